@@ -0,0 +1,35 @@
+#ifndef ACCOUNTS_HPP
+#define ACCOUNTS_HPP
+
+#include <string>
+#include <unordered_map>
+
+/*
+Local accounts for SASL (IRCSERV_ACCOUNTS=<file>): one "name:hash" per
+line, the hash in crypt(3) format as libcrypt knows it (yescrypt "$y$",
+bcrypt "$2b$", sha512crypt "$6$", ...). Empty lines and lines starting
+with '#' are skipped. Names are case-insensitive.
+*/
+struct Account
+{
+	std::string	name;
+	std::string	hash;
+};
+
+class Accounts
+{
+	private:
+		std::unordered_map<std::string, Account>	entries;	// lowercase name -> account
+
+	public:
+		void			load(const std::string &path);
+		bool			empty() const { return entries.empty(); }
+		size_t			size() const { return entries.size(); }
+		const Account	*find(const std::string &name) const;
+		std::string		decoy() const;
+
+		// slow on purpose, meant for a worker thread
+		static bool		verify(const std::string &password, const std::string &hash);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstdint>
+#include <memory_resource>
+
+/*
+Memory for what one round of the event loop parses and drops again: the
+received commands (cmd), their parameters (parseArgs) and the target
+lists split out of them (commaSplit). A monotonic arena hands it out by
+bumping a pointer through a block kept for the whole run, and
+Server::iterate() takes all of it back at once when the round ends, so
+none of it is a malloc or a free. A round that needs more than the block
+borrows from the heap until the reset; those chunks are counted.
+
+Nothing from here may outlive the round. Copying a std::pmr::string (or
+a cmd) puts the copy on the heap, which is how held commands and
+suspended handlers keep theirs.
+*/
+class Arena
+{
+	private:
+		static std::pmr::monotonic_buffer_resource	resource;
+
+	public:
+		static uint64_t	spills;		// heap chunks borrowed by rounds that outgrew the block
+
+		Arena() = delete;
+		static std::pmr::memory_resource	*get() { return &resource; }
+		static void							reset() { resource.release(); }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstdint>
+
+/*
+Traffic capture (IRCSERV_CAPTURE=<file>): every line a client sends is
+appended to a binary file as parsed by IO::recvCommands, with the time
+since the previous record, so tools/ircreplay can play it against
+another build. Passwords (PASS, OPER, SASL payloads) are replaced by '*'.
+
+File: segments, each a header followed by records. A server started
+by a hot upgrade appends a new segment that starts with REMAP records
+(old fd -> new fd) for the connections it took over.
+	header:	"IRCCAP" u8 version u8 0 u64 start (µs since the epoch, little endian)
+	record:	u8 kind, varint µs since the previous record, varint fd
+			LINE adds varint length + the line without CRLF,
+			REMAP adds varint old fd
+*/
+
+#define CAPTURE_MAGIC	"IRCCAP"
+#define CAPTURE_VERSION	1
+
+enum CaptureKind : uint8_t { CAPTURE_OPEN = 1, CAPTURE_LINE = 2, CAPTURE_CLOSE = 3, CAPTURE_REMAP = 4 };
+
+class Capture
+{
+	public:
+		Capture() = delete;
+		static void	start(const char *path);
+		static void	stop();
+		static bool	enabled() { return file != nullptr; }
+		static void	opened(const int fd);
+		static void	line(const int fd, std::string_view line);
+		static void	closed(const int fd);
+		static void	remapped(const int oldFd, const int newFd);
+		static void	flush();
+
+	private:
+		static FILE		*file;
+		static uint64_t	last;		// monotonic µs of the previous record
+		static uint64_t	flushed;	// monotonic µs of the last flush
+
+		static void	record(CaptureKind kind, const int fd);
+		static void	varint(uint64_t v);
+};
+
+#endif
@@ -10,12 +10,20 @@
 #include <exception>
 #include <optional>
 #include <set>
+#include <ctime>
+#include "Mask.hpp"
 
 // Forward declaration of User
 class User;
 
 using namespace std;
 
+// ":<server> 353 <nick> = " + " :" with a 63 character server name and a 9 character nick
+#define NAMES_HEADER_MAX 83
+#define NAMES_LINE_MAX 510
+#define MAXLIST 100 // entries per +b, +e and +I list
+
+
 class Channel {
 private:
     std::string ChannelName;
@@ -27,11 +35,43 @@ private:
     bool inviteOnly;
     bool topic_restriction;
     unsigned int userLimit;
+    time_t createdAt;
+    time_t topicSetAt;
+
+    /*
+    RPL_NAMREPLY bodies ("@op nick ..."), each short enough to fit one
+    512 byte line, kept up to date on every membership, op and nick
+    change so JOIN only has to prepend the header. Chunks emptied by
+    parts stay in place and are refilled first. A member only costs the
+    index of their chunk: the entry is rendered again to find it, so it
+    has to be erased before the nick or op status it shows changes.
+    */
+    std::vector<std::string> namesChunks;
+    std::vector<size_t> namesFree;
+    std::map<int, size_t> namesSlots;
+
+    std::string namesEntry(int fd, const std::string& nickname) const;
+    void namesInsert(int fd);
+    void namesErase(int fd, const std::string& entry);
+
+    // +b, +e and +I, and per member verdicts valid until either side changes
+    MaskList bans, exceptions, inviteExceptions;
+    unsigned long listsVersion = 0;
+    struct Verdict {
+        unsigned long maskId;
+        unsigned long listsVersion;
+        bool banned;
+        bool inviteExcepted;
+    };
+    mutable std::map<int, Verdict> verdicts;
+
+    Verdict verdict(const User& user) const;
+    MaskList& maskList(char mode);
 
 public:
-    Channel() : ChannelName(""), ChannelTopic(""), password(""), inviteOnly(false), topic_restriction(false), userLimit(999) {}
-    Channel(const std::string& name) : ChannelName(name), inviteOnly(false), topic_restriction(false), userLimit(999) {}
-    Channel(const std::string& name, const std::string& pw) : ChannelName(name), ChannelTopic(""), password(pw), inviteOnly(false), topic_restriction(false), userLimit(999) {}
+    Channel() : ChannelName(""), ChannelTopic(""), password(""), inviteOnly(false), topic_restriction(false), userLimit(999), createdAt(time(nullptr)), topicSetAt(0) {}
+    Channel(const std::string& name) : ChannelName(name), inviteOnly(false), topic_restriction(false), userLimit(999), createdAt(time(nullptr)), topicSetAt(0) {}
+    Channel(const std::string& name, const std::string& pw) : ChannelName(name), ChannelTopic(""), password(pw), inviteOnly(false), topic_restriction(false), userLimit(999), createdAt(time(nullptr)), topicSetAt(0) {}
 
     // Getters
     std::string getChannelName() const { return ChannelName; }
@@ -43,18 +83,23 @@ public:
     bool isInviteOnly() const { return inviteOnly; }
     bool isTopicRestricted() const { return topic_restriction; }
     unsigned int getUserLimit() const { return userLimit; }
+    time_t getCreatedAt() const { return createdAt; }
+    time_t getTopicSetAt() const { return topicSetAt; }
+    const std::vector<std::string>& getNamesChunks() const { return namesChunks; }
 
     // Setters
     void setChannelName(const std::string& name) { ChannelName = name; }
-    void setChannelTopic(const std::string& topic) { ChannelTopic = topic; }
+    void setChannelTopic(const std::string& topic) { ChannelTopic = topic; topicSetAt = time(nullptr); }
     void setPassword(const std::string& pass) { password = pass; }
     void setInviteOnly(bool status) { inviteOnly = status; }
     void setTopicRestriction(bool status) { topic_restriction = status; }
     void setUserLimit(unsigned int limit) { userLimit = limit; }
+    void setTimes(time_t created, time_t topicSet) { createdAt = created; topicSetAt = topicSet; }
 
     // User management
     void addUser(int fd, User* user);
     void removeUser(int fd);
+    void renameUser(int fd, const std::string& oldNickname);
     std::optional<std::map<int, User*>::iterator> findUser(int fd);
     std::optional<std::map<int, User*>::const_iterator> findUser(int fd) const;
     std::optional<std::map<int, User*>::iterator> findUserByNickname(const std::string& nickname);
@@ -65,5 +110,12 @@ public:
     void addOperator(const User& user);
     void removeOperator(const User& user);
     bool isOperator(const User& user) const;
+
+    // Ban, exception and invite-exception lists ('b', 'e', 'I')
+    const MaskList& getMaskList(char mode) const;
+    int addMask(char mode, const std::string& mask, const std::string& setBy, time_t setAt = time(nullptr));
+    bool removeMask(char mode, const std::string& mask);
+    bool isBanned(const User& user) const { return verdict(user).banned; }
+    bool isInviteExcepted(const User& user) const { return verdict(user).inviteExcepted; }
 };
 #endif
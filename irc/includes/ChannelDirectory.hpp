@@ -0,0 +1,101 @@
+#ifndef CHANNELDIRECTORY_HPP
+#define CHANNELDIRECTORY_HPP
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <limits>
+#include <ctime>
+#include "Mask.hpp"
+
+class Channel;
+
+/*
+One LIST request: ELIST conditions plus where the last page stopped.
+Pages are produced in name order, or in member count order when a
+user-count condition lets the count index skip non-matching channels.
+*/
+struct ListQuery
+{
+	size_t				minUsers = 0;
+	size_t				maxUsers = std::numeric_limits<size_t>::max();
+	time_t				createdAfter = 0, createdBefore = std::numeric_limits<time_t>::max();
+	time_t				topicAfter = 0, topicBefore = std::numeric_limits<time_t>::max();
+	std::vector<Mask>	masks;		// M: any of them must match
+	std::vector<Mask>	notMasks;	// N: none may match
+
+	bool				started = false;
+	std::string			lastKey;
+	size_t				lastUsers = 0;
+
+	bool	parse(const std::string &conditions);
+	bool	byUsers() const { return minUsers > 0 || maxUsers != std::numeric_limits<size_t>::max(); }
+	bool	accepts(const Channel &channel) const;
+};
+
+/*
+Channels by lowercase name and by member count, kept current by the
+server on every join, part and channel removal.
+*/
+class ChannelDirectory
+{
+	private:
+		struct Entry {
+			const Channel	*channel;
+			size_t			users;
+		};
+		std::map<std::string, Entry>				byName;
+		std::set<std::pair<size_t, std::string>>	byCount;
+
+	public:
+		void	update(const std::string &key, const Channel &channel);
+		void	remove(const std::string &key);
+		void	clear();
+		size_t	size() const { return byName.size(); }
+
+		template <class F>
+		bool	page(ListQuery &q, size_t limit, F emit) const;
+};
+
+/*
+Visits up to limit channels after the query's cursor and emits the ones
+the query accepts, so one page costs the same whatever the filters are.
+Returns true once the listing is complete.
+*/
+template <class F>
+bool	ChannelDirectory::page(ListQuery &q, size_t limit, F emit) const
+{
+	if (q.byUsers()) {
+		auto it = q.started ? byCount.upper_bound({q.lastUsers, q.lastKey})
+			: byCount.lower_bound({q.minUsers, ""});
+		for (; it != byCount.end() && it->first <= q.maxUsers; ++it) {
+			if (limit == 0)
+				return false;
+			q.started = true;
+			q.lastUsers = it->first;
+			q.lastKey = it->second;
+			const Entry &entry = byName.at(it->second);
+			if (q.accepts(*entry.channel))
+				emit(*entry.channel, entry.users);
+			limit--;
+		}
+		return true;
+	}
+
+	// a single mask with a literal prefix only needs that range of names
+	std::string prefix = (q.masks.size() == 1) ? q.masks[0].literalPrefix() : "";
+	auto it = q.started ? byName.upper_bound(q.lastKey) : byName.lower_bound(prefix);
+	for (; it != byName.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+		if (limit == 0)
+			return false;
+		q.started = true;
+		q.lastKey = it->first;
+		if (q.accepts(*it->second.channel))
+			emit(*it->second.channel, it->second.users);
+		limit--;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef CHANNELTABLE_HPP
+#define CHANNELTABLE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include "Channel.hpp"
+
+/*
+The server's channels by casemapped name (CASEMAPPING=ascii). Open
+addressing with linear probing; names are hashed and compared folding
+case on the fly, so a lookup allocates nothing. Every channel lives in
+its own allocation that only the slot pointing at it moves, so a
+Channel& stays valid across rehashing until the channel is erased.
+Erasing shifts the rest of the probe run back instead of leaving
+tombstones, and must not happen while iterating.
+*/
+class ChannelTable
+{
+	public:
+		struct Entry {
+			const std::string	key;		// lowercase name, as the channel directory files it
+			Channel				channel;
+		};
+
+	private:
+		struct Slot {
+			size_t					hash = 0;
+			std::unique_ptr<Entry>	entry;		// null when free
+		};
+		std::vector<Slot>	slots;				// power of two, at most 3/4 full
+		size_t				count = 0;
+
+		size_t	locate(std::string_view name, size_t hash) const;
+		void	grow();
+
+		template <class S, class E>
+		class Iterator {
+			S	*at, *end;
+
+			void	skip() { while (at != end && !at->entry) ++at; }
+		public:
+			Iterator(S *at, S *end) : at(at), end(end) { skip(); }
+			E			&operator*() const { return *at->entry; }
+			E			*operator->() const { return at->entry.get(); }
+			Iterator	&operator++() { ++at; skip(); return *this; }
+			bool		operator!=(const Iterator &other) const { return at != other.at; }
+		};
+
+	public:
+		typedef Iterator<Slot, Entry>				iterator;
+		typedef Iterator<const Slot, const Entry>	const_iterator;
+
+		static size_t	hash(std::string_view name);
+		static bool		equal(std::string_view key, std::string_view name);
+
+		Entry		*find(std::string_view name);
+		const Entry	*find(std::string_view name) const;
+		Entry		&insert(const std::string &name, Channel &&channel);	// the existing entry if there is one
+		bool		erase(std::string_view name);
+		void		clear() { slots.clear(); count = 0; }
+		size_t		size() const { return count; }
+
+		iterator		begin() { return {slots.data(), slots.data() + slots.size()}; }
+		iterator		end() { return {slots.data() + slots.size(), slots.data() + slots.size()}; }
+		const_iterator	begin() const { return {slots.data(), slots.data() + slots.size()}; }
+		const_iterator	end() const { return {slots.data() + slots.size(), slots.data() + slots.size()}; }
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <vector>
+#include "IO.hpp"
+
+enum log_level : int;
+
+/*
+Server settings (IRCSERV_CONFIG=<file>): one "key = value" per line,
+a '#' at the start of a line or after a blank starts a comment. Unknown
+keys and bad values are errors, reported with the line. Without a file,
+and for keys the file leaves out, the older IRCSERV_* variables still
+apply, then the defaults below.
+SIGHUP loads the file again; a file that does not parse leaves the
+running settings alone. Everything but events, capture, tls_cert,
+tls_key and ports applies to live connections.
+*/
+struct Config
+{
+	std::string			path;
+
+	// server
+	std::string			name = "IRCS";
+	std::string			password;				// overrides the one given on the command line
+	int					portMin = 6660, portMax = 6669;	// allowed for the port argument, besides 6697
+	std::vector<int>	listen;					// more plaintext ports
+	int					backlog = 1024;
+	std::string			tlsCert, tlsKey;
+	std::string			events;					// epoll, poll or uring
+	std::string			accounts;
+	std::string			capture;
+	std::string			operPassword;
+	log_level			logLevel{};				// DEBUG
+	std::string			trace;					// spans are recorded and SIGUSR1 writes them here
+	unsigned			slowCommand = 50;		// ms, commands that take longer go to the slow log
+	unsigned			slowLoop = 100;			// ms, loop iterations that take longer are logged
+	unsigned			watchdog = 0;			// ms, the loop's stack is dumped when it is stuck that long
+
+	// limits
+	size_t				maxClients = 0;			// connected at once, 0: as many as the fd limit allows
+	size_t				targMax = 4;			// PRIVMSG/NOTICE targets per message
+	size_t				modesMax = 4;			// mode changes with a parameter per MODE command
+	IOLimits			io;						// queues and flood control
+	size_t				heldMax = 100;			// commands a client may send while its handler is suspended
+
+	// sockets, 0 leaves the kernel's choice
+	bool				tcpNoDelay = true;
+	int					sendBuffer = 0;
+	int					recvBuffer = 0;
+	int					notSentLowat = 0;
+	int					busyPoll = 0;			// microseconds
+	bool				keepalive = false;
+	int					keepIdle = 0, keepInterval = 0, keepCount = 0;
+
+	static Config	load(const char *path);
+	bool			tune(int fd) const;			// socket options, false if one was refused
+};
+
+#endif
@@ -200,4 +200,28 @@
 // "<client> <nick> :Erroneous user format"
 // Returned when the given USER's args is invalid (e.g., contains forbidden characters).
 
+#define ERR_INVALIDCAPCMD 410
+// "<client> <subcommand> :Invalid CAP command"
+// Returned when a client sends a CAP subcommand the server does not know.
+
+#define ERR_MONLISTFULL 734
+// "<client> <limit> <targets> :Monitor list is full."
+// Returned when a MONITOR + would take the client's list over MONITOR_MAX.
+
+#define ERR_INVALIDMODEPARAM 696
+// "<client> <target chan/user> <mode char> <parameter> :<description>"
+// Returned when a mode parameter is not valid for its mode, such as a limit that is not a number.
+
+#define ERR_SASLFAIL 904
+// "<client> :SASL authentication failed"
+
+#define ERR_SASLTOOLONG 905
+// "<client> :SASL message too long"
+
+#define ERR_SASLABORTED 906
+// "<client> :SASL authentication aborted"
+
+#define ERR_SASLALREADY 907
+// "<client> :You have already authenticated using SASL"
+
 #endif // IRC_ERROR_CODES_HPP
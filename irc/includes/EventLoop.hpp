@@ -0,0 +1,114 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+struct Event
+{
+	enum Kind { ACCEPT, READABLE, WRITABLE };
+	Kind	kind;
+	int		fd;			// ACCEPT: the new client, or -1 with errno in error
+	int		listener;	// ACCEPT only
+	int		error;
+};
+
+/*
+What the server loop needs from an event backend: listening sockets
+produce ACCEPT events with the new client already accepted, clients
+produce READABLE (read() has data, EOF or an error) and WRITABLE (the
+last write() went out, flush more).
+
+A client is either a stream, whose bytes the backend moves itself with
+read()/write(), or readiness only (TLS: OpenSSL does the socket IO and
+the backend just reports POLLIN/POLLOUT as asked by setEvents()).
+*/
+class EventLoop
+{
+	public:
+		virtual ~EventLoop() = default;
+
+		virtual const char	*name() const = 0;
+		virtual void		addListener(int fd) = 0;
+		virtual void		add(int fd, bool stream) = 0;
+		virtual void		remove(int fd) = 0;	// before the fd is closed
+		virtual void		setEvents(int fd, short events) = 0;
+		virtual void		wait(int timeoutMs, std::vector<Event> &events) = 0;
+
+		// like recv()/send() on a non-blocking socket: -1 with EAGAIN when nothing can move
+		virtual ssize_t		read(int fd, std::string &out) = 0;
+		virtual ssize_t		write(int fd, const char *data, size_t len) = 0;
+
+		// ends a client connection after remove(): shutdown and close for sockets
+		virtual void		close(int fd);
+		// CLOCK_MONOTONIC in seconds, for rate limits; a simulated network keeps its own
+		virtual double		now() const;
+
+		// hot upgrade: stop all socket IO; read() still hands out what already arrived
+		virtual void		quiesce() {}
+		virtual void		resume() {}
+		// bytes write() took that never reached the socket, after quiesce()
+		virtual std::string	takeUnsent(int) { return ""; }
+
+		// events in the config: "epoll" (default), "poll" or "uring" (SimNet is built by hand)
+		static std::unique_ptr<EventLoop>	create(const char *kind);
+};
+
+// poll(2) over every socket, one recv()/send() per ready client
+class PollLoop : public EventLoop
+{
+	private:
+		std::vector<pollfd>				fds;
+		std::unordered_map<int, size_t>	slot;		// fd -> index in fds
+		std::vector<bool>				listening;	// per index
+
+	public:
+		const char	*name() const override { return "poll"; }
+		void		addListener(int fd) override;
+		void		add(int fd, bool stream) override;
+		void		remove(int fd) override;
+		void		setEvents(int fd, short events) override;
+		void		wait(int timeoutMs, std::vector<Event> &events) override;
+		ssize_t		read(int fd, std::string &out) override;
+		ssize_t		write(int fd, const char *data, size_t len) override;
+};
+
+#define EPOLL_LISTENER	(1ULL << 32)	// in epoll_event.data, next to the fd
+#define EPOLL_BATCH_MAX	65536			// ready events taken per wait, at most
+
+/*
+epoll(7), level-triggered: the kernel keeps the interest set, so a wait
+costs the ready sockets only, not every connection as with poll. The
+batch grows while waits fill it.
+*/
+class EpollLoop : public EventLoop
+{
+	private:
+		int								epfd;
+		std::vector<epoll_event>		ready;
+		std::unordered_map<int, short>	interest;	// client fd -> events, to skip redundant epoll_ctl
+
+		void	control(int op, int fd, uint32_t events, bool listener = false);
+
+	public:
+		EpollLoop();
+		~EpollLoop() override;
+		EpollLoop(const EpollLoop &) = delete;
+		EpollLoop &operator=(const EpollLoop &) = delete;
+
+		const char	*name() const override { return "epoll"; }
+		void		addListener(int fd) override;
+		void		add(int fd, bool stream) override;
+		void		remove(int fd) override;
+		void		setEvents(int fd, short events) override;
+		void		wait(int timeoutMs, std::vector<Event> &events) override;
+		ssize_t		read(int fd, std::string &out) override;
+		ssize_t		write(int fd, const char *data, size_t len) override;
+};
+
+#endif
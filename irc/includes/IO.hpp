@@ -3,28 +3,128 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <map>
+#include <cstdint>
+#include <string_view>
+#include "Arena.hpp"
 
+// received commands live in the Arena until the end of the loop round, a copy is on the heap
 struct cmd
 {
-	std::string prefix;
-	std::string command;
-	std::string arguments;
+	std::pmr::string prefix;
+	std::pmr::string command;
+	std::pmr::string arguments;
+	std::pmr::string tags = "";	// IRCv3 message tags, without the leading '@'
+
+	// the same command with other arguments, for the replies that quote them
+	cmd with(std::string_view other) const {
+		return {{}, command, std::pmr::string(other, Arena::get())};
+	}
+};
+
+// IRCv3 capabilities, one bit each in Connection::caps
+enum Capability : unsigned {
+	CAP_BATCH				= 1 << 0,
+	CAP_LABELED_RESPONSE	= 1 << 1,
+	CAP_SERVER_TIME			= 1 << 2,
+	CAP_MULTI_PREFIX		= 1 << 3,
+	CAP_ECHO_MESSAGE		= 1 << 4,
+	CAP_SASL				= 1 << 5
+};
+
+#define RECVQ_MAX		16384		// bytes of one unfinished line a client may hold (tags + 512)
+#define SENDQ_MAX		(512 << 10)	// bytes queued for one slow reader before it is dropped
+#define QUEUES_MAX		(256 << 20)	// all send and receive queues together
+
+// queue and flood limits, set from the config (see Config.hpp)
+struct IOLimits
+{
+	size_t	recvQ = RECVQ_MAX;
+	size_t	sendQ = SENDQ_MAX;
+	size_t	queues = QUEUES_MAX;
+	double	floodBurst = 0;		// commands a client may send at once, 0 turns flood control off
+	double	floodRate = 2;		// commands per second once the burst is spent
+};
+
+// per-connection transport state
+// labeled-response: the label of the running command and the replies held back for it
+struct Labeled
+{
+	std::string					label;
+	std::vector<std::string>	lines;
+};
+
+struct Connection
+{
+	std::string					input;		// RecvQ: received bytes not yet parsed into commands
+	std::string					output;		// SendQ: bytes the socket has not taken yet
+	size_t						sent = 0;	// of output, already written
+	std::string					closing;	// why the connection has to be dropped, if it has
+	unsigned					caps = 0;	// negotiated Capability bits
+	std::unique_ptr<Labeled>	labeled;	// while a labeled command runs, null otherwise
+	double						credit = -1;	// flood control: commands left, -1 until the first one
+	double						creditAt = 0;	// when credit was last topped up
 };
 
 class User;
+class EventLoop;
+
+// queue totals across all connections, for STATS z
+struct QueueStats
+{
+	size_t	recvQ = 0;
+	size_t	sendQ = 0;
+	size_t	largestSendQ = 0;
+	size_t	evicted = 0;
+};
 
 class IO
 {
+	private:
+		static std::map<int, Connection>	connections;
+		static unsigned						batchId;
+		static QueueStats					totals;
+		static std::vector<int>				dropped;	// connections marked closing, not yet reaped
+		static std::vector<int>				flipped;	// SendQ became empty or stopped being, see takeFlipped
+		static EventLoop					*loop;		// moves the bytes of non-TLS connections
+		static IOLimits						limits;
+		static uint64_t						messages;	// queued to any client since the start
+
+		static std::string	frame(const Connection &conn, const std::vector<std::string> &lines);
+		static ssize_t		transmit(const int fd, const std::string &message);
+		static size_t		write(const int fd, Connection &conn, const char *data, size_t len);
+		static void			drop(const int fd, Connection &conn, const std::string &reason);
+
 	public:
 		IO() = delete;
-		static std::vector<cmd> recvCommands(const int fd);
+		static void setLoop(EventLoop *l) { loop = l; }
+		static void setLimits(const IOLimits &l) { limits = l; }
+		static const IOLimits &getLimits() { return limits; }
+		static bool admit(const int fd);
+		static uint64_t queuedMessages() { return messages; }
+		static Connection &connection(const int fd) { return connections[fd]; }
+		static void forget(const int fd);
+		static void flush(const int fd);
+		static bool wantsWrite(const int fd);
+		static size_t queued(const int fd);
+		static std::vector<int> takeDropped();
+		static std::vector<int> takeFlipped();
+		static QueueStats stats();
+		static unsigned caps(const int fd);
+		static void beginLabel(const int fd, const std::string &label);
+		static void endLabel(const int fd, const std::string &server);
+		static std::pmr::vector<cmd> recvCommands(const int fd);
 		static ssize_t sendCommand(const int fd, const cmd &cmd);
 		static ssize_t sendString(const int fd, const std::string &s);
 		static ssize_t sendCommandAll(const std::map<int, User*> &m, const cmd &cmd);
 		static ssize_t sendCommandAll(const std::map<std::string, User*> &m, const cmd &cmd);
 		static ssize_t sendStringAll(const std::map<int, User*> &m, const std::string &s);
 		static ssize_t sendStringAll(const std::map<std::string, User*> &m, const std::string &s);
+		static const std::string &getPending(const int fd);
+		static void setPending(const int fd, const std::string &s);
+		static std::string getQueued(const int fd);
+		static void setQueued(const int fd, const std::string &s);
 };
 
 #endif
\ No newline at end of file
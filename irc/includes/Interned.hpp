@@ -0,0 +1,37 @@
+#ifndef INTERNED_HPP
+#define INTERNED_HPP
+
+#include <string>
+#include <unordered_map>
+
+/*
+A string that rarely changes and is often the same for many users
+(host, server and real names, accounts), stored once in a shared pool
+and counted: a handle is one pointer instead of a std::string, and a
+thousand clients that all say "localhost" share one copy. The empty
+string takes no pool entry. Loop thread only.
+*/
+class Interned
+{
+	private:
+		typedef std::unordered_map<std::string, size_t>	Pool;	// text -> handles using it
+		Pool::value_type	*entry = nullptr;
+
+		static Pool	&pool();
+		static Pool::value_type	*acquire(const std::string &text);
+		void	release();
+
+	public:
+		Interned() {}
+		Interned(const std::string &text) : entry(acquire(text)) {}
+		Interned(const Interned &other) : entry(other.entry) { if (entry) entry->second++; }
+		~Interned() { release(); }
+		Interned	&operator=(const Interned &other);
+		Interned	&operator=(const std::string &text);
+
+		const std::string	&str() const;
+		bool				empty() const { return !entry; }
+		static size_t		distinct() { return pool().size(); }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef MASK_HPP
+#define MASK_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <ctime>
+
+/*
+Case-insensitive glob ('*' any run, '?' one character) compiled once.
+The pattern is cut at its stars into literal segments: the first is
+anchored at the start, the last at the end and the ones in between are
+searched leftmost-first, so matching never backtracks.
+*/
+class Mask
+{
+	private:
+		std::vector<std::string>	segments;
+		std::string					prefix;		// literal characters before the first wildcard
+		std::string					suffix;		// literal characters after the last wildcard
+		bool						anchoredStart;
+		bool						anchoredEnd;
+		size_t						minLength;
+
+		static bool	segmentAt(const std::string &segment, const std::string &s, size_t pos);
+
+	public:
+		Mask() : segments(1), anchoredStart(true), anchoredEnd(true), minLength(0) {}
+		explicit Mask(const std::string &pattern);
+
+		bool				matches(const std::string &s) const;
+		const std::string	&literalPrefix() const { return prefix; }
+		const std::string	&literalSuffix() const { return suffix; }
+		bool				isLiteral() const { return segments.size() == 1 && anchoredStart && anchoredEnd; }
+};
+
+/*
+A channel's ban, exception or invite-exception list. Each mask is
+compiled once and filed under its literal suffix, or its literal prefix
+when it ends in a wildcard, so a lookup only tries the masks whose
+fixed part occurs at the end (or start) of the target; masks with
+neither are always tried.
+*/
+class MaskList
+{
+	public:
+		struct Entry {
+			std::string	mask;
+			std::string	setBy;
+			time_t		setAt;
+		};
+
+	private:
+		std::vector<Entry>										entries;
+		std::vector<Mask>										compiled;
+		std::unordered_map<std::string, std::vector<size_t>>	bySuffix, byPrefix;
+		std::map<size_t, size_t>								suffixLengths, prefixLengths; // length -> masks
+		std::vector<size_t>										unanchored;
+
+		void	file(size_t i);
+		void	refile();
+
+	public:
+		bool						add(const std::string &mask, const std::string &setBy, time_t setAt);
+		bool						remove(const std::string &mask);
+		bool						matches(const std::string &target) const;
+		const std::vector<Entry>	&list() const { return entries; }
+		size_t						size() const { return entries.size(); }
+};
+
+/*
+Ordered lowercase key -> fd index, used as a prefix tree: all keys
+starting with a prefix are one contiguous range.
+*/
+class PrefixIndex
+{
+	private:
+		std::set<std::pair<std::string, int>>	entries;
+
+	public:
+		void	insert(const std::string &key, int fd);
+		void	erase(const std::string &key, int fd);
+		void	clear() { entries.clear(); }
+
+		template <class F>
+		void	scan(const std::string &prefix, F f) const {
+			for (auto it = entries.lower_bound({prefix, -1});
+				it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+				f(it->second);
+		}
+};
+
+#endif
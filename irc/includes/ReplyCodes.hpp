@@ -35,4 +35,34 @@
 // PONG message
 
 #define RPL_ENDOFNAMES 366
-// after RPL_NAMREPLY is complete, send a message signifying that was all
\ No newline at end of file
+// after RPL_NAMREPLY is complete, send a message signifying that was all
+
+#define RPL_WHOISACCOUNT 330
+// "<client> <nick> <account> :is logged in as"
+
+#define RPL_LOGGEDIN 900
+// "<client> <nick>!<user>@<host> <account> :You are now logged in as <account>"
+
+#define RPL_SASLSUCCESS 903
+// "<client> :SASL authentication successful"
+
+#define RPL_SASLMECHS 908
+// "<client> <mechanisms> :are available SASL mechanisms"
+
+#define RPL_USERHOST 302
+// "<client> :[<reply>{ <reply>}]", reply = nick['*']'='('+'|'-')user@host
+
+#define RPL_ISON 303
+// "<client> :[<nickname>{ <nickname>}]"
+
+#define RPL_MONONLINE 730
+// "<client> :target[!user@host][,target[!user@host]]*"
+
+#define RPL_MONOFFLINE 731
+// "<client> :target[,target2]*"
+
+#define RPL_MONLIST 732
+// "<client> :target[,target2]*"
+
+#define RPL_ENDOFMONLIST 733
+// "<client> :End of MONITOR list"
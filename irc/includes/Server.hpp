@@ -3,6 +3,7 @@
 
 #include "../includes/IO.hpp"
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <cstring>
 #include <csignal>
@@ -25,76 +26,202 @@
 #include "ReplyCodes.hpp"
 #include <regex>
 #include "Utils.hpp"
+#include "Tls.hpp"
+#include "Mask.hpp"
+#include "ChannelDirectory.hpp"
+#include "ChannelTable.hpp"
+#include "EventLoop.hpp"
+#include "Capture.hpp"
+#include "Task.hpp"
+#include "Workers.hpp"
+#include "Accounts.hpp"
+#include "Config.hpp"
+#include "Trace.hpp"
+#include "Watchdog.hpp"
+#include <deque>
 
 using namespace std;
 
 class User;
 
+// commands of a client that arrived while one of its handlers was suspended
+struct Held
+{
+	unsigned long	id;			// of the suspension, a reused fd gets a new one
+	deque<cmd>		commands;
+};
+
+#define SLOWLOG_MAX	64	// slow commands kept for STATS s
+#define MONITOR_MAX	100	// nicks one client may monitor (MONITOR in 005)
+#define FD_RESERVE	64	// descriptors kept out of max_clients: listeners, files, workers, the ring
+
+// a command that took longer than slow_command
+struct SlowCommand
+{
+	time_t		at;
+	string		command;
+	string		arguments;	// cut short, passwords masked
+	string		nick;
+	uint64_t	duration;	// ns
+	uint64_t	fanout;		// messages queued to clients
+};
+
+// a WHO reply still being paged out: the matches, and how far it got
+struct WhoQuery
+{
+	string		mask;
+	string		channel;	// the channel asked for, empty for a user mask
+	vector<int>	targets;
+	size_t		next = 0;
+};
+
+// event loop iterations, for STATS s
+struct LoopStats
+{
+	uint64_t	iterations = 0;
+	uint64_t	slow = 0;		// over slow_loop
+	uint64_t	longest = 0;	// ns
+};
+
 class Server
 {
 	private:
+		Config							config;		// see IRCSERV_CONFIG, reloaded on SIGHUP
 		map<int, User>					users;
-		map<string, Channel>			channels;
-		vector<pollfd>					fds;
+		unordered_map<string, int>		nickIndex;	// lowercase nick -> fd
+		unordered_map<string, int>		userIndex;	// lowercase username -> fd
+		unordered_map<string, unsigned>	userSuffix;	// next suffix to try per taken username
+		PrefixIndex						nickPrefixes, userPrefixes, hostPrefixes; // for WHO masks
+		ChannelTable					channels;
+		ChannelDirectory				directory;		// LIST view of channels, kept in sync
+		map<int, ListQuery>				pendingLists;	// LIST replies still being paged out
+		map<int, WhoQuery>				pendingWhos;	// WHO replies still being paged out
+		map<int, Held>					held;			// clients waiting for a suspended handler
+		unordered_map<string, set<int>>	watchers;		// lowercase nick -> clients monitoring it
+		map<int, map<string, string>>	monitored;		// client -> lowercase nick -> nick as given
+		deque<SlowCommand>				slowLog;		// newest last
+		LoopStats						loopStats;
+		unsigned long					nextHold = 0;
+		Accounts						accounts;		// SASL, see IRCSERV_ACCOUNTS
+		unique_ptr<EventLoop>			loop;			// epoll, poll or io_uring, see IRCSERV_EVENTS
+		vector<int>						_listenerFds;
 		static volatile sig_atomic_t	running;
-		const string					_name = "IRCS";
+		static volatile sig_atomic_t	upgrading;
+		static volatile sig_atomic_t	reloading;
+		static volatile sig_atomic_t	dumping;	// SIGUSR1: write the trace
+		string							_name;
 		const int						_port;
-		const string					_password;
-		const int						_maxClients = 1024;
+		const string					_password;	// from the command line, config.password overrides it
+		int								_tlsListener = -1;
+		size_t							_fdLimit = 0;	// RLIMIT_NOFILE once raised
+		vector<Event>					events;			// of the current loop iteration
+		int								_spareFd = -1;	// given up to turn clients away when out of fds
+		vector<pair<string, string>>	_welcome;	// burst lines around the nick, rendered once
 
-		void 	handleNewClient();
-		void 	handleClientMessages(size_t *index);
+		void	openLoop();
+		void	raiseFdLimit();
+		size_t	clientLimit() const;
+		void	shedClient(int listener);
+		void	loadAccounts();
+		void	applyConfig();
+		void	reload();
+		void	syncListeners();
+		void	noteSlow(const cmd &cmd, const string &nick, uint64_t duration, uint64_t fanout);
+		void 	handleNewClient(const Event &event);
+		void 	handleClientMessages(const Event &event);
+		bool	handleHandshake(int fd);
+		void	updatePollEvents();
+		void	reapDropped();
 		void 	cleanup();
 		void 	process_message(int clientFd, string buffer);
-		int		createSocket();
-		void 	execute_command(cmd cmd, User &user);
-		void 	process_privmsg(cmd cmd, const User &user);
+		int		createSocket(int port);
+		void	openListeners();
+		void 	execute_command(const cmd &cmd, User &user);
+		void 	process_privmsg(const cmd &cmd, const User &user);
 		string 	client_info(struct sockaddr_in &client_addr);
 
+		// hot upgrade
+		bool	hotUpgrade();
+		string	serializeState(const set<int> &leaving);
+		map<int, string>	restoreState(const string &blob, const map<int, int> &fdMap);
+
 		// helper functions:
-		bool	_nickIsUsed(string nick);
-		bool	_userIsUsed(string username);
+		bool	_nickIsUsed(const string &nick, int self = -1);
+		string	_uniqueUsername(const string &username);
+		void	indexNick(int fd, const string &nick);
+		void	indexUser(const User &user);
+		void	unindexUser(const User &user);
+		vector<const User *>	whoMatches(const string &pattern);
+		string	whoReply(const User &user, const User &target, const string &channel, bool isOp);
+		void	completeRegistration(User &user);
+		void	renderWelcome();
+		void	channelChanged(const string &name);
+		void	continueList(int fd);
+		void	continueWho(int fd);
+		bool	listsReady();
+		unsigned long	hold(int fd);
+		bool	resumed(int fd, unsigned long id);
+		void	release(int fd);
+		void	watch(int fd, const string &nick);
+		void	unwatch(int fd, const string &key);
+		void	unwatchAll(int fd);
+		void	notifyWatchers(const string &nick, const User *online);
+		void	sendMonitorStatus(const User &user, const vector<string> &nicks);
 
 		// Commands
-		int		PASS(cmd cmd, User &user);
-		int		NICK(cmd cmd, User &user);
-		int		USER(cmd cmd, User &user);
-		int		JOIN(cmd cmd, User &user);
-		int		PING(cmd cmd, User &user);
-		int		PONG(cmd cmd, User &user);
-		// int		OPER(cmd cmd, User &user);
-		int		PRIVMSG(cmd cmd, User &user);
-		int		QUIT(cmd cmd, User &user);
-		int		PART(cmd cmd, User &user);
-		int		WHOIS(cmd cmd, User &user);
+		int		PASS(const cmd &cmd, User &user);
+		int		NICK(const cmd &cmd, User &user);
+		int		USER(const cmd &cmd, User &user);
+		int		JOIN(const cmd &cmd, User &user);
+		int		PING(const cmd &cmd, User &user);
+		int		PONG(const cmd &cmd, User &user);
+		int		OPER(const cmd &cmd, User &user);
+		int		STATS(const cmd &cmd, User &user);
+		int		PRIVMSG(const cmd &cmd, User &user);
+		int		NOTICE(const cmd &cmd, User &user);
+		int		relay(const cmd &cmd, User &user, bool notice);
+		int		QUIT(const cmd &cmd, User &user);
+		int		PART(const cmd &cmd, User &user);
+		int		WHOIS(const cmd &cmd, User &user);
+		int		CAP(const cmd &cmd, User &user);
+		int		WHO(const cmd &cmd, User &user);
+		int		LIST(const cmd &cmd, User &user);
+		Task	AUTHENTICATE(cmd cmd, int fd);	// by value: a copy on the heap, kept while it waits
+		int		MONITOR(const cmd &cmd, User &user);
+		int		ISON(const cmd &cmd, User &user);
+		int		USERHOST(const cmd &cmd, User &user);
 
 		//channel commands
-		int		KICK(cmd cmd, User &user);
-		int		INVITE(cmd cmd, User &user);
-		int		TOPIC(cmd cmd, User &user);
-		int		MODE(cmd cmd, User &user);
+		int		KICK(const cmd &cmd, User &user);
+		int		INVITE(const cmd &cmd, User &user);
+		int		TOPIC(const cmd &cmd, User &user);
+		int		MODE(const cmd &cmd, User &user);
+		void	sendMaskList(Channel &channel, User &user, char letter);
 
-		string	createMessage(int code, cmd cmd, User &user);
-		string	createMessage(int code, cmd cmd, User &user, Channel &channel);
+		string	createMessage(int code, const cmd &cmd, User &user);
+		string	createMessage(int code, const cmd &cmd, User &user, Channel &channel);
 		int 	createChannel(Channel*& channel, User &user, const std::string &channelName, const std::string &key);
 		Channel*	findChannelByName(const std::string& channelName);
 		User* 	findUserByNickName(const string& nickName);
-		void 	sendMessage(int code, cmd cmd, User &user);
-		void 	sendMessage(int code, cmd cmd, User &user, Channel &channel);
+		void 	sendMessage(int code, const cmd &cmd, User &user);
+		void 	sendMessage(int code, const cmd &cmd, User &user, Channel &channel);
 		void 	removeUser(int UserFd);
 		void	partAll(User &user, const string &message);
 
 	public:
-		Server(std::string port, std::string password);
+		Server(std::string port, std::string password, const Config &config);
+		Server(std::string port, std::string password, const Config &config, int upgradeFd);
+		Server(std::string password, const Config &config, unique_ptr<EventLoop> transport);
 		~Server();
 
 		void 			start();
+		bool			iterate();
 		static void 	signal_handler(int signal);
+		static int		upgradeFdFromEnv();
 
 		const User*		getUser(int fd);
 		const User*		getUser(const string &nickname);
 		
-		std::optional<std::map<string, Channel>::iterator> findChannel(string channel);
 };
 	
 #endif
\ No newline at end of file
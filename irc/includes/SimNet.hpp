@@ -0,0 +1,72 @@
+#ifndef SIMNET_HPP
+#define SIMNET_HPP
+
+#include "EventLoop.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+#define SIM_FD_BASE		(1 << 30)		// virtual fds start here, above any real descriptor
+#define SIM_LISTENER	(SIM_FD_BASE - 1)
+
+/*
+An in-memory network for running the server inside a benchmark or test
+harness: no sockets, no syscalls, a clock that only moves when told to.
+The harness plays the clients. connect() makes a client that the next
+wait() hands over as accepted, send() puts bytes where the server's
+read() finds them, and whatever the server write()s collects in the
+client's inbox (or is only counted, for large runs). Writes always go through whole, so the server never
+queues. Every wait() reports all clients with unread bytes, in fd
+order, which keeps a run deterministic. Connections the server closes
+are marked closed and keep their inbox until the harness takes it.
+*/
+class SimNet : public EventLoop
+{
+	private:
+		struct Peer {
+			std::string	toServer;			// sent by the client, not read by the server yet
+			std::string	inbox;				// written by the server, not taken by the client yet
+			size_t		lines = 0;			// written by the server, kept or not
+			bool		accepted = false;
+			bool		hungUp = false;		// client side closed, the server reads EOF
+			bool		closed = false;		// server side closed
+			bool		listed = false;		// in ready
+			short		events = POLLIN;
+		};
+		std::unordered_map<int, Peer>	peers;
+		std::vector<int>				connecting;	// not accepted yet
+		std::vector<int>				ready;		// unread bytes or EOF, reported on the next wait()
+		int								nextFd = SIM_FD_BASE;
+		double							clock = 0;	// seconds
+		size_t							written = 0;
+		bool							keep = true;	// inboxes collect what the server writes
+
+		void	wake(int fd);
+
+	public:
+		const char	*name() const override { return "sim"; }
+		void		addListener(int) override {}
+		void		add(int fd, bool stream) override;
+		void		remove(int fd) override;
+		void		setEvents(int fd, short events) override;
+		void		wait(int timeoutMs, std::vector<Event> &events) override;
+		ssize_t		read(int fd, std::string &out) override;
+		ssize_t		write(int fd, const char *data, size_t len) override;
+		void		close(int fd) override;
+		double		now() const override { return clock; }
+
+		// the client side
+		int			connect();
+		void		send(int fd, std::string_view bytes);
+		void		hangUp(int fd);
+		std::string	take(int fd);					// and empty the inbox
+		bool		closed(int fd) const;
+		bool		idle() const { return connecting.empty() && ready.empty(); }	// nothing for the server to do
+		void		advance(double seconds) { clock += seconds; }
+		size_t		bytesWritten() const { return written; }	// by the server, in total
+		size_t		lines(int fd) const;							// received by a client so far
+		void		keepInboxes(bool on) { keep = on; }				// off: only count lines
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/*
+Byte kernels for what every received line goes through: finding where
+its text ends (the first CR or LF), ASCII casefolding (CASEMAPPING=ascii)
+for nick and channel keys, and UTF-8 validation of trailing parameters.
+Each exists as AVX2, SSE2 and scalar code. The best set the CPU has is
+picked by CPUID when the program starts; IRCSERV_SIMD=scalar or sse2
+caps it, to compare them (tools/ircsimd.cpp).
+*/
+struct SimdKernels
+{
+	const char	*name;
+	size_t		(*findEol)(const char *data, size_t len);	// first '\r' or '\n', len if none
+	void		(*fold)(char *data, size_t len);			// A-Z to a-z, in place
+	bool		(*equalFolded)(const char *a, const char *b, size_t len);
+	bool		(*validUtf8)(const char *data, size_t len);
+};
+
+class Simd
+{
+	private:
+		static const SimdKernels	*active;
+
+	public:
+		Simd() = delete;
+		static const std::vector<const SimdKernels *>	&supported();	// by this CPU, scalar first
+		static void			pick(const char *cap);						// the best up to cap, nullptr: the best
+		static const char	*name() { return active->name; }
+
+		static size_t	findEol(std::string_view s) { return active->findEol(s.data(), s.size()); }
+		static void		fold(char *data, size_t len) { active->fold(data, len); }
+		static bool		equalFolded(std::string_view a, std::string_view b) {
+			return a.size() == b.size() && active->equalFolded(a.data(), b.data(), a.size());
+		}
+		static bool		validUtf8(std::string_view s) { return active->validUtf8(s.data(), s.size()); }
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine>
+#include <exception>
+
+/*
+Return type of command handlers that wait for something the event loop
+must not block on (co_await Workers::run(...)). The handler runs right
+away up to its first co_await and the loop thread resumes it once the
+result is in. Nobody waits for a Task: the frame frees itself when the
+handler returns, so replies go out from the handler itself.
+*/
+struct Task
+{
+	struct promise_type
+	{
+		Task				get_return_object() { return {}; }
+		std::suspend_never	initial_suspend() noexcept { return {}; }
+		std::suspend_never	final_suspend() noexcept { return {}; }
+		void				return_void() {}
+		void				unhandled_exception() { std::terminate(); }
+	};
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <string>
+#include <map>
+#include <sys/types.h>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+#define TLS_PORT 6697
+
+/*
+TLS connections are accepted non-blocking and the handshake is driven
+from the event loop. Once it completes, OpenSSL tries to install the
+session keys into the kernel (kTLS): with both directions offloaded the
+SSL object is freed and the socket is used with plain send()/recv().
+Otherwise records go through SSL_read/SSL_write.
+*/
+class Tls
+{
+	public:
+		enum Mode { HANDSHAKE, USERSPACE, KERNEL };
+
+		Tls() = delete;
+		static void		init(const std::string &cert, const std::string &key);
+		static bool		enabled() { return ctx != nullptr; }
+		static void		attach(const int fd);
+		static void		adopt(const int fd);
+		static int		handshake(const int fd);
+		static short	pollEvents(const int fd);
+		static bool		has(const int fd) { return sessions.count(fd); }
+		static Mode		mode(const int fd) { return sessions.at(fd).mode; }
+		static ssize_t	read(const int fd, std::string &out);
+		static ssize_t	write(const int fd, const char *data, size_t len);
+		static void		release(const int fd);
+
+	private:
+		struct Session {
+			SSL		*ssl;
+			Mode	mode;
+			bool	wantWrite;
+		};
+		static SSL_CTX					*ctx;
+		static std::map<int, Session>	sessions;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+
+#if __has_include(<sys/sdt.h>)
+# define _SDT_HAS_SEMAPHORES 1
+# include <sys/sdt.h>
+extern "C" unsigned short ircserv_span_semaphore;	// raised by perf or bpftrace while attached
+# define TRACE_PROBE(name, fd, count, ns)	DTRACE_PROBE4(ircserv, span, name, fd, count, ns)
+# define TRACE_PROBED()						(__builtin_expect(ircserv_span_semaphore, 0) != 0)
+#else
+# define TRACE_PROBE(name, fd, count, ns)	((void)0)
+# define TRACE_PROBED()						false
+#endif
+
+#define TRACE_RING		16384	// spans kept per thread, the oldest are overwritten
+#define TRACE_NAME		16		// bytes of a span name, longer ones are cut
+
+/*
+Tracing (trace = <file> in the config): spans around receiving, each
+command and its handler, broadcasts and socket writes are recorded in a
+ring per thread, and SIGUSR1 writes what the rings hold to the file as
+Chrome trace JSON (chrome://tracing, ui.perfetto.dev). Off, a span is
+a branch or two. Where <sys/sdt.h> is available every span also ends in
+the USDT probe ircserv:span (name, fd, count, nanoseconds), for perf and
+bpftrace, whether tracing is on or not; its semaphore tells the spans
+when a tool is attached, and only then are they timed for it.
+*/
+struct SpanRecord
+{
+	char		name[TRACE_NAME];
+	uint64_t	start;		// CLOCK_MONOTONIC ns
+	uint64_t	duration;
+	int32_t		fd;
+	uint32_t	count;		// recipients, commands, bytes: whatever the span counts
+};
+
+class Trace
+{
+	private:
+		static std::atomic<bool>	enabled;	// set by the loop thread, read by the workers
+
+	public:
+		Trace() = delete;
+		static bool		on() { return enabled.load(std::memory_order_relaxed); }
+		static void		enable(bool on);
+		static void		record(const char *name, size_t length, uint64_t start, int fd, uint32_t count);
+		static bool		dump(const std::string &path);
+		static uint64_t	now() {
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		}
+};
+
+// records the time from its construction to the end of the scope; the name has to outlive it
+class Span
+{
+	private:
+		const char	*name;
+		size_t		length;
+		uint64_t	start;
+		int			fd;
+
+	public:
+		uint32_t	count = 0;
+
+		Span(const char *name, int fd = -1) : Span(name, __builtin_strlen(name), fd) {}
+		Span(std::string_view name, int fd = -1) : Span(name.data(), name.size(), fd) {}
+		Span(const char *name, size_t length, int fd) : name(name), length(length), start(0), fd(fd) {
+			if (Trace::on() || TRACE_PROBED())
+				start = Trace::now();
+		}
+		~Span() { end(); }
+
+		// ends the span before the scope does
+		void	end() {
+			if (!start)
+				return;
+			TRACE_PROBE(name, fd, count, Trace::now() - start);
+			if (Trace::on())
+				Trace::record(name, length, start, fd, count);
+			start = 0;
+		}
+		Span(const Span &) = delete;
+		Span &operator=(const Span &) = delete;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include "EventLoop.hpp"
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <memory>
+#include <cstdint>
+
+#define URING_ENTRIES		4096
+#define URING_BUFFERS		256			// provided receive buffers, a power of two
+#define URING_BUFFER_SIZE	4096
+#define URING_SEND_CHUNK	(64 << 10)	// bytes per linked send
+#define URING_WRITE_MAX		(256 << 10)	// bytes one write() hands to the kernel
+
+/*
+io_uring backend (IRCSERV_EVENTS=uring), talking to the kernel through
+the raw syscalls and the mmap'd rings:
+- listeners: one multishot accept each
+- stream clients: one multishot recv each, filling buffers from a
+  provided buffer ring (or PROVIDE_BUFFERS where the ring does not
+  work). Received bytes are staged per client until the server read()s
+  them, so the buffer goes straight back to the kernel.
+- writes: write() copies what it takes into the client's chain buffer
+  and submits it as linked sends; the next write() waits until the
+  chain completes and the client gets a WRITABLE event.
+- readiness clients (TLS): one-shot poll, armed again after each event
+Completions carry fd, operation and the client's generation, so ones
+that arrive after the fd was removed (and maybe reused) are ignored.
+New sqes are submitted together on the next wait().
+*/
+class UringLoop : public EventLoop
+{
+	private:
+		enum Op : uint8_t { OP_ACCEPT, OP_RECV, OP_POLL, OP_SEND, OP_CANCEL, OP_UPDATE, OP_PROVIDE };
+
+		struct Client {
+			int			fd;
+			uint32_t	gen;
+			bool		listener;
+			bool		stream;
+			bool		armed = false;	// accept, recv or poll in flight
+			short		events = POLLIN;
+			std::string	staged;			// received, not read() yet
+			bool		eof = false;
+			int			readError = 0;
+			unsigned	reported = 0;	// wait() round of the last READABLE
+			std::string	chain;			// bytes of the send chain in flight
+			size_t		chainSent = 0;
+			unsigned	inflight = 0;	// sends of the chain not completed
+			int			writeError = 0;
+		};
+
+		int					ring = -1;
+		void				*rings = nullptr;
+		size_t				ringsSize = 0;
+		unsigned			*sqHead, *sqTail, *cqHead, *cqTail;
+		unsigned			sqMask, cqMask, sqEntries;
+		unsigned			sqLocal = 0;		// our sq tail, published on submit
+		io_uring_sqe		*sqes = nullptr;
+		size_t				sqesSize = 0;
+		io_uring_cqe		*cqes;
+		size_t				outstanding = 0;	// operations still due a final completion
+
+		io_uring_buf_ring	*bufRing = nullptr;	// null: buffers go through PROVIDE_BUFFERS
+		std::vector<char>	buffers;
+		uint16_t			bufTail = 0;
+		std::vector<uint16_t>	returned;		// buffer ids to provide again
+
+		std::unordered_map<int, std::unique_ptr<Client>>	clients;
+		std::vector<std::unique_ptr<Client>>				retired;	// removed with sends in flight
+		std::vector<int>									rearm;
+		std::vector<int>									ready;		// READABLE again next round
+		uint32_t											nextGen = 0;
+		unsigned											round = 0;
+		bool												quiet = false;
+
+		void			setup();
+		void			teardown();
+		bool			probe();
+		void			provideBuffers();
+		void			provideReturned();
+		Client			*find(int fd);
+		Client			*owner(int fd, uint32_t gen);
+		unsigned		space() const;
+		io_uring_sqe	*sqe(uint64_t userData);
+		io_uring_sqe	*sqe(Client &c, Op op);
+		void			submit(unsigned wait, const __kernel_timespec *ts);
+		void			recycle(uint16_t bid);
+		void			arm(Client &c);
+		void			sendChain(Client &c);
+		void			cancel(Client &c);
+		void			readable(Client &c, std::vector<Event> &events);
+		void			complete(const io_uring_cqe &cqe, std::vector<Event> &events);
+		void			reap(std::vector<Event> &events);
+
+	public:
+		UringLoop();
+		~UringLoop() override;
+
+		const char	*name() const override { return "uring"; }
+		void		addListener(int fd) override;
+		void		add(int fd, bool stream) override;
+		void		remove(int fd) override;
+		void		setEvents(int fd, short events) override;
+		void		wait(int timeoutMs, std::vector<Event> &events) override;
+		ssize_t		read(int fd, std::string &out) override;
+		ssize_t		write(int fd, const char *data, size_t len) override;
+		void		quiesce() override;
+		void		resume() override;
+		std::string	takeUnsent(int fd) override;
+};
+
+#endif
@@ -2,23 +2,46 @@
 #define USER_HPP
 
 #include "Server.hpp"
+#include "Interned.hpp"
 #include <string>
+#include <string_view>
 #include <poll.h>
 #include <iostream>
 #include <map>
+#include <set>
 
 class Channel;
 
+/*
+Registration state machine: PASS, NICK and USER each set their bit,
+in any order. The transition into REG_DONE happens exactly once, when
+all three are present and no CAP negotiation holds it (see User::advance).
+*/
+enum RegState : unsigned char {
+	REG_NONE = 0,
+	REG_PASS = 1 << 0,
+	REG_NICK = 1 << 1,
+	REG_USER = 1 << 2,
+	REG_DONE = 1 << 3,
+	REG_CAP = 1 << 4	// CAP LS/REQ seen, registration waits for CAP END
+};
+
 class User
 {
 	private:
-		std::string nickname, username, hostname, servername, realname;
+		std::string nickname, username;
+		Interned hostname, servername, realname;	// shared with every user that gave the same
 		int fd;
 		bool isOperator;
-		bool isAuth;
-		bool nickIsSet;
-		bool userIsSet;
-		bool isRegistered;
+		unsigned char regState;
+		unsigned long maskId;	// changes with nick!user@host, keys cached ban checks
+		std::string prefix;		// ":nick!user@host", rebuilt when one of them changes
+		Interned account;		// SASL account, empty until logged in
+		bool authenticating;	// AUTHENTICATE PLAIN started, payload expected
+		std::string sasl;		// payload received so far (400-byte chunks)
+		std::set<std::string> channels;	// names of the channels joined, kept by Channel::addUser/removeUser
+
+		void updatePrefix();
 	public:
 		// constructors
 		User();
@@ -27,26 +50,34 @@ class User
 		User &operator=(const User &other);
 
 		bool isInChannel(const std::string &channelName) const;
-		int privmsg(const User &recipient, const std::string &message) const;
-		int privmsg(const Channel &reci_chan, const std::string &message) const;
+		std::string line(std::string_view command, std::string_view params, std::string_view trailing = "") const;
+		int privmsg(const User &recipient, std::string_view message, std::string_view command = "PRIVMSG") const;
+		int privmsg(const Channel &reci_chan, std::string_view message, std::string_view command = "PRIVMSG") const;
 		int join(Channel &channel);
 		int join(Channel &channel, const std::string &password);
 		int part(Channel &channel, const std::string &message);
 		int quit(const std::string &message);
 
-		// getters
-		std::string getNickname() const { return nickname; }
-		std::string getUsername() const { return username; }
-		std::string getHostname() const { return hostname; }
-		std::string getServername() const { return servername; }
-		std::string getRealname() const { return realname; }
+		// getters, references into the user: copy what must outlive it or a rename
+		const std::string &getNickname() const { return nickname; }
+		const std::string &getUsername() const { return username; }
+		const std::string &getHostname() const { return hostname.str(); }
+		const std::string &getServername() const { return servername.str(); }
+		const std::string &getRealname() const { return realname.str(); }
 		int getFd() const { return fd; }
 		bool getIsOperator() const { return isOperator; }
-		std::string getFullIdentifier() const;
-		bool getAuth() const { return isAuth; }
-		bool getNickIsSet() const { return nickIsSet; }
-		bool getUserIsSet() const { return userIsSet; }
-		bool getIsRegistered() const { return isRegistered; }
+		const std::string &getFullIdentifier() const { return prefix; }
+		std::string_view getHostmask() const { return std::string_view(prefix).substr(1); }
+		unsigned long getMaskId() const { return maskId; }
+		bool getAuth() const { return regState & REG_PASS; }
+		bool getNickIsSet() const { return regState & REG_NICK; }
+		bool getUserIsSet() const { return regState & REG_USER; }
+		bool getIsRegistered() const { return regState & REG_DONE; }
+		unsigned char getRegState() const { return regState; }
+		const std::string &getAccount() const { return account.str(); }
+		bool isAuthenticating() const { return authenticating; }
+		const std::string &getSasl() const { return sasl; }
+		const std::set<std::string> &getChannels() const { return channels; }
 
 		// setters
 		int setNickname(const std::string &nickname);
@@ -55,10 +86,12 @@ class User
 		int setServername(const std::string &servername);
 		int setRealname(const std::string &realname);
 		void setIsOperator(const bool isOperator) { this->isOperator = isOperator; }
-		void setAuth(const bool status) { isAuth = status; }
-		void setNickIsSet(const bool status) { nickIsSet = status; }
-		void setUserIsSet(const bool status) { userIsSet = status; }
-		void setIsRegistered(const bool status) { isRegistered = status; }
+		void setRegState(const unsigned char state) { regState = state; }
+		bool advance(const RegState step);
+		void setAccount(const std::string &account) { this->account = account; }
+		void setSasl(const bool authenticating, const std::string &payload = "") { this->authenticating = authenticating; sasl = payload; }
+		void joined(const std::string &channel) { channels.insert(channel); }
+		void left(const std::string &channel) { channels.erase(channel); }
 
 		friend bool operator==(const User &lhs, const User &rhs);
 		friend bool operator!=(const User &lhs, const User &rhs);
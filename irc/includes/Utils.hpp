@@ -3,7 +3,7 @@
 #include "Server.hpp"
 #define DEBUG_MODE true
 
-enum log_level { DEBUG, INFO, WARN, ERROR };
+enum log_level : int { DEBUG, INFO, WARN, ERROR };
 
 #define RESET	"\033[0m";
 #define RED		"\033[31m";
@@ -11,20 +11,26 @@ enum log_level { DEBUG, INFO, WARN, ERROR };
 #define GREEN	"\033[32m";
 #define BLUE	"\033[34m"
 
+// views of the command's arguments, the list itself is in the Arena
 struct parsedArgs {
-	vector <string>	args;
-	string			trailing;
-	int				size;
+	std::pmr::vector<string_view>	args{Arena::get()};
+	string_view						trailing;
+	int								size;
 };
 
 int 			countWords(const 	string &s);
-vector<string>	commaSplit(string str);
+std::pmr::vector<string_view>	commaSplit(string_view str);
 bool			isValidChannelName(const string& channelName);
 bool			matchesWildcard(const string &pattern, const string &target);
 bool			targetIsUser(char c);
 bool			isJoinedChannel(User &user, Channel &channel);
 void 			log(log_level level, const string &event, const string &details);
-parsedArgs		parseArgs(const std::string& args, int words, bool withTrailing);
+bool			logs(log_level level);
+parsedArgs		parseArgs(string_view args, int words, bool withTrailing);
 string			trim(const string &str);
-std::string 	toLowerString(const std::string& s);
-bool 			compareIgnoreCase(const std::string& a, const std::string& b);
+string_view		trim(string_view str);
+std::string 	toLowerString(std::string_view s);
+bool 			compareIgnoreCase(std::string_view a, std::string_view b);
+string			tagValue(string_view tags, const string &key);
+bool			isValidPassword(const string& s);
+void			setLogLevel(log_level level);
@@ -0,0 +1,44 @@
+#ifndef WATCHDOG_HPP
+#define WATCHDOG_HPP
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <pthread.h>
+
+/*
+Watchdog (watchdog = <ms> in the config): the loop marks when it starts
+working on a batch of events and when it goes back to waiting. A thread
+checks a few times per period; once the loop has been busy for longer
+than the limit, it interrupts the loop thread with WATCHDOG_SIGNAL,
+whose handler writes the loop's stack to stderr. One dump per stall.
+*/
+
+#define WATCHDOG_SIGNAL	(SIGRTMIN + 1)
+#define WATCHDOG_FRAMES	64
+
+class Watchdog
+{
+	private:
+		static std::atomic<uint64_t>	busySince;	// CLOCK_MONOTONIC ns, 0 while the loop waits
+		static std::atomic<unsigned>	limitMs;
+		static std::thread				thread;
+		static std::mutex				lock;
+		static std::condition_variable	wakeup;
+		static bool						stopping;
+		static pthread_t				loopThread;
+
+		static void	watch();
+		static void	dumpStack(int signal);
+
+	public:
+		Watchdog() = delete;
+		static void	start(unsigned ms);		// from the loop thread, 0 stops it
+		static void	stop();
+		static void	busy(uint64_t now) { busySince.store(now, std::memory_order_relaxed); }
+		static void	idle() { busySince.store(0, std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef WORKERS_HPP
+#define WORKERS_HPP
+
+#include <coroutine>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+#define WORKERS_MAX	4	// threads at most, fewer on smaller machines
+
+/*
+Thread pool for work too slow for the event loop (password hashes).
+co_await Workers::run<T>(work) runs work on a pool thread and resumes
+the coroutine on the loop thread: finished jobs are signalled on an
+eventfd the loop watches, and complete() resumes them from there.
+The work sees only what it captured, never server state. Without
+running threads, run() does the work inline.
+*/
+class Workers
+{
+	public:
+		template <typename T>
+		struct Job
+		{
+			std::function<T()>	work;
+			T					result{};
+
+			bool	await_ready() const noexcept { return false; }
+			bool	await_suspend(std::coroutine_handle<> handle) {
+				if (!running()) {
+					result = work();
+					return false;
+				}
+				submit([this] { result = work(); }, handle);
+				return true;
+			}
+			T		await_resume() { return std::move(result); }
+		};
+
+		Workers() = delete;
+		static void		start(unsigned count);
+		static void		stop();
+		static bool		running() { return !threads.empty(); }
+		static int		fd() { return wake; }
+		static size_t	pending() { return inFlight; }
+		static void		complete();
+
+		template <typename T>
+		static Job<T>	run(std::function<T()> work) { return {std::move(work)}; }
+
+	private:
+		struct Item
+		{
+			std::function<void()>	work;
+			std::coroutine_handle<>	handle;
+		};
+
+		static std::vector<std::thread>				threads;
+		static std::mutex							lock;		// queue, done, stopping
+		static std::condition_variable				wakeup;
+		static std::deque<Item>						queue;
+		static std::vector<std::coroutine_handle<>>	done;
+		static bool									stopping;
+		static int									wake;		// eventfd, readable once jobs are done
+		static size_t								inFlight;	// submitted, not resumed yet (loop thread)
+
+		static void	submit(std::function<void()> work, std::coroutine_handle<> handle);
+		static void	worker();
+};
+
+#endif
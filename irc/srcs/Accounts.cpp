@@ -0,0 +1,51 @@
+#include "../includes/Accounts.hpp"
+#include "../includes/Utils.hpp"
+#include <crypt.h>
+#include <fstream>
+#include <memory>
+#include <openssl/crypto.h>
+
+void Accounts::load(const std::string &path)
+{
+	std::ifstream	file(path);
+	std::string		line;
+	size_t			number = 0;
+
+	if (!file)
+		throw runtime_error("cannot read accounts file " + path);
+	entries.clear();
+	while (getline(file, line)) {
+		number++;
+		line = trim(line);
+		if (line.empty() || line[0] == '#')
+			continue;
+		size_t colon = line.find(':');
+		if (colon == 0 || colon == std::string::npos || colon + 1 == line.size())
+			throw runtime_error(path + ":" + to_string(number) + ": expected name:hash");
+		std::string name = line.substr(0, colon);
+		entries[toLowerString(name)] = {name, line.substr(colon + 1)};
+	}
+	log(INFO, "Accounts", "Loaded " + to_string(entries.size()) + " accounts from " + path);
+}
+
+const Account *Accounts::find(const std::string &name) const
+{
+	auto it = entries.find(toLowerString(name));
+	return it == entries.end() ? nullptr : &it->second;
+}
+
+// a real hash to check unknown names against, so they cost as much as a wrong password
+std::string Accounts::decoy() const
+{
+	return entries.empty() ? "" : entries.begin()->second.hash;
+}
+
+bool Accounts::verify(const std::string &password, const std::string &hash)
+{
+	auto		data = std::make_unique<crypt_data>();
+	const char	*result = crypt_r(password.c_str(), hash.c_str(), data.get());
+
+	if (!result || result[0] == '*' || strlen(result) != hash.size())
+		return false;
+	return CRYPTO_memcmp(result, hash.data(), hash.size()) == 0;
+}
@@ -0,0 +1,25 @@
+#include "../includes/Arena.hpp"
+#include <cstddef>
+
+#define ARENA_BYTES	(256 * 1024)	// a read of 64 KiB of short lines still fits
+
+// the heap behind the block, counted
+class Spill : public std::pmr::memory_resource
+{
+	void *do_allocate(size_t bytes, size_t alignment) override {
+		Arena::spills++;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+		return this == &other;
+	}
+};
+
+alignas(std::max_align_t) static unsigned char	block[ARENA_BYTES];
+static Spill									spill;
+
+std::pmr::monotonic_buffer_resource	Arena::resource(block, sizeof(block), &spill);
+uint64_t							Arena::spills = 0;
@@ -0,0 +1,90 @@
+#include "Server.hpp"
+
+/*
+IRCv3 capability negotiation (CAP LS/LIST/REQ/END).
+A client that starts negotiating before registration is held in
+REG_CAP until CAP END, so the welcome burst comes after the ACKs.
+sasl is offered only when accounts are configured (see Sasl.cpp).
+*/
+
+struct capability {
+	const char	*name;
+	unsigned	bit;
+};
+
+static const capability capabilities[] = {
+	{"batch", CAP_BATCH},
+	{"labeled-response", CAP_LABELED_RESPONSE},
+	{"server-time", CAP_SERVER_TIME},
+	{"multi-prefix", CAP_MULTI_PREFIX},
+	{"echo-message", CAP_ECHO_MESSAGE},
+	{"sasl", CAP_SASL},
+};
+
+static unsigned capabilityBit(const string &name) {
+	for (const capability &c : capabilities)
+		if (name == c.name)
+			return c.bit;
+	return 0;
+}
+
+static string capabilityList(unsigned mask) {
+	string list;
+
+	for (const capability &c : capabilities) {
+		if (!(mask & c.bit))
+			continue;
+		if (!list.empty())
+			list += " ";
+		list += c.name;
+	}
+	return list;
+}
+
+int	Server::CAP(const cmd &cmd, User &user) {
+	parsedArgs	capArgs = parseArgs(cmd.arguments, 2, true);
+	Connection	&conn = IO::connection(user.getFd());
+
+	if (capArgs.args.empty()) {
+		return (ERR_NEEDMOREPARAMS);
+	}
+	string sub(capArgs.args[0]);
+	unsigned offered = accounts.empty() ? ~CAP_SASL : ~0u; // sasl only with accounts to log in to
+	string reply = ":" + _name + " CAP " + (user.getIsRegistered() ? user.getNickname() : "*") + " ";
+	transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+
+	if ((sub == "LS" || sub == "REQ") && !user.getIsRegistered()) {
+		user.setRegState(user.getRegState() | REG_CAP);
+	}
+	if (sub == "LS") {
+		IO::sendString(user.getFd(), reply + "LS :" + capabilityList(offered));
+	} else if (sub == "LIST") {
+		IO::sendString(user.getFd(), reply + "LIST :" + capabilityList(conn.caps));
+	} else if (sub == "REQ") {
+		// all or nothing: one unknown capability rejects the whole request
+		istringstream	names{string(capArgs.trailing)};
+		string			name;
+		unsigned		add = 0, remove = 0;
+
+		while (names >> name) {
+			bool		disable = (name[0] == '-');
+			unsigned	bit = capabilityBit(disable ? name.substr(1) : name);
+			if (!(bit & offered)) {
+				IO::sendString(user.getFd(), reply + "NAK :" + string(capArgs.trailing));
+				return (0);
+			}
+			(disable ? remove : add) |= bit;
+		}
+		conn.caps = (conn.caps | add) & ~remove;
+		IO::sendString(user.getFd(), reply + "ACK :" + string(capArgs.trailing));
+	} else if (sub == "END") {
+		if (user.getIsRegistered())
+			return (0);
+		user.setRegState(user.getRegState() & ~REG_CAP);
+		if (user.advance(REG_NONE))
+			completeRegistration(user);
+	} else {
+		return (ERR_INVALIDCAPCMD);
+	}
+	return (0);
+}
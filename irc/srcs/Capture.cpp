@@ -0,0 +1,145 @@
+#include "../includes/Capture.hpp"
+#include "../includes/Utils.hpp"
+#include <ctime>
+#include <cstring>
+
+#define CAPTURE_BUFFER	(64 << 10)
+#define CAPTURE_FLUSH	1000000	// µs between flushes at most
+
+FILE		*Capture::file = nullptr;
+uint64_t	Capture::last = 0;
+uint64_t	Capture::flushed = 0;
+
+static uint64_t micros(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// where the command word starts, after the optional @tags and :prefix
+static size_t commandStart(const std::string &text)
+{
+	size_t pos = 0;
+
+	for (char lead : {'@', ':'}) {
+		if (pos < text.size() && text[pos] == lead) {
+			pos = text.find_first_not_of(' ', text.find(' ', pos));
+			if (pos == std::string::npos)
+				return text.size();
+		}
+	}
+	return pos;
+}
+
+// opens the file for appending and starts a segment; no path, no capture
+void Capture::start(const char *path)
+{
+	if (!path || !*path)
+		return;
+	file = fopen(path, "ae");
+	if (!file) {
+		log(ERROR, "Capture", "Cannot open " + string(path) + ": " + strerror(errno));
+		return;
+	}
+	setvbuf(file, nullptr, _IOFBF, CAPTURE_BUFFER);
+
+	uint64_t	start = micros(CLOCK_REALTIME);
+	uint8_t		header[16] = {0};
+	memcpy(header, CAPTURE_MAGIC, 6);
+	header[6] = CAPTURE_VERSION;
+	for (int i = 0; i < 8; ++i)
+		header[8 + i] = start >> (8 * i);
+	fwrite(header, 1, sizeof(header), file);
+	last = flushed = micros(CLOCK_MONOTONIC);
+	log(INFO, "Capture", "Recording client traffic to " + string(path));
+}
+
+void Capture::stop()
+{
+	if (!file)
+		return;
+	fclose(file);
+	file = nullptr;
+}
+
+void Capture::flush()
+{
+	if (file)
+		fflush(file);
+}
+
+void Capture::varint(uint64_t v)
+{
+	uint8_t	buf[10];
+	size_t	n = 0;
+
+	do {
+		buf[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+		v >>= 7;
+	} while (v);
+	fwrite(buf, 1, n, file);
+}
+
+void Capture::record(CaptureKind kind, const int fd)
+{
+	uint64_t now = micros(CLOCK_MONOTONIC);
+
+	fputc(kind, file);
+	varint(now - last);
+	varint(fd);
+	last = now;
+	if (now - flushed > CAPTURE_FLUSH) {
+		fflush(file);
+		flushed = now;
+	}
+}
+
+void Capture::opened(const int fd)
+{
+	if (file)
+		record(CAPTURE_OPEN, fd);
+}
+
+// one received line; secrets are masked, the command mix and timing stay
+void Capture::line(const int fd, std::string_view line)
+{
+	if (!file)
+		return;
+	std::string text(line);
+	if (!text.empty() && text.back() == '\r')
+		text.pop_back();
+	if (text.empty())
+		return;
+
+	size_t start = commandStart(text);
+	if (compareIgnoreCase(text.substr(start, 5), "PASS ")) {
+		text.replace(start + 5, std::string::npos, "*");
+	} else if (compareIgnoreCase(text.substr(start, 5), "OPER ")) {
+		size_t space = text.find(' ', start + 5);
+		if (space != std::string::npos)
+			text.replace(space + 1, std::string::npos, "*");
+	} else if (compareIgnoreCase(text.substr(start, 13), "AUTHENTICATE ")) {
+		std::string arg = text.substr(start + 13);
+		if (arg != "+" && arg != "*" && !compareIgnoreCase(arg, "PLAIN"))
+			text.replace(start + 13, std::string::npos, "*"); // SASL payload, holds the password
+	}
+
+	record(CAPTURE_LINE, fd);
+	varint(text.size());
+	fwrite(text.data(), 1, text.size(), file);
+}
+
+void Capture::closed(const int fd)
+{
+	if (file)
+		record(CAPTURE_CLOSE, fd);
+}
+
+void Capture::remapped(const int oldFd, const int newFd)
+{
+	if (!file)
+		return;
+	record(CAPTURE_REMAP, newFd);
+	varint(oldFd);
+}
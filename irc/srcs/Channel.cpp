@@ -14,14 +14,82 @@
 #include "Channel.hpp"
 #include <optional>
 #include "User.hpp"
+#include "ErrorCodes.hpp"
 
 
 void Channel::addUser(int fd, User* user) {
+    auto member = UserList.find(fd);
+    if (member != UserList.end())
+        namesErase(fd, namesEntry(fd, member->second->getNickname()));
     UserList[fd] = user;
+    user->joined(ChannelName);
+    namesInsert(fd);
 }
 
 void Channel::removeUser(int fd) {
-    UserList.erase(fd);
+    auto member = UserList.find(fd);
+    if (member == UserList.end())
+        return;
+    namesErase(fd, namesEntry(fd, member->second->getNickname()));
+    member->second->left(ChannelName);
+    UserList.erase(member);
+    verdicts.erase(fd);
+}
+
+// re-renders a member's NAMES entry after their nick changed
+void Channel::renameUser(int fd, const std::string& oldNickname) {
+    if (!UserList.count(fd))
+        return;
+    namesErase(fd, namesEntry(fd, oldNickname));
+    namesInsert(fd);
+}
+
+std::string Channel::namesEntry(int fd, const std::string& nickname) const {
+    return (operators.count(fd) ? "@" : "") + nickname;
+}
+
+void Channel::namesInsert(int fd) {
+    std::string entry = namesEntry(fd, UserList.at(fd)->getNickname());
+    size_t capacity = NAMES_LINE_MAX - NAMES_HEADER_MAX - ChannelName.size();
+    size_t chunk;
+
+    if (!namesFree.empty()) {
+        chunk = namesFree.back();
+        namesFree.pop_back();
+    } else if (!namesChunks.empty() && namesChunks.back().size() + 1 + entry.size() <= capacity) {
+        chunk = namesChunks.size() - 1;
+    } else {
+        chunk = namesChunks.size();
+        namesChunks.emplace_back();
+    }
+    std::string &line = namesChunks[chunk];
+    if (!line.empty())
+        line += ' ';
+    line += entry;
+    namesSlots[fd] = chunk;
+}
+
+void Channel::namesErase(int fd, const std::string& entry) {
+    auto slot = namesSlots.find(fd);
+    if (slot == namesSlots.end())
+        return;
+    std::string &line = namesChunks[slot->second];
+
+    for (size_t pos = 0; pos < line.size(); ) {
+        size_t end = std::min(line.find(' ', pos), line.size());
+        if (line.compare(pos, end - pos, entry) == 0) {
+            // drop the entry with one of the spaces around it
+            if (end < line.size())
+                line.erase(pos, end - pos + 1);
+            else
+                line.erase(pos ? pos - 1 : 0);
+            break;
+        }
+        pos = end + 1;
+    }
+    if (line.empty())
+        namesFree.push_back(slot->second);
+    namesSlots.erase(slot);
 }
 
 std::optional<std::map<int, User*>::iterator> Channel::findUser(int fd) {
@@ -69,13 +137,71 @@ std::optional<std::map<int, const User *>::const_iterator> Channel::IsInvited(in
     return std::nullopt;
 }
 void Channel::addOperator(const User& user) {
+    bool member = namesSlots.count(user.getFd());
+    if (member)
+        namesErase(user.getFd(), namesEntry(user.getFd(), user.getNickname()));
     operators.insert(user.getFd());
+    if (member)
+        namesInsert(user.getFd());
 }
 
 void Channel::removeOperator(const User& user) {
+    bool member = namesSlots.count(user.getFd());
+    if (member)
+        namesErase(user.getFd(), namesEntry(user.getFd(), user.getNickname()));
     operators.erase(user.getFd());
+    if (member)
+        namesInsert(user.getFd());
 }
 
 bool Channel::isOperator(const User& user) const {
     return operators.find(user.getFd()) != operators.end();
-}
\ No newline at end of file
+}
+MaskList& Channel::maskList(char mode) {
+    if (mode == 'b')
+        return bans;
+    return (mode == 'e') ? exceptions : inviteExceptions;
+}
+
+const MaskList& Channel::getMaskList(char mode) const {
+    if (mode == 'b')
+        return bans;
+    return (mode == 'e') ? exceptions : inviteExceptions;
+}
+
+// 0, or ERR_BANLISTFULL; adding a mask that is already listed is a no-op
+int Channel::addMask(char mode, const std::string& mask, const std::string& setBy, time_t setAt) {
+    MaskList &list = maskList(mode);
+
+    if (list.size() >= MAXLIST)
+        return ERR_BANLISTFULL;
+    if (list.add(mask, setBy, setAt))
+        listsVersion++;
+    return 0;
+}
+
+bool Channel::removeMask(char mode, const std::string& mask) {
+    if (!maskList(mode).remove(mask))
+        return false;
+    listsVersion++;
+    return true;
+}
+
+// the lists are only matched again when they or a member's nick!user@host changed;
+// non-members (JOIN, INVITE checks) are matched every time and not cached
+Channel::Verdict Channel::verdict(const User& user) const {
+    auto cached = UserList.count(user.getFd()) ? verdicts.try_emplace(user.getFd()).first : verdicts.end();
+    if (cached != verdicts.end() && cached->second.maskId == user.getMaskId()
+        && cached->second.listsVersion == listsVersion)
+        return cached->second;
+
+    std::string hostmask(user.getHostmask());
+    Verdict v;
+    v.maskId = user.getMaskId();
+    v.listsVersion = listsVersion;
+    v.banned = bans.matches(hostmask) && !exceptions.matches(hostmask);
+    v.inviteExcepted = inviteExceptions.matches(hostmask);
+    if (cached != verdicts.end())
+        cached->second = v;
+    return v;
+}
@@ -2,17 +2,7 @@
 #include "Server.hpp"
 
 
-std::optional<std::map<string, Channel>::iterator> Server:: findChannel(string channel)
-{
-	auto it = channels.find(toLowerString(channel));
-    if (it != channels.end()) {
-        return it;
-    }
-    return std::nullopt;
-}
-
-
-int	Server::TOPIC(cmd cmd, User &user)
+int	Server::TOPIC(const cmd &cmd, User &user)
 
 {
 	string		res;
@@ -26,26 +16,25 @@ int	Server::TOPIC(cmd cmd, User &user)
 	{
 		return (ERR_NEEDMOREPARAMS);
 	}
-	auto itOpt = findChannel(channel);
-    if (!itOpt.has_value()) {
+	Channel *c = findChannelByName(channel);
+    if (!c) {
         return ERR_NOSUCHCHANNEL;
     }
-    std::map<string, Channel>::iterator it = *itOpt;
 	if (topic.empty())
 	{
-		message = it->second.getChannelTopic();
+		message = c->getChannelTopic();
 		message += "\r\n";
-		if (send(user.getFd(), message.c_str(), message.length(), 0) == -1)
+		if (IO::sendString(user.getFd(), message) == -1)
 			cerr << "send() error: " << strerror(errno) << endl;
 		return (0);
 	}
-	if (it->second.isTopicRestricted() && !it->second.isOperator(user))
+	if (c->isTopicRestricted() && !c->isOperator(user))
 	{
 		return (ERR_CHANOPRIVSNEEDED);
 	}
 	else
 	{
-		it->second.setChannelTopic(topic);
+		c->setChannelTopic(topic);
 		message = user.getNickname() + " has set topic to " + topic + "\r\n";
 		user.privmsg(channel, message);
 	}
@@ -53,7 +42,7 @@ int	Server::TOPIC(cmd cmd, User &user)
 
 }
 
-int	Server::KICK(cmd cmd, User &user)
+int	Server::KICK(const cmd &cmd, User &user)
 {
 	string channel;
 	string target;
@@ -65,188 +54,263 @@ int	Server::KICK(cmd cmd, User &user)
 	{
 		return (ERR_NEEDMOREPARAMS);
 	}
-	auto itOpt = findChannel(channel);
-    if (!itOpt.has_value()) {
+	Channel *c = findChannelByName(channel);
+    if (!c) {
         return ERR_NOSUCHCHANNEL;
     }
 
-    std::map<string, Channel>::iterator it = *itOpt;
-	if (!it->second.isOperator(user))
+	if (!c->isOperator(user))
 	{
 		return (ERR_CHANOPRIVSNEEDED);
 	}
-	std::optional<std::map<int, User*>::iterator> it2 = it->second.findUserByNickname(target);
+	std::optional<std::map<int, User*>::iterator> it2 = c->findUserByNickname(target);
 	if (!it2)
 	{
 		return (ERR_NOSUCHNICK);
 	}
     User *targetUser = it2.value()->second;
-    targetUser->part(it->second, target + " was kicked by " + user.getNickname());
+    targetUser->part(*c, target + " was kicked by " + user.getNickname());
+	channelChanged(channel);
 	return (0);
 }
 
-int	Server::MODE(cmd cmd, User &user)
+// nick, nick!user and user@host are completed to a full nick!user@host mask
+static string completeMask(const string &mask)
 {
-	string mode;
-	string channel;
-	string extra;
-	string		res;
-	log_level	type;
-	istringstream stream(cmd.arguments);
+	size_t bang = mask.find('!');
+	size_t at = mask.find('@');
 
-	stream >> channel >> mode >> extra;
+	if (bang == string::npos && at == string::npos)
+		return mask + "!*@*";
+	if (at == string::npos)
+		return mask + "@*";
+	if (bang == string::npos)
+		return "*!" + mask;
+	return mask;
+}
 
-	if (channel.empty())
-    {
-        return (ERR_NEEDMOREPARAMS);
-    }
+// one letter of a MODE command, with its parameter if it takes one
+struct ModeChange
+{
+	bool	add;
+	char	letter;
+	string	param;
+	User	*target;	// +o/-o
+};
 
-	auto itOpt = findChannel(channel);
-    if (!itOpt.has_value()) {
-		return ERR_NOSUCHCHANNEL;
-    }
+// the mode string and its parameters; a ':' parameter takes the rest of the line
+static vector<string> modeWords(const string &arguments)
+{
+	vector<string>	words;
+	istringstream	stream(arguments);
+	string			word;
+
+	while (stream >> word) {
+		if (word[0] == ':') {
+			// from this word's own colon, a mask like *!*@::1 may come earlier
+			size_t end = stream.eof() ? arguments.size() : static_cast<size_t>(stream.tellg());
+			words.push_back(arguments.substr(end - word.size() + 1));
+			break;
+		}
+		words.push_back(word);
+	}
+	return words;
+}
+
+// a +l value: digits only, at least 1
+static bool parseLimit(const string &value, unsigned &limit)
+{
+	if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != string::npos)
+		return false;
+	limit = stoul(value);
+	return limit > 0;
+}
+
+/*
+MODE <channel> [<modes> [<parameters>]]: any number of i, t, k, l, o, b,
+e and I changes in one command, such as +itkl key 50 or +ooo a b c.
+Every change is checked before any is applied, so one bad letter or
+parameter leaves the channel as it was. Up to config.modesMax changes
+with a parameter are taken per command (MODES in 005); the rest of the
+line is ignored. What actually changed goes to the channel as a single
+MODE line. b, e or I without a mask shows that list, to anyone; any
+change by a non-operator is refused before its parameter is checked.
+There are no user modes: MODE on a nick changes nothing.
+*/
+int	Server::MODE(const cmd &cmd, User &user)
+{
+	vector<string>	words = modeWords(string(cmd.arguments));
 
-	std::map<string, Channel>::iterator it = *itOpt;
-	Channel c = it->second;
+	if (words.empty())
+		return (ERR_NEEDMOREPARAMS);
+	if (targetIsUser(words[0][0])) // no user modes: the query is ignored, a change refused
+		return (words.size() == 1 ? 0 : ERR_UMODEUNKNOWNFLAG);
+	Channel *c = findChannelByName(words[0]);
+	if (!c)
+		return (ERR_NOSUCHCHANNEL);
+	const string &name = c->getChannelName();
 
-	if (mode.empty())
+	if (words.size() == 1)
 	{
-		std::string modes = "+";
-		if (c.isInviteOnly())
+		string modes = "+";
+		if (c->isInviteOnly())
 			modes += "i";
-		if (c.isTopicRestricted())
+		if (c->isTopicRestricted())
 			modes += "t";
-		if (!c.getPassword().empty())
+		if (!c->getPassword().empty())
 			modes += "k";
-		IO::sendString(user.getFd(), ":" + _name + " 324 " + user.getNickname() + " " + c.getChannelName() + (modes == "+" ? "" : " " + modes));
-		return 0;
+		if (c->getUserLimit() != 999)
+			modes += "l " + to_string(c->getUserLimit());
+		IO::sendString(user.getFd(), ":" + _name + " 324 " + user.getNickname() + " " + name + (modes == "+" ? "" : " " + modes));
+		return (0);
 	}
 
-	if (!it->second.isOperator(user))
-	{
-		return (ERR_CHANOPRIVSNEEDED);
-	}
-	if (mode == "-i")
-	{
-		it->second.setInviteOnly(false);
-        res = "Switched Invite only off";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "+i")
-	{
-		it->second.setInviteOnly(true);
-        res = "Switched Invite only on";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "-t")
-	{
-		if (!it->second.isTopicRestricted())
-			it->second.setTopicRestriction(true);
-		else
-			it->second.setTopicRestriction(false);
-        res = "Switched topic restriction off";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "+t")
-	{
-		it->second.setTopicRestriction(true);
-        res = "Switched topic restriction on";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "-k")
-	{
-        it->second.setPassword("");
-        res = "removed password";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "+k")
+	vector<ModeChange>	changes;
+	string				lists;		// b, e and I asked for without a mask
+	size_t				next = 2;	// the next parameter in words
+	size_t				withParam = 0;
+	bool				add = true;
+	bool				denied = false;	// a change asked for by a non-operator
+
+	for (char letter : words[1])
 	{
-		if (extra.empty())
+		if (letter == '+' || letter == '-')
 		{
-            return (ERR_NEEDMOREPARAMS);
+			add = letter == '+';
+			continue;
 		}
-        else
+		bool takesParam = letter == 'o' || string("beI").find(letter) != string::npos
+			|| (add && (letter == 'k' || letter == 'l'));
+		if (string("itklobeI").find(letter) == string::npos)
+			return (ERR_UNKNOWNMODE);
+		if (takesParam && withParam == config.modesMax)
+			break;
+		ModeChange change = {add, letter, "", nullptr};
+		if (takesParam || (letter == 'k' && next < words.size()))
 		{
-            it->second.setPassword(extra);
+			if (next == words.size())
+			{
+				if (string("beI").find(letter) == string::npos)
+					return (ERR_NEEDMOREPARAMS);
+				if (lists.find(letter) == string::npos)
+					lists += letter;
+				continue;
+			}
+			change.param = words[next++];
+			withParam++;
 		}
-        res = "Switched password";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "-o")
-	{
-
-		if (it->second.findUserByNickname(extra))
+		if (!c->isOperator(user))
 		{
-            const User *opp =  getUser(extra);
-			it->second.removeOperator(*opp);
-		}
-		else{
-			return (ERR_NOSUCHNICK);
+			denied = true;	// before its parameter is looked at
+			continue;
 		}
-        res = "removed operator";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "+o")
-	{
-
-		if (it->second.findUserByNickname(extra))
+		unsigned	limit;
+		const char	*invalid = nullptr;
+		if (letter == 'l' && add && !parseLimit(change.param, limit))
+			invalid = "Invalid limit";
+		if (letter == 'k' && add && change.param.find_first_of(" ,") != string::npos)
+			invalid = "Invalid key";
+		if (invalid)
 		{
-            const User *opp =  getUser(extra);
-			it->second.addOperator(*opp);
+			IO::sendString(user.getFd(), ":" + _name + " " + to_string(ERR_INVALIDMODEPARAM) + " " + user.getNickname()
+				+ " " + name + " " + letter + " " + change.param + " :" + invalid);
+			return (0);
 		}
-		else{
-			return (ERR_NOSUCHNICK);
+		if (letter == 'o')
+		{
+			std::optional<std::map<int, User *>::iterator> member = c->findUserByNickname(change.param);
+			if (!member)
+				return (ERR_NOSUCHNICK);
+			change.target = member.value()->second;
 		}
-        res = "Added operator";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
+		if (string("beI").find(letter) != string::npos)
+			change.param = completeMask(change.param);
+		changes.push_back(change);
 	}
-	if (mode == "-l")
-	{
-		it->second.setUserLimit(999);
-        res = "removed Userlimit";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	if (mode == "+l")
+
+	for (char letter : lists)
+		sendMaskList(*c, user, letter);
+	if (denied)
+		return (ERR_CHANOPRIVSNEEDED);
+	if (changes.empty())
+		return (0);
+
+	// apply, keeping what changed: "+it-o" and its parameters
+	string	modes;
+	string	params;
+	char	sign = 0;
+	for (const ModeChange &change : changes)
 	{
-		if (extra.empty())
+		string shown = change.param;
+		switch (change.letter)
 		{
-			return (ERR_NEEDMOREPARAMS);
+			case 'i':
+				if (c->isInviteOnly() == change.add)
+					continue;
+				c->setInviteOnly(change.add);
+				break;
+			case 't':
+				if (c->isTopicRestricted() == change.add)
+					continue;
+				c->setTopicRestriction(change.add);
+				break;
+			case 'k':
+				if (change.add ? c->getPassword() == change.param : c->getPassword().empty())
+					continue;
+				c->setPassword(change.add ? change.param : "");
+				shown = change.add ? change.param : "*";
+				break;
+			case 'l':
+				if (change.add ? c->getUserLimit() == stoul(change.param) : c->getUserLimit() == 999)
+					continue;
+				c->setUserLimit(change.add ? stoul(change.param) : 999);
+				if (change.add)
+					shown = to_string(c->getUserLimit());
+				break;
+			case 'o':
+				if (c->isOperator(*change.target) == change.add)
+					continue;
+				if (change.add)
+					c->addOperator(*change.target);
+				else
+					c->removeOperator(*change.target);
+				shown = change.target->getNickname();
+				break;
+			default: // b, e, I
+			{
+				const vector<MaskList::Entry> &entries = c->getMaskList(change.letter).list();
+				bool listed = find_if(entries.begin(), entries.end(),
+					[&](const MaskList::Entry &e) { return e.mask == change.param; }) != entries.end();
+				if (listed == change.add)
+					continue;
+				if (!change.add)
+					c->removeMask(change.letter, change.param);
+				else if (c->addMask(change.letter, change.param, user.getNickname()) == ERR_BANLISTFULL)
+				{
+					IO::sendString(user.getFd(), ":" + _name + " 478 " + user.getNickname() + " " + name
+						+ " " + change.param + " :Channel list is full");
+					continue;
+				}
+			}
 		}
-		else
+		if (sign != (change.add ? '+' : '-'))
 		{
-			it->second.setUserLimit(stoi(extra));
+			sign = change.add ? '+' : '-';
+			modes += sign;
 		}
-        res = "Set Userlimit";
-        type = INFO;
-        log(type, cmd.command, res);
-        return (0);
-	}
-	else
-	{
-		return (ERR_UNKNOWNMODE);
+		modes += change.letter;
+		if (!shown.empty())
+			params += " " + shown;
 	}
+	if (modes.empty())
+		return (0);
+	IO::sendStringAll(c->getUserList(), user.line("MODE", name + " " + modes + params));
+	log(INFO, "MODE", name + " " + modes + params);
+	return (0);
 }
 
 
-int Server::INVITE(cmd cmd, User &user)
+int Server::INVITE(const cmd &cmd, User &user)
 {
     std::string target;
     std::string channel;
@@ -260,13 +324,12 @@ int Server::INVITE(cmd cmd, User &user)
     {
         return ERR_NEEDMOREPARAMS;
     }
-    auto itOpt = findChannel(channel);
-    if (!itOpt.has_value())
+    Channel *c = findChannelByName(channel);
+    if (!c)
     {
         return ERR_NOSUCHCHANNEL;
     }
-    std::map<std::string, Channel>::iterator it = *itOpt;
-    if (!it->second.isOperator(user))
+    if (!c->isOperator(user))
     {
         return ERR_CHANOPRIVSNEEDED;
     }
@@ -275,12 +338,12 @@ int Server::INVITE(cmd cmd, User &user)
     {
         return ERR_NOSUCHNICK;
     }
-    std::optional<std::map<int, User *>::iterator> it2 = it->second.findUserByNickname(user.getNickname());
+    std::optional<std::map<int, User *>::iterator> it2 = c->findUserByNickname(user.getNickname());
     if (!it2)
     {
         return ERR_NOTONCHANNEL;
     }
-    std::optional<std::map<int, User *>::iterator> it3 = it->second.findUserByNickname(target);
+    std::optional<std::map<int, User *>::iterator> it3 = c->findUserByNickname(target);
     if (it3)
     {
         return ERR_USERONCHANNEL;
@@ -291,6 +354,25 @@ int Server::INVITE(cmd cmd, User &user)
     message2 = "You have been invited by " + user.getNickname() + " to channel " + channel + "\r\n";
     if (IO::sendString(invited->getFd(), message2) < 0)
         std::cerr << "send() error: " << strerror(errno) << std::endl;
-    it->second.addInvite(invited->getFd(), invited);
+    c->addInvite(invited->getFd(), invited);
     return 0;
-}
\ No newline at end of file
+}
+
+// the b, e or I list of a channel (367/368, 348/349, 346/347)
+void	Server::sendMaskList(Channel &channel, User &user, char letter)
+{
+	// entry numeric, end numeric, end text
+	static const map<char, vector<string>> replies = {
+		{'b', {"367", "368", "End of channel ban list"}},
+		{'e', {"348", "349", "End of channel exception list"}},
+		{'I', {"346", "347", "End of channel invite list"}}};
+	const string			&name = channel.getChannelName();
+	const vector<string>	&numerics = replies.at(letter);
+	string					reply;
+
+	for (const MaskList::Entry &e : channel.getMaskList(letter).list())
+		reply += ":" + _name + " " + numerics[0] + " " + user.getNickname() + " " + name + " "
+			+ e.mask + " " + e.setBy + " " + to_string(e.setAt) + "\r\n";
+	IO::sendString(user.getFd(), reply + ":" + _name + " " + numerics[1] + " "
+		+ user.getNickname() + " " + name + " :" + numerics[2]);
+}
@@ -0,0 +1,99 @@
+#include "../includes/ChannelDirectory.hpp"
+#include "../includes/Channel.hpp"
+#include "../includes/Utils.hpp"
+
+void ChannelDirectory::update(const std::string &key, const Channel &channel)
+{
+	size_t	users = channel.getUserList().size();
+	auto	it = byName.find(key);
+
+	if (it != byName.end()) {
+		if (it->second.users == users)
+			return;
+		byCount.erase({it->second.users, key});
+		it->second.users = users;
+	} else {
+		byName.emplace(key, Entry{&channel, users});
+	}
+	byCount.insert({users, key});
+}
+
+void ChannelDirectory::remove(const std::string &key)
+{
+	auto it = byName.find(key);
+	if (it == byName.end())
+		return;
+	byCount.erase({it->second.users, key});
+	byName.erase(it);
+}
+
+void ChannelDirectory::clear()
+{
+	byName.clear();
+	byCount.clear();
+}
+
+/*
+ELIST conditions, comma separated (times in minutes):
+	>n <n		more / less than n users
+	C>n C<n		created more / less than n minutes ago
+	T>n T<n		topic set more / less than n minutes ago
+	!mask		name does not match
+	mask		name matches (channel names are masks without wildcards)
+*/
+bool ListQuery::parse(const std::string &conditions)
+{
+	time_t now = time(nullptr);
+
+	for (std::string_view item : commaSplit(conditions)) {
+		std::string c(item);
+		try {
+			if (c.size() > 1 && (c[0] == '>' || c[0] == '<')) {
+				size_t n = std::stoul(c.substr(1));
+				if (c[0] == '>')
+					minUsers = std::max(minUsers, n + 1);
+				else
+					maxUsers = std::min(maxUsers, n ? n - 1 : 0);
+			} else if (c.size() > 2 && (c[0] == 'C' || c[0] == 'T') && (c[1] == '>' || c[1] == '<')) {
+				time_t	at = now - std::stol(c.substr(2)) * 60;
+				time_t	&after = (c[0] == 'C') ? createdAfter : topicAfter;
+				time_t	&before = (c[0] == 'C') ? createdBefore : topicBefore;
+				if (c[1] == '>')
+					before = std::min(before, at);	// older than n minutes
+				else
+					after = std::max(after, at);	// newer than n minutes
+			} else if (c.size() > 1 && c[0] == '!') {
+				notMasks.emplace_back(c.substr(1));
+			} else if (!c.empty()) {
+				masks.emplace_back(c);
+			}
+		} catch (const std::exception &) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ListQuery::accepts(const Channel &channel) const
+{
+	size_t users = channel.getUserList().size();
+
+	if (users < minUsers || users > maxUsers)
+		return false;
+	if (channel.getCreatedAt() < createdAfter || channel.getCreatedAt() > createdBefore)
+		return false;
+	if ((topicAfter > 0 || topicBefore != std::numeric_limits<time_t>::max())
+		&& (channel.getTopicSetAt() == 0
+			|| channel.getTopicSetAt() < topicAfter || channel.getTopicSetAt() > topicBefore))
+		return false;
+	const std::string &name = channel.getChannelName();
+	for (const Mask &m : notMasks)
+		if (m.matches(name))
+			return false;
+	if (masks.empty())
+		return true;
+	for (const Mask &m : masks)
+		if (m.matches(name))
+			return true;
+	return false;
+}
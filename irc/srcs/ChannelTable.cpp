@@ -0,0 +1,109 @@
+#include "../includes/ChannelTable.hpp"
+#include "../includes/Utils.hpp"
+#include <cstdint>
+
+static inline unsigned char fold(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a over the folded bytes
+size_t ChannelTable::hash(std::string_view name)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (unsigned char c : name)
+		h = (h ^ fold(c)) * 0x100000001b3ULL;
+	return h;
+}
+
+bool ChannelTable::equal(std::string_view key, std::string_view name)
+{
+	if (key.size() != name.size())
+		return false;
+	for (size_t i = 0; i < key.size(); ++i)
+		if ((unsigned char)key[i] != fold(name[i]))
+			return false;
+	return true;
+}
+
+// the slot holding name, or the free slot that ends its probe run
+size_t ChannelTable::locate(std::string_view name, size_t hash) const
+{
+	size_t mask = slots.size() - 1;
+
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		const Slot &slot = slots[i];
+		if (!slot.entry || (slot.hash == hash && equal(slot.entry->key, name)))
+			return i;
+	}
+}
+
+void ChannelTable::grow()
+{
+	std::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2);
+
+	old.swap(slots);
+	size_t mask = slots.size() - 1;
+	for (Slot &slot : old) {
+		if (!slot.entry)
+			continue;
+		size_t i = slot.hash & mask;
+		while (slots[i].entry)
+			i = (i + 1) & mask;
+		slots[i] = std::move(slot);
+	}
+}
+
+ChannelTable::Entry *ChannelTable::find(std::string_view name)
+{
+	if (count == 0)
+		return nullptr;
+	return slots[locate(name, hash(name))].entry.get();
+}
+
+const ChannelTable::Entry *ChannelTable::find(std::string_view name) const
+{
+	if (count == 0)
+		return nullptr;
+	return slots[locate(name, hash(name))].entry.get();
+}
+
+ChannelTable::Entry &ChannelTable::insert(const std::string &name, Channel &&channel)
+{
+	size_t h = hash(name);
+
+	if ((count + 1) * 4 > slots.size() * 3)
+		grow();
+	Slot &slot = slots[locate(name, h)];
+	if (slot.entry)
+		return *slot.entry;
+	slot.hash = h;
+	slot.entry.reset(new Entry{toLowerString(name), std::move(channel)});
+	count++;
+	return *slot.entry;
+}
+
+/*
+Backward shift: each later entry of the run moves into the hole unless
+its home slot lies between the hole and where it sits now.
+*/
+bool ChannelTable::erase(std::string_view name)
+{
+	if (count == 0)
+		return false;
+	size_t mask = slots.size() - 1;
+	size_t hole = locate(name, hash(name));
+	if (!slots[hole].entry)
+		return false;
+	slots[hole].entry.reset();
+	count--;
+	for (size_t i = (hole + 1) & mask; slots[i].entry; i = (i + 1) & mask) {
+		size_t home = slots[i].hash & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			slots[hole] = std::move(slots[i]);
+			hole = i;
+		}
+	}
+	return true;
+}
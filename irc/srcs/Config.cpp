@@ -0,0 +1,215 @@
+#include "../includes/Server.hpp"
+#include <fstream>
+#include <netinet/tcp.h>
+
+static long number(const string &value, long min, long max)
+{
+	size_t	used = 0;
+	long	n;
+
+	try {
+		n = stol(value, &used);
+	} catch (const exception &) {
+		used = 0;
+	}
+	if (used == 0 || used != value.size())
+		throw runtime_error("expected a number, got \"" + value + "\"");
+	if (n < min || n > max)
+		throw runtime_error(value + " is out of range (" + to_string(min) + "-" + to_string(max) + ")");
+	return n;
+}
+
+static bool boolean(const string &value)
+{
+	string v = toLowerString(value);
+
+	if (v == "yes" || v == "on" || v == "true" || v == "1")
+		return true;
+	if (v == "no" || v == "off" || v == "false" || v == "0")
+		return false;
+	throw runtime_error("expected yes or no, got \"" + value + "\"");
+}
+
+static log_level level(const string &value)
+{
+	const string names[] = {"debug", "info", "warn", "error"};
+
+	for (int i = DEBUG; i <= ERROR; ++i)
+		if (compareIgnoreCase(value, names[i]))
+			return log_level(i);
+	throw runtime_error("expected debug, info, warn or error, got \"" + value + "\"");
+}
+
+// surrounding blanks only, unlike trim() a value may end in ':'
+static string strip(const string &s)
+{
+	size_t first = s.find_first_not_of(" \t\r");
+	if (first == string::npos)
+		return "";
+	return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+static string env(const char *name)
+{
+	const char *value = getenv(name);
+	return value ? value : "";
+}
+
+// a line of the file, key already lowercased
+static void setting(Config &c, const string &key, const string &value)
+{
+	if (key == "name") {
+		if (value.empty() || value.size() > 63 || value.find_first_of(" :!@*?,") != string::npos)
+			throw runtime_error("invalid server name \"" + value + "\"");
+		c.name = value;
+	} else if (key == "password") {
+		if (!isValidPassword(value))
+			throw runtime_error("password must be 3 to 20 letters and digits");
+		c.password = value;
+	} else if (key == "ports") {
+		size_t dash = value.find('-');
+		c.portMin = number(value.substr(0, dash), 1, 65535);
+		c.portMax = dash == string::npos ? c.portMin : number(value.substr(dash + 1), c.portMin, 65535);
+	} else if (key == "listen") {
+		istringstream	words(value);
+		string			port;
+		c.listen.clear();
+		while (words >> port)
+			c.listen.push_back(number(port, 1, 65535));
+	} else if (key == "backlog") {
+		c.backlog = number(value, 1, 65535);
+	} else if (key == "tls_cert") {
+		c.tlsCert = value;
+	} else if (key == "tls_key") {
+		c.tlsKey = value;
+	} else if (key == "events") {
+		c.events = value;
+	} else if (key == "accounts") {
+		c.accounts = value;
+	} else if (key == "capture") {
+		c.capture = value;
+	} else if (key == "oper_password") {
+		c.operPassword = value;
+	} else if (key == "trace") {
+		c.trace = value;
+	} else if (key == "slow_command") {
+		c.slowCommand = number(value, 0, 3600000);
+	} else if (key == "slow_loop") {
+		c.slowLoop = number(value, 0, 3600000);
+	} else if (key == "watchdog") {
+		c.watchdog = number(value, 0, 3600000);
+	} else if (key == "log_level") {
+		c.logLevel = level(value);
+	} else if (key == "max_clients") {
+		c.maxClients = number(value, 0, 1 << 24);
+	} else if (key == "targmax") {
+		c.targMax = number(value, 1, 100);
+	} else if (key == "modes") {
+		c.modesMax = number(value, 1, 100);
+	} else if (key == "recvq") {
+		c.io.recvQ = number(value, 512, 1 << 20);
+	} else if (key == "sendq") {
+		c.io.sendQ = number(value, 4096, 1L << 30);
+	} else if (key == "queues") {
+		c.io.queues = number(value, 1 << 20, 1L << 40);
+	} else if (key == "held_max") {
+		c.heldMax = number(value, 1, 100000);
+	} else if (key == "flood_burst") {
+		c.io.floodBurst = number(value, 0, 100000);
+	} else if (key == "flood_rate") {
+		c.io.floodRate = number(value, 1, 100000);
+	} else if (key == "tcp_nodelay") {
+		c.tcpNoDelay = boolean(value);
+	} else if (key == "sndbuf") {
+		c.sendBuffer = number(value, 0, 1 << 30);
+	} else if (key == "rcvbuf") {
+		c.recvBuffer = number(value, 0, 1 << 30);
+	} else if (key == "notsent_lowat") {
+		c.notSentLowat = number(value, 0, 1 << 30);
+	} else if (key == "busy_poll") {
+		c.busyPoll = number(value, 0, 1000000);
+	} else if (key == "keepalive") {
+		c.keepalive = boolean(value);
+	} else if (key == "keepalive_idle") {
+		c.keepIdle = number(value, 0, 32767);
+	} else if (key == "keepalive_interval") {
+		c.keepInterval = number(value, 0, 32767);
+	} else if (key == "keepalive_count") {
+		c.keepCount = number(value, 0, 127);
+	} else {
+		throw runtime_error("unknown setting \"" + key + "\"");
+	}
+}
+
+Config Config::load(const char *path)
+{
+	Config	c;
+	string	targMax = env("IRCSERV_TARGMAX");
+
+	c.tlsCert = env("IRCSERV_TLS_CERT");
+	c.tlsKey = env("IRCSERV_TLS_KEY");
+	c.events = env("IRCSERV_EVENTS");
+	c.accounts = env("IRCSERV_ACCOUNTS");
+	c.capture = env("IRCSERV_CAPTURE");
+	c.operPassword = env("IRCSERV_OPER_PASSWORD");
+	if (atoi(targMax.c_str()) > 0)
+		c.targMax = atoi(targMax.c_str());
+	if (!path || !*path)
+		return c;
+
+	ifstream	file(path);
+	string		line;
+	size_t		lineNumber = 0;
+
+	if (!file)
+		throw runtime_error("cannot read config file " + string(path));
+	c.path = path;
+	while (getline(file, line)) {
+		lineNumber++;
+		size_t comment = line.find('#');
+		while (comment != string::npos && comment > 0 && line[comment - 1] != ' ' && line[comment - 1] != '\t')
+			comment = line.find('#', comment + 1); // only a '#' after a blank starts a comment
+		line = strip(line.substr(0, comment));
+		if (line.empty())
+			continue;
+		size_t equals = line.find('=');
+		string key = toLowerString(strip(line.substr(0, equals)));
+		string value = equals == string::npos ? "" : strip(line.substr(equals + 1));
+		try {
+			if (equals == string::npos || key.empty())
+				throw runtime_error("expected key = value");
+			setting(c, key, value);
+		} catch (const exception &e) {
+			throw runtime_error(c.path + ":" + to_string(lineNumber) + ": " + e.what());
+		}
+	}
+	return c;
+}
+
+/*
+Applied to every client socket when it is accepted and again on reload,
+and to the listeners so accepted sockets start out with the buffer sizes.
+*/
+bool Config::tune(int fd) const
+{
+	int		nodelay = tcpNoDelay, alive = keepalive;
+	bool	ok = true;
+
+	ok &= setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == 0;
+	ok &= setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &alive, sizeof(alive)) == 0;
+	if (sendBuffer)
+		ok &= setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer)) == 0;
+	if (recvBuffer)
+		ok &= setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &recvBuffer, sizeof(recvBuffer)) == 0;
+	if (notSentLowat)
+		ok &= setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notSentLowat, sizeof(notSentLowat)) == 0;
+	if (busyPoll)
+		ok &= setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll)) == 0;
+	if (keepalive && keepIdle)
+		ok &= setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(keepIdle)) == 0;
+	if (keepalive && keepInterval)
+		ok &= setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(keepInterval)) == 0;
+	if (keepalive && keepCount)
+		ok &= setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(keepCount)) == 0;
+	return ok;
+}
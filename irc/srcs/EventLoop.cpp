@@ -0,0 +1,211 @@
+#include "../includes/EventLoop.hpp"
+#include "../includes/Uring.hpp"
+#include "../includes/Utils.hpp"
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+std::unique_ptr<EventLoop> EventLoop::create(const char *kind)
+{
+	std::string backend = (kind && *kind) ? kind : "epoll";
+
+	if (backend == "uring") {
+		try {
+			return std::make_unique<UringLoop>();
+		} catch (const std::exception &e) {
+			log(WARN, "Server", std::string("io_uring unavailable, using epoll: ") + e.what());
+		}
+	} else if (backend == "poll") {
+		return std::make_unique<PollLoop>();
+	} else if (backend != "epoll") {
+		throw std::runtime_error("IRCSERV_EVENTS: unknown backend " + backend);
+	}
+	return std::make_unique<EpollLoop>();
+}
+
+void EventLoop::close(int fd)
+{
+	shutdown(fd, SHUT_RDWR);
+	::close(fd);
+}
+
+double EventLoop::now() const
+{
+	timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void PollLoop::addListener(int fd)
+{
+	slot[fd] = fds.size();
+	fds.push_back({fd, POLLIN, 0});
+	listening.push_back(true);
+}
+
+void PollLoop::add(int fd, bool)
+{
+	slot[fd] = fds.size();
+	fds.push_back({fd, POLLIN, 0});
+	listening.push_back(false);
+}
+
+// the last entry takes the removed one's place
+void PollLoop::remove(int fd)
+{
+	auto it = slot.find(fd);
+	if (it == slot.end())
+		return;
+	size_t index = it->second;
+	slot.erase(it);
+	if (index != fds.size() - 1) {
+		fds[index] = fds.back();
+		listening[index] = listening.back();
+		slot[fds[index].fd] = index;
+	}
+	fds.pop_back();
+	listening.pop_back();
+}
+
+void PollLoop::setEvents(int fd, short events)
+{
+	auto it = slot.find(fd);
+	if (it != slot.end())
+		fds[it->second].events = events;
+}
+
+void PollLoop::wait(int timeoutMs, std::vector<Event> &events)
+{
+	events.clear();
+	if (poll(fds.data(), fds.size(), timeoutMs) < 0) {
+		if (errno == EINTR)
+			return;
+		throw std::runtime_error("Poll error");
+	}
+	for (size_t index = 0; index < fds.size(); index++) {
+		short revents = fds[index].revents;
+		int fd = fds[index].fd;
+
+		if (revents == 0)
+			continue;
+		if (listening[index]) {
+			if (revents & POLLIN) {
+				int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+				events.push_back({Event::ACCEPT, client, fd, client < 0 ? errno : 0});
+			}
+			continue;
+		}
+		if (revents & POLLOUT)
+			events.push_back({Event::WRITABLE, fd, -1, 0});
+		if (revents & (POLLIN | POLLHUP | POLLERR))
+			events.push_back({Event::READABLE, fd, -1, 0});
+	}
+}
+
+// one recv() appended to out, for the backends that leave the bytes to the socket
+static ssize_t receive(int fd, std::string &out)
+{
+	char	buf[512];
+	ssize_t	n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+	if (n > 0)
+		out.append(buf, n);
+	return n;
+}
+
+ssize_t PollLoop::read(int fd, std::string &out)
+{
+	return receive(fd, out);
+}
+
+ssize_t PollLoop::write(int fd, const char *data, size_t len)
+{
+	return send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+EpollLoop::EpollLoop() : epfd(epoll_create1(EPOLL_CLOEXEC)), ready(1024)
+{
+	if (epfd == -1)
+		throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+}
+
+EpollLoop::~EpollLoop()
+{
+	::close(epfd);
+}
+
+void EpollLoop::control(int op, int fd, uint32_t events, bool listener)
+{
+	epoll_event ev = {};
+
+	ev.events = events;
+	ev.data.u64 = uint32_t(fd) | (listener ? EPOLL_LISTENER : 0);
+	if (epoll_ctl(epfd, op, fd, &ev) == -1 && op != EPOLL_CTL_DEL)
+		log(ERROR, "Server", "epoll_ctl on fd " + std::to_string(fd) + ": " + strerror(errno));
+}
+
+void EpollLoop::addListener(int fd)
+{
+	control(EPOLL_CTL_ADD, fd, EPOLLIN, true);
+}
+
+void EpollLoop::add(int fd, bool)
+{
+	control(EPOLL_CTL_ADD, fd, EPOLLIN);
+	interest[fd] = POLLIN;
+}
+
+void EpollLoop::remove(int fd)
+{
+	control(EPOLL_CTL_DEL, fd, 0);
+	interest.erase(fd);
+}
+
+// events are poll(2) bits; EPOLLIN and EPOLLOUT have the same values
+void EpollLoop::setEvents(int fd, short events)
+{
+	auto it = interest.find(fd);
+	if (it == interest.end() || it->second == events)
+		return;
+	it->second = events;
+	control(EPOLL_CTL_MOD, fd, events & (POLLIN | POLLOUT));
+}
+
+void EpollLoop::wait(int timeoutMs, std::vector<Event> &events)
+{
+	events.clear();
+	int n = epoll_wait(epfd, ready.data(), ready.size(), timeoutMs);
+	if (n < 0) {
+		if (errno == EINTR)
+			return;
+		throw std::runtime_error("epoll_wait error");
+	}
+	for (int i = 0; i < n; i++) {
+		uint32_t	revents = ready[i].events;
+		int			fd = int(ready[i].data.u64 & 0xffffffff);
+
+		if (ready[i].data.u64 & EPOLL_LISTENER) {
+			int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+			events.push_back({Event::ACCEPT, client, fd, client < 0 ? errno : 0});
+			continue;
+		}
+		if (revents & EPOLLOUT)
+			events.push_back({Event::WRITABLE, fd, -1, 0});
+		if (revents & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			events.push_back({Event::READABLE, fd, -1, 0});
+	}
+	if (size_t(n) == ready.size() && ready.size() < EPOLL_BATCH_MAX)
+		ready.resize(ready.size() * 2);
+}
+
+ssize_t EpollLoop::read(int fd, std::string &out)
+{
+	return receive(fd, out);
+}
+
+ssize_t EpollLoop::write(int fd, const char *data, size_t len)
+{
+	return send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
@@ -1,10 +1,282 @@
 #include "../includes/IO.hpp"
 #include "../includes/Server.hpp"
 #include "../includes/Utils.hpp"
+#include "../includes/Tls.hpp"
+#include "../includes/EventLoop.hpp"
+#include "../includes/Capture.hpp"
+#include "../includes/Simd.hpp"
 #include <sstream>
 #include <sys/socket.h>
 #include <map>
 
+std::map<int, Connection>	IO::connections;
+unsigned					IO::batchId = 0;
+QueueStats					IO::totals;
+std::vector<int>			IO::dropped;
+std::vector<int>			IO::flipped;
+EventLoop					*IO::loop = nullptr;
+IOLimits					IO::limits;
+uint64_t					IO::messages = 0;
+
+static std::string addTag(const std::string &line, const std::string &tag)
+{
+    if (!line.empty() && line[0] == '@')
+        return "@" + tag + ";" + line.substr(1);
+    return "@" + tag + " " + line;
+}
+
+static std::string serverTime()
+{
+    timespec	ts;
+    tm			utc;
+    char		buf[40];
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &utc);
+    size_t len = strftime(buf, sizeof(buf), "time=%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(buf + len, sizeof(buf) - len, ".%03ldZ", ts.tv_nsec / 1000000);
+    return buf;
+}
+
+static std::vector<std::string> splitLines(const std::string &s)
+{
+    std::vector<std::string>	lines;
+    size_t						start = 0, end;
+
+    while (start < s.size()) {
+        end = s.find("\r\n", start);
+        if (end == std::string::npos)
+            end = s.size();
+        if (end > start)
+            lines.push_back(s.substr(start, end - start));
+        start = end + 2;
+    }
+    return lines;
+}
+
+unsigned IO::caps(const int fd)
+{
+    auto it = connections.find(fd);
+    return it == connections.end() ? 0 : it->second.caps;
+}
+
+// tags each line as the connection's capabilities ask for and joins them with CRLF
+std::string IO::frame(const Connection &conn, const std::vector<std::string> &lines)
+{
+    std::string message;
+    std::string time = (conn.caps & CAP_SERVER_TIME) ? serverTime() : "";
+
+    for (const std::string &line : lines) {
+        message += time.empty() ? line : addTag(line, time);
+        message += "\r\n";
+    }
+    return message;
+}
+
+/*
+Everything for a client goes through its SendQ: written right away as
+far as the socket takes it, the rest kept until the event loop reports
+the connection writable (see flush). The SendQ only holds memory while
+something is pending: a message the socket takes whole is written
+straight from the caller's string. A client whose SendQ outgrows
+limits.sendQ, or that would push all queues past limits.queues, is marked
+closing and its queue freed; the server reaps it after the current
+command.
+*/
+ssize_t IO::transmit(const int fd, const std::string &message)
+{
+    Connection &conn = connection(fd);
+
+    if (!conn.closing.empty())
+        return message.size();
+    size_t queued = conn.output.size() - conn.sent;
+    if (queued + message.size() > limits.sendQ) {
+        drop(fd, conn, "Max SendQ exceeded");
+        return message.size();
+    }
+    if (totals.recvQ + totals.sendQ + message.size() > limits.queues) {
+        drop(fd, conn, "Server out of queue memory");
+        return message.size();
+    }
+    messages++;
+    if (queued > 0) {
+        conn.output += message;
+        totals.sendQ += message.size();
+        return message.size();
+    }
+    size_t written = write(fd, conn, message.data(), message.size());
+    if (written < message.size() && conn.closing.empty()) {
+        conn.output.assign(message, written);
+        totals.sendQ += message.size() - written;
+        flipped.push_back(fd);
+    }
+    return message.size();
+}
+
+// as much of data as the socket takes now; a write error drops the connection
+size_t IO::write(const int fd, Connection &conn, const char *data, size_t len)
+{
+    Span span("send", fd);
+
+    while (span.count < len) {
+        const char	*from = data + span.count;
+        size_t		left = len - span.count;
+        ssize_t		n = Tls::has(fd) ? Tls::write(fd, from, left) : loop->write(fd, from, left);
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        if (n < 0) {
+            drop(fd, conn, std::string("Write error: ") + strerror(errno));
+            break;
+        }
+        if (n == 0)
+            break; // TLS handshake still running
+        span.count += n;
+    }
+    return span.count;
+}
+
+void IO::flush(const int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end() || !it->second.closing.empty() || it->second.output.empty())
+        return;
+    Connection &conn = it->second;
+    size_t written = write(fd, conn, conn.output.data() + conn.sent, conn.output.size() - conn.sent);
+
+    if (!conn.closing.empty())
+        return;
+    conn.sent += written;
+    totals.sendQ -= written;
+    if (conn.sent == conn.output.size()) {
+        conn.output.clear();
+        conn.output.shrink_to_fit();
+        conn.sent = 0;
+        flipped.push_back(fd);
+    } else if (conn.sent > conn.output.size() / 2) {
+        conn.output.erase(0, conn.sent);
+        conn.sent = 0;
+    }
+}
+
+bool IO::wantsWrite(const int fd)
+{
+    return queued(fd) > 0;
+}
+
+size_t IO::queued(const int fd)
+{
+    auto it = connections.find(fd);
+    return it == connections.end() ? 0 : it->second.output.size() - it->second.sent;
+}
+
+/*
+Flood control: each command spends one credit, credit comes back at
+limits.floodRate per second up to limits.floodBurst. False once the
+client has none left; always true with floodBurst at 0.
+*/
+bool IO::admit(const int fd)
+{
+    if (limits.floodBurst <= 0)
+        return true;
+    Connection	&conn = connection(fd);
+    double		now = loop->now();
+    if (conn.credit < 0)
+        conn.credit = limits.floodBurst;
+    else
+        conn.credit = std::min(limits.floodBurst, conn.credit + (now - conn.creditAt) * limits.floodRate);
+    conn.creditAt = now;
+    if (conn.credit < 1)
+        return false;
+    conn.credit -= 1;
+    return true;
+}
+
+void IO::drop(const int fd, Connection &conn, const std::string &reason)
+{
+    log(WARN, "Connection", "Dropping fd " + std::to_string(fd) + ": " + reason);
+    totals.sendQ -= conn.output.size() - conn.sent;
+    totals.recvQ -= conn.input.size();
+    conn.output.clear();
+    conn.output.shrink_to_fit();
+    conn.input.clear();
+    conn.input.shrink_to_fit();
+    conn.sent = 0;
+    conn.closing = reason;
+    totals.evicted++;
+    dropped.push_back(fd);
+}
+
+// connections marked closing since the last call
+std::vector<int> IO::takeDropped()
+{
+    std::vector<int> fds;
+    fds.swap(dropped);
+    return fds;
+}
+
+/*
+Connections whose SendQ became empty or non-empty since the last call,
+the only ones whose POLLOUT interest can have changed. A connection can
+be listed more than once or be gone already.
+*/
+std::vector<int> IO::takeFlipped()
+{
+    std::vector<int> fds;
+    fds.swap(flipped);
+    return fds;
+}
+
+void IO::forget(const int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end())
+        return;
+    totals.sendQ -= it->second.output.size() - it->second.sent;
+    totals.recvQ -= it->second.input.size();
+    connections.erase(it);
+}
+
+QueueStats IO::stats()
+{
+    QueueStats s = totals;
+    for (const auto &[fd, conn] : connections)
+        s.largestSendQ = std::max(s.largestSendQ, conn.output.size() - conn.sent);
+    return s;
+}
+
+// replies to fd are held back until endLabel() so they can carry the label
+void IO::beginLabel(const int fd, const std::string &label)
+{
+    connection(fd).labeled.reset(new Labeled{label, {}});
+}
+
+void IO::endLabel(const int fd, const std::string &server)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end() || !it->second.labeled)
+        return; // connection closed by the command
+    Connection					&conn = it->second;
+    std::unique_ptr<Labeled>	labeled = std::move(conn.labeled);
+    std::vector<std::string>	&lines = labeled->lines;
+    std::string					tag = "label=" + labeled->label;
+
+    if (lines.empty()) {
+        lines.push_back(addTag(":" + server + " ACK", tag));
+    } else if (lines.size() == 1 || !(conn.caps & CAP_BATCH)) {
+        for (std::string &line : lines)
+            line = addTag(line, tag);
+    } else {
+        std::string id = "l" + std::to_string(++batchId);
+        for (std::string &line : lines)
+            line = addTag(line, "batch=" + id);
+        lines.insert(lines.begin(), addTag(":" + server + " BATCH +" + id + " labeled-response", tag));
+        lines.push_back(":" + server + " BATCH -" + id);
+    }
+    log(DEBUG, "SEND " + std::to_string(fd), "labeled response " + labeled->label);
+    transmit(fd, frame(conn, lines));
+}
+
 ssize_t IO::sendCommand(const int fd, const cmd &cmd)
 {
     stringstream stream;
@@ -24,16 +296,29 @@ ssize_t IO::sendString(int fd, const std::string &s)
         return 0;
     log(DEBUG, "SEND " + std::to_string(fd), s);
 
-    std::string message = s;
-    message += "\r\n";
+    auto conn = connections.find(fd);
+    if (conn != connections.end() && (conn->second.labeled || conn->second.caps & CAP_SERVER_TIME)) {
+        std::vector<std::string> lines = splitLines(s);
+        if (!conn->second.labeled)
+            return transmit(fd, frame(conn->second, lines));
+        for (std::string &line : lines)
+            conn->second.labeled->lines.push_back(std::move(line));
+        return s.size();
+    }
 
-    return send(fd, message.c_str(), message.size(), 0);
+    // lines built for many recipients already end in CRLF and go out without a copy
+    if (s.size() >= 2 && s.compare(s.size() - 2, 2, "\r\n") == 0)
+        return transmit(fd, s);
+    return transmit(fd, s + "\r\n");
 }
 
 // UPDATED TO USE POINTERS
 ssize_t IO::sendCommandAll(const std::map<int, User *> &m, const cmd &cmd)
 {
     ssize_t ret, result = 0;
+    Span span("broadcast");
+
+    span.count = m.size();
     for (const auto &pair : m)
     {
         if (pair.second) // Safety check
@@ -51,6 +336,9 @@ ssize_t IO::sendCommandAll(const std::map<int, User *> &m, const cmd &cmd)
 ssize_t IO::sendStringAll(const std::map<int, User *> &m, const std::string &s)
 {
     ssize_t ret, result = 0;
+    Span span("broadcast");
+
+    span.count = m.size();
     for (const auto &pair : m)
     {
         if (pair.second) // Safety check
@@ -64,48 +352,121 @@ ssize_t IO::sendStringAll(const std::map<int, User *> &m, const std::string &s)
     return result;
 }
 
-std::vector<cmd> IO::recvCommands(const int fd)
+// what happened instead of commands: PARTIAL, DISCONNECT or ERROR
+static std::pmr::vector<cmd> status(const char *what, std::string_view arguments = "")
 {
-    static std::string message[1024]; // replace with some max limit of clients
-    char buf[512];
-    ssize_t bytesReceived = recv(fd, buf, sizeof(buf), 0);
+    std::pmr::vector<cmd> result(Arena::get());
+    result.push_back({"", what, std::pmr::string(arguments, Arena::get())});
+    return result;
+}
+
+static std::pmr::string arenaString(std::string_view s)
+{
+    return std::pmr::string(s, Arena::get());
+}
+
+/*
+Only complete lines are parsed; an unfinished one stays in the RecvQ
+for the next read. A line that outgrows limits.recvQ without ending ends
+the connection instead ("ERROR" with the reason as arguments). The
+commands are in the Arena, valid until the loop round ends.
+*/
+std::pmr::vector<cmd> IO::recvCommands(const int fd)
+{
+    ssize_t bytesReceived;
+    Connection &conn = connection(fd);
+    std::string &message = conn.input;
+    size_t before = message.size();
+    Span span("recv", fd);
+
+    if (Tls::has(fd))
+        bytesReceived = Tls::read(fd, message);
+    else
+        bytesReceived = loop->read(fd, message);
+    totals.recvQ += message.size() - before;
+    span.count = message.size() - before;
 
+    if (bytesReceived < 0 && errno == EAGAIN)
+        return status("PARTIAL");
     if (bytesReceived <= 0)
     {
-        message[fd] = "";
+        totals.recvQ -= message.size();
+        message = "";
         if (bytesReceived == 0)
-            return {{"", "DISCONNECT", ""}};
+            return status("DISCONNECT");
         else
-            return {{"", "ERROR", ""}};
+            return status("ERROR");
     }
 
-    buf[bytesReceived] = '\0';
-    message[fd] += string(buf);
-    if (message[fd].find("\r\n") == std::string::npos)
-        return {{"", "PARTIAL", ""}};
-    
-    istringstream stream(message[fd]);
-    std::string line;
-    std::vector<cmd> commands;
-    
-    while (getline(stream, line))
-    {
-        cmd cmd = {"", "", ""};
-        istringstream lstream(line);
-        if (line[0] == ':')
-            getline(lstream, cmd.prefix, ' ');
-        getline(lstream, cmd.command, ' ');
-        getline(lstream, cmd.arguments, '\r');
-
-        log(DEBUG, "RECV " + to_string(fd), line);
+    size_t complete = message.rfind('\n');
+    size_t unfinished = (complete == std::string::npos) ? message.size() : message.size() - complete - 1;
+    if (unfinished > limits.recvQ) {
+        drop(fd, conn, "Max RecvQ exceeded");
+        return status("ERROR", conn.closing);
+    }
+    if (complete == std::string::npos)
+        return status("PARTIAL");
 
-        cmd.prefix = trim(cmd.prefix);
-        cmd.command = trim(cmd.command);
-        cmd.arguments = trim(cmd.arguments);
+    std::pmr::vector<cmd> commands(Arena::get());
+    std::string_view rest(message.data(), complete + 1);
+    while (!rest.empty())
+    {
+        // a line's text ends at its first CR or LF, the line itself at the LF
+        std::string_view line = rest.substr(0, Simd::findEol(rest));
+        rest.remove_prefix(rest.find('\n', line.size()) + 1);
+        if (line.empty())
+            continue;
+        Capture::line(fd, line);
+        if (logs(DEBUG))
+            log(DEBUG, "RECV " + to_string(fd), std::string(line));
 
-        commands.push_back(cmd);
+        std::string_view tags;
+        if (line[0] == '@')
+        {
+            tags = line.substr(1, line.find(' ') - 1);
+            line.remove_prefix(std::min(line.size(), tags.size() + 2));
+        }
+        std::string_view prefix = line.substr(0, !line.empty() && line[0] == ':' ? line.find(' ') : 0);
+        line.remove_prefix(std::min(line.size(), prefix.size() + (prefix.empty() ? 0 : 1)));
+        size_t space = std::min(line.find(' '), line.size());
+        commands.push_back({arenaString(trim(prefix)), arenaString(trim(line.substr(0, space))),
+            arenaString(trim(line.substr(std::min(space + 1, line.size())))), arenaString(tags)});
     }
-    message[fd] = "";
+    totals.recvQ -= complete + 1;
+    message.erase(0, complete + 1);
+    if (message.empty())
+        message.shrink_to_fit(); // nothing pending, the RecvQ gives its memory back
+    if (commands.empty())
+        return status("PARTIAL");
     return commands;
 }
 
+
+// partial input of a connection, carried over a hot upgrade
+const std::string &IO::getPending(const int fd)
+{
+    return connection(fd).input;
+}
+
+void IO::setPending(const int fd, const std::string &s)
+{
+    Connection &conn = connection(fd);
+    totals.recvQ += s.size() - conn.input.size();
+    conn.input = s;
+}
+
+// unsent output of a connection, carried over a hot upgrade
+std::string IO::getQueued(const int fd)
+{
+    const Connection &conn = connection(fd);
+    return conn.output.substr(conn.sent);
+}
+
+void IO::setQueued(const int fd, const std::string &s)
+{
+    Connection &conn = connection(fd);
+    totals.sendQ += s.size() - (conn.output.size() - conn.sent);
+    conn.output = s;
+    conn.sent = 0;
+    flipped.push_back(fd);
+}
@@ -0,0 +1,48 @@
+#include "../includes/Interned.hpp"
+
+Interned::Pool &Interned::pool()
+{
+	static Pool strings;
+	return strings;
+}
+
+Interned::Pool::value_type *Interned::acquire(const std::string &text)
+{
+	if (text.empty())
+		return nullptr;
+	Pool::value_type &entry = *pool().try_emplace(text, 0).first;
+	entry.second++;
+	return &entry;
+}
+
+void Interned::release()
+{
+	if (entry && --entry->second == 0)
+		pool().erase(pool().find(entry->first));
+	entry = nullptr;
+}
+
+Interned &Interned::operator=(const Interned &other)
+{
+	if (entry == other.entry)
+		return *this;
+	release();
+	entry = other.entry;
+	if (entry)
+		entry->second++;
+	return *this;
+}
+
+Interned &Interned::operator=(const std::string &text)
+{
+	Pool::value_type *next = acquire(text);
+	release();
+	entry = next;
+	return *this;
+}
+
+const std::string &Interned::str() const
+{
+	static const std::string none;
+	return entry ? entry->first : none;
+}
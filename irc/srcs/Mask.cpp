@@ -0,0 +1,160 @@
+#include "../includes/Mask.hpp"
+#include "../includes/Utils.hpp"
+
+Mask::Mask(const std::string &pattern) : anchoredStart(true), anchoredEnd(true), minLength(0)
+{
+	std::string lower = toLowerString(pattern);
+	size_t		start = 0;
+
+	anchoredStart = lower.empty() || lower[0] != '*';
+	anchoredEnd = lower.empty() || lower.back() != '*';
+	while (start <= lower.size()) {
+		size_t star = lower.find('*', start);
+		if (star == std::string::npos)
+			star = lower.size();
+		if (star > start || segments.empty())
+			segments.push_back(lower.substr(start, star - start));
+		minLength += star - start;
+		start = star + 1;
+	}
+	if (anchoredStart)
+		prefix = segments[0].substr(0, segments[0].find('?'));
+	if (anchoredEnd) {
+		size_t wild = segments.back().rfind('?');
+		suffix = segments.back().substr(wild == std::string::npos ? 0 : wild + 1);
+	}
+}
+
+// segment (lowercase, '?' = any char) matches s at pos
+bool Mask::segmentAt(const std::string &segment, const std::string &s, size_t pos)
+{
+	for (size_t i = 0; i < segment.size(); ++i) {
+		char c = s[pos + i];
+		if (segment[i] != '?' && segment[i] != std::tolower(static_cast<unsigned char>(c)))
+			return false;
+	}
+	return true;
+}
+
+bool Mask::matches(const std::string &s) const
+{
+	if (s.size() < minLength)
+		return false;
+	if (isLiteral())
+		return s.size() == segments[0].size() && segmentAt(segments[0], s, 0);
+
+	size_t pos = 0, first = 0, last = segments.size();
+	if (anchoredStart) {
+		if (!segmentAt(segments[0], s, 0))
+			return false;
+		pos = segments[0].size();
+		first = 1;
+	}
+	if (anchoredEnd) {
+		const std::string &tail = segments.back();
+		if (tail.size() > s.size() - pos || !segmentAt(tail, s, s.size() - tail.size()))
+			return false;
+		last--;
+	}
+	size_t end = anchoredEnd ? s.size() - segments.back().size() : s.size();
+	for (size_t i = first; i < last; ++i) {
+		const std::string &segment = segments[i];
+		while (pos + segment.size() <= end && !segmentAt(segment, s, pos))
+			pos++;
+		if (pos + segment.size() > end)
+			return false;
+		pos += segment.size();
+	}
+	return true;
+}
+
+void MaskList::file(size_t i)
+{
+	const Mask &m = compiled[i];
+
+	if (!m.literalSuffix().empty()) {
+		bySuffix[m.literalSuffix()].push_back(i);
+		suffixLengths[m.literalSuffix().size()]++;
+	} else if (!m.literalPrefix().empty()) {
+		byPrefix[m.literalPrefix()].push_back(i);
+		prefixLengths[m.literalPrefix().size()]++;
+	} else {
+		unanchored.push_back(i);
+	}
+}
+
+void MaskList::refile()
+{
+	bySuffix.clear();
+	byPrefix.clear();
+	suffixLengths.clear();
+	prefixLengths.clear();
+	unanchored.clear();
+	for (size_t i = 0; i < compiled.size(); ++i)
+		file(i);
+}
+
+// false if an equal mask is already listed
+bool MaskList::add(const std::string &mask, const std::string &setBy, time_t setAt)
+{
+	for (const Entry &e : entries)
+		if (compareIgnoreCase(e.mask, mask))
+			return false;
+	entries.push_back({mask, setBy, setAt});
+	compiled.emplace_back(mask);
+	file(compiled.size() - 1);
+	return true;
+}
+
+bool MaskList::remove(const std::string &mask)
+{
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (compareIgnoreCase(entries[i].mask, mask)) {
+			entries.erase(entries.begin() + i);
+			compiled.erase(compiled.begin() + i);
+			refile();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MaskList::matches(const std::string &target) const
+{
+	if (entries.empty())
+		return false;
+	std::string lower = toLowerString(target);
+
+	for (const auto &[length, count] : suffixLengths) {
+		if (length > lower.size())
+			break;
+		auto group = bySuffix.find(lower.substr(lower.size() - length));
+		if (group != bySuffix.end())
+			for (size_t i : group->second)
+				if (compiled[i].matches(lower))
+					return true;
+	}
+	for (const auto &[length, count] : prefixLengths) {
+		if (length > lower.size())
+			break;
+		auto group = byPrefix.find(lower.substr(0, length));
+		if (group != byPrefix.end())
+			for (size_t i : group->second)
+				if (compiled[i].matches(lower))
+					return true;
+	}
+	for (size_t i : unanchored)
+		if (compiled[i].matches(lower))
+			return true;
+	return false;
+}
+
+void PrefixIndex::insert(const std::string &key, int fd)
+{
+	entries.insert({toLowerString(key), fd});
+}
+
+void PrefixIndex::erase(const std::string &key, int fd)
+{
+	entries.erase({toLowerString(key), fd});
+}
@@ -0,0 +1,205 @@
+#include "Server.hpp"
+
+/*
+IRCv3 MONITOR, and the older ISON and USERHOST, so clients stop polling
+WHOIS to see who is online. Every client's list lives in monitored, and
+watchers is the reverse index: for each lowercase nick, who monitors
+it. Registration, a nick change and a disconnect look up that one nick
+and tell its watchers with 730 (online) or 731 (offline).
+*/
+
+#define MONITOR_LINE	400	// targets are packed into replies of about this many bytes
+
+// head + items, as many per line as fit; no CRLF after the last line, sendString adds it
+static string packLines(const string &head, const vector<string> &items, char separator)
+{
+	string out, line;
+
+	for (const string &item : items) {
+		if (!line.empty() && line.size() + item.size() >= MONITOR_LINE) {
+			out += head + line + "\r\n";
+			line.clear();
+		}
+		if (!line.empty())
+			line += separator;
+		line += item;
+	}
+	if (!line.empty())
+		out += head + line;
+	return out;
+}
+
+void Server::watch(int fd, const string &nick) {
+	string key = toLowerString(nick);
+
+	if (monitored[fd].emplace(key, nick).second)
+		watchers[key].insert(fd);
+}
+
+void Server::unwatch(int fd, const string &key) {
+	auto list = monitored.find(fd);
+
+	if (list == monitored.end() || !list->second.erase(key))
+		return;
+	if (list->second.empty())
+		monitored.erase(list);
+	auto it = watchers.find(key);
+	it->second.erase(fd);
+	if (it->second.empty())
+		watchers.erase(it);
+}
+
+void Server::unwatchAll(int fd) {
+	auto list = monitored.find(fd);
+
+	if (list == monitored.end())
+		return;
+	for (const auto &[key, nick] : list->second) {
+		auto it = watchers.find(key);
+		it->second.erase(fd);
+		if (it->second.empty())
+			watchers.erase(it);
+	}
+	monitored.erase(list);
+}
+
+// online: the user now registered under nick, nullptr: nick went offline
+void Server::notifyWatchers(const string &nick, const User *online) {
+	auto it = watchers.find(toLowerString(nick));
+
+	if (it == watchers.end())
+		return;
+	string tail = online ? " :" + string(online->getHostmask()) : " :" + nick;
+	Span span("monitor");
+	for (int fd : it->second) {
+		auto watcher = users.find(fd);
+		if (watcher == users.end())
+			continue;
+		IO::sendString(fd, ":" + _name + (online ? " 730 " : " 731 ") + watcher->second.getNickname() + tail);
+		span.count++;
+	}
+}
+
+// 730 with the masks of the nicks that are online, 731 with the others
+void Server::sendMonitorStatus(const User &user, const vector<string> &nicks) {
+	vector<string> online, offline;
+
+	for (const string &nick : nicks) {
+		const User *target = findUserByNickName(nick);
+		if (target && target->getIsRegistered())
+			online.push_back(string(target->getHostmask()));
+		else
+			offline.push_back(nick);
+	}
+	string head = ":" + _name + " ";
+	string reply = packLines(head + "730 " + user.getNickname() + " :", online, ',');
+	string rest = packLines(head + "731 " + user.getNickname() + " :", offline, ',');
+	if (!reply.empty() && !rest.empty())
+		reply += "\r\n";
+	reply += rest;
+	if (!reply.empty())
+		IO::sendString(user.getFd(), reply);
+}
+
+/*
+MONITOR + a,b,c: watch these nicks (up to MONITOR_MAX), answered with
+their status. MONITOR - a,b: stop. C: clear the list. L: show it (732,
+733). S: the status of everything on it.
+*/
+int	Server::MONITOR(const cmd &cmd, User &user) {
+	parsedArgs	args = parseArgs(cmd.arguments, 2, true);
+	int			fd = user.getFd();
+
+	if (args.args.empty())
+		return (ERR_NEEDMOREPARAMS);
+	string_view		sub = args.args[0];
+	vector<string>	targets;
+	for (string_view target : commaSplit(args.trailing))
+		if (!target.empty())
+			targets.push_back(string(target));
+
+	if ((sub == "+" || sub == "-") && targets.empty())
+		return (ERR_NEEDMOREPARAMS);
+	auto list = monitored.find(fd);
+	if (sub == "+") {
+		vector<string> added;
+		for (size_t i = 0; i < targets.size(); ++i) {
+			list = monitored.find(fd);
+			size_t size = list == monitored.end() ? 0 : list->second.size();
+			if (size >= MONITOR_MAX && !list->second.count(toLowerString(targets[i]))) {
+				string rest;
+				for (size_t j = i; j < targets.size(); ++j)
+					rest += (j == i ? "" : ",") + targets[j];
+				IO::sendString(fd, ":" + _name + " " + to_string(ERR_MONLISTFULL) + " " + user.getNickname()
+					+ " " + to_string(MONITOR_MAX) + " " + rest + " :Monitor list is full.");
+				break;
+			}
+			watch(fd, targets[i]);
+			added.push_back(targets[i]);
+		}
+		sendMonitorStatus(user, added);
+	} else if (sub == "-") {
+		for (const string &target : targets)
+			unwatch(fd, toLowerString(target));
+	} else if (sub == "C") {
+		unwatchAll(fd);
+	} else if (sub == "L" || sub == "S") {
+		vector<string> nicks;
+		if (list != monitored.end())
+			for (const auto &[key, nick] : list->second)
+				nicks.push_back(nick);
+		if (sub == "S") {
+			sendMonitorStatus(user, nicks);
+			return (0);
+		}
+		string reply = packLines(":" + _name + " 732 " + user.getNickname() + " :", nicks, ',');
+		IO::sendString(fd, reply + (reply.empty() ? "" : "\r\n") + ":" + _name + " 733 "
+			+ user.getNickname() + " :End of MONITOR list");
+	}
+	return (0);
+}
+
+// ISON nick...: the ones that are online, as they spell themselves
+int	Server::ISON(const cmd &cmd, User &user) {
+	istringstream	words(cmd.arguments);
+	string			nick;
+	vector<string>	online;
+	bool			asked = false;
+
+	while (words >> nick) {
+		if (nick[0] == ':')
+			nick.erase(0, 1);
+		asked = asked || !nick.empty();
+		const User *target = nick.empty() ? nullptr : findUserByNickName(nick);
+		if (target && target->getIsRegistered())
+			online.push_back(target->getNickname());
+	}
+	if (!asked)
+		return (ERR_NEEDMOREPARAMS);
+	string list;
+	for (const string &name : online)
+		list += (list.empty() ? "" : " ") + name;
+	IO::sendString(user.getFd(), ":" + _name + " 303 " + user.getNickname() + " :" + list);
+	return (0);
+}
+
+// USERHOST nick...: nick[*]=+user@host for up to 5 nicks, * for IRC operators
+int	Server::USERHOST(const cmd &cmd, User &user) {
+	istringstream	words(cmd.arguments);
+	string			nick, list;
+
+	if (cmd.arguments.empty())
+		return (ERR_NEEDMOREPARAMS);
+	for (int asked = 0; asked < 5 && words >> nick; ++asked) {
+		if (nick[0] == ':')
+			nick.erase(0, 1);
+		const User *target = nick.empty() ? nullptr : findUserByNickName(nick);
+		if (!target || !target->getIsRegistered())
+			continue;
+		string_view mask = target->getHostmask();
+		list += (list.empty() ? "" : " ") + target->getNickname() + (target->getIsOperator() ? "*" : "")
+			+ "=+" + string(mask.substr(mask.find('!') + 1));
+	}
+	IO::sendString(user.getFd(), ":" + _name + " 302 " + user.getNickname() + " :" + list);
+	return (0);
+}
@@ -0,0 +1,139 @@
+#include "Server.hpp"
+
+/*
+SASL PLAIN (the "sasl" capability, AUTHENTICATE) against the local
+accounts. The password hash is checked on the worker pool; meanwhile
+the client's further commands are held (see Server::hold), so a CAP END
+sent right behind the credentials waits for the outcome.
+Logging in also stands in for the server password (PASS).
+*/
+
+#define SASL_CHUNK	400		// payload per AUTHENTICATE line, a full one means more follows
+#define SASL_MAX	1200	// base64 payload of one exchange
+
+// strict base64, false on anything else
+static bool decodeBase64(const string &in, string &out) {
+	static const string	alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned			bits = 0, count = 0;
+	size_t				padding = 0;
+
+	if (in.size() % 4 != 0)
+		return false;
+	out.clear();
+	for (char c : in) {
+		if (c == '=') {
+			padding++;
+			continue;
+		}
+		size_t value = alphabet.find(c);
+		if (padding || value == string::npos)
+			return false;
+		bits = (bits << 6) | value;
+		if (++count % 4 == 0) {
+			out += char(bits >> 16);
+			out += char(bits >> 8);
+			out += char(bits);
+			bits = 0;
+		}
+	}
+	if (padding > 2)
+		return false;
+	if (count % 4 == 2)
+		out += char(bits >> 4);
+	else if (count % 4 == 3) {
+		out += char(bits >> 10);
+		out += char(bits >> 2);
+	}
+	return true;
+}
+
+Task	Server::AUTHENTICATE(cmd cmd, int fd) {
+	User	*user = &users[fd];
+	string	arg;
+
+	{ // the parsed list is in the Arena, gone by the time the hash is checked
+		parsedArgs saslArgs = parseArgs(cmd.arguments, 1, false);
+		if (saslArgs.args.empty()) {
+			sendMessage(ERR_NEEDMOREPARAMS, cmd, *user);
+			co_return;
+		}
+		arg = saslArgs.args[0];
+	}
+	if (!(IO::caps(fd) & CAP_SASL) || user->getIsRegistered()) {
+		sendMessage(ERR_SASLFAIL, cmd, *user);
+		co_return;
+	}
+	if (!user->getAccount().empty()) {
+		sendMessage(ERR_SASLALREADY, cmd, *user);
+		co_return;
+	}
+	if (arg == "*") {
+		user->setSasl(false);
+		sendMessage(ERR_SASLABORTED, cmd, *user);
+		co_return;
+	}
+	if (!user->isAuthenticating()) {
+		if (!compareIgnoreCase(arg, "PLAIN")) {
+			sendMessage(RPL_SASLMECHS, cmd, *user);
+			sendMessage(ERR_SASLFAIL, cmd, *user);
+			co_return;
+		}
+		user->setSasl(true);
+		IO::sendString(fd, "AUTHENTICATE +");
+		co_return;
+	}
+
+	string payload = user->getSasl() + (arg == "+" ? "" : arg);
+	if (payload.size() > SASL_MAX) {
+		user->setSasl(false);
+		sendMessage(ERR_SASLTOOLONG, cmd, *user);
+		co_return;
+	}
+	if (arg.size() == SASL_CHUNK) {
+		user->setSasl(true, payload);
+		co_return;
+	}
+	user->setSasl(false);
+
+	// authzid \0 authcid \0 password; logging in as someone else is not supported
+	string	plain;
+	size_t	first, second;
+	if (!decodeBase64(payload, plain) || (first = plain.find('\0')) == string::npos
+		|| (second = plain.find('\0', first + 1)) == string::npos) {
+		sendMessage(ERR_SASLFAIL, cmd, *user);
+		co_return;
+	}
+	string	authzid = plain.substr(0, first);
+	string	authcid = plain.substr(first + 1, second - first - 1);
+	string	password = plain.substr(second + 1);
+	if (!authzid.empty() && authzid != authcid) {
+		sendMessage(ERR_SASLFAIL, cmd, *user);
+		co_return;
+	}
+
+	const Account	*account = accounts.find(authcid);
+	string			name = account ? account->name : "";
+	string			hash = account ? account->hash : accounts.decoy();
+	unsigned long	id = hold(fd);
+
+	// named: GCC 12 destroys temporaries of a co_await operand twice
+	auto check = Workers::run<bool>([password, hash] { return Accounts::verify(password, hash); });
+	bool valid = co_await check;
+	if (!resumed(fd, id))
+		co_return; // the client left while the hash was computed
+
+	user = &users[fd];
+	if (!valid || name.empty()) {
+		log(WARN, "SASL", "Failed login for " + authcid + " from fd " + to_string(fd));
+		sendMessage(ERR_SASLFAIL, cmd, *user);
+	} else {
+		user->setAccount(name);
+		cmd.arguments.assign(user->getHostmask()).append(" " + name + " :You are now logged in as " + name);
+		sendMessage(RPL_LOGGEDIN, cmd, *user);
+		sendMessage(RPL_SASLSUCCESS, cmd, *user);
+		log(INFO, "SASL", user->getNickname() + " logged in as " + name);
+		if (user->advance(REG_PASS))
+			completeRegistration(*user);
+	}
+	release(fd);
+}
@@ -1,34 +1,62 @@
 #include "../includes/Server.hpp"
+#include "../includes/Simd.hpp"
+#include <sys/resource.h>
+#include <fcntl.h>
 
 volatile sig_atomic_t Server::running = 1;
+volatile sig_atomic_t Server::upgrading = 0;
+volatile sig_atomic_t Server::reloading = 0;
+volatile sig_atomic_t Server::dumping = 0;
 
 static bool ignoreCommand(const cmd &cmd, const User &user)
 {
-	if (cmd.command != "QUIT" && cmd.command != "PASS" && user.getAuth() == false)
+	// a client that asked for SASL sends NICK and USER before it logs in
+	bool sasl = (IO::caps(user.getFd()) & CAP_SASL)
+		&& (cmd.command == "NICK" || cmd.command == "USER" || cmd.command == "AUTHENTICATE");
+
+	if (cmd.command != "QUIT" && cmd.command != "PASS" && cmd.command != "CAP" && !sasl && user.getAuth() == false)
 		return true; // if not authenticated
-	if (cmd.command == "MODE" && cmd.arguments.find("#") == string::npos)
-		return true; // if MODE for user
-	if (cmd.command == "CAP")
-		return true;
-	if (cmd.command == "WHO")
-		return true;
 	return false;
 }
 
-void Server::execute_command(cmd cmd, User &user)
+// the trailing parameter: after the first " :", or all of them if they start with ':'
+static string_view trailing(string_view arguments)
+{
+	if (!arguments.empty() && arguments[0] == ':')
+		return arguments;
+	size_t colon = arguments.find(" :");
+	return colon == string::npos ? string_view() : arguments.substr(colon + 2);
+}
+
+void Server::execute_command(const cmd &cmd, User &user)
 {
 	int code = 0;
 	const string nick = user.getNickname(); // for that DEBUG log. if QUIT, then its invalid read
+	const int fd = user.getFd();
+	Span span("command", fd);
 
 	if (ignoreCommand(cmd, user))
 	{
-		log(DEBUG, "EXEC", "Command " + cmd.command + " ignored");
+		if (logs(DEBUG))
+			log(DEBUG, "EXEC", "Command " + string(cmd.command) + " ignored");
 		return;
 	}
 
-	log(DEBUG, "EXEC", "Executing command: " + cmd.prefix + " | " + cmd.command + " | " + cmd.arguments);
-
-	if (cmd.command == "PING") {
+	if (logs(DEBUG))
+		log(DEBUG, "EXEC", "Executing command: " + string(cmd.prefix) + " | " + string(cmd.command) + " | " + string(cmd.arguments));
+	uint64_t began = Trace::now();
+	uint64_t queued = IO::queuedMessages();
+
+	string label = (IO::caps(fd) & CAP_LABELED_RESPONSE) ? tagValue(cmd.tags, "label") : "";
+	if (!label.empty())
+		IO::beginLabel(fd, label);
+
+	Span handler(cmd.command, fd);
+	// UTF8ONLY: text that is not UTF-8 is refused, not relayed; QUIT drops such a reason itself
+	bool utf8 = cmd.command == "QUIT" || Simd::validUtf8(trailing(cmd.arguments));
+	if (!utf8) {
+		IO::sendString(fd, ":" + _name + " FAIL " + string(cmd.command) + " INVALID_UTF8 :Message rejected, your IRC software MUST use UTF-8");
+	} else if (cmd.command == "PING") {
 		code = PING(cmd, user);
 	} else if (cmd.command == "PASS") {
 		code = PASS(cmd, user); 
@@ -40,12 +68,18 @@ void Server::execute_command(cmd cmd, User &user)
 		code = MODE(cmd, user); 
 	} else if (cmd.command == "QUIT") {
 		code = QUIT(cmd, user); 
+	} else if (cmd.command == "CAP") {
+		code = CAP(cmd, user);
+	} else if (cmd.command == "AUTHENTICATE") {
+		AUTHENTICATE(cmd, fd); // replies itself, possibly after a hash on the worker pool
 	} else if (!user.getIsRegistered()) {
 	 	code = ERR_NOTREGISTERED; 
 	} else if (cmd.command == "INVITE") {
 		code = INVITE(cmd, user); 
 	} else if (cmd.command == "PRIVMSG") {
 		code = PRIVMSG(cmd, user); 
+	} else if (cmd.command == "NOTICE") {
+		code = NOTICE(cmd, user);
 	} else if (cmd.command == "JOIN") {
 		code = JOIN(cmd, user); 
 	} else if (cmd.command == "TOPIC") {
@@ -56,16 +90,37 @@ void Server::execute_command(cmd cmd, User &user)
 		code = PART(cmd, user);
 	} else if (cmd.command == "WHOIS") {
 		code = WHOIS(cmd, user);
+	} else if (cmd.command == "WHO") {
+		code = WHO(cmd, user);
+	} else if (cmd.command == "LIST") {
+		code = LIST(cmd, user);
+	} else if (cmd.command == "OPER") {
+		code = OPER(cmd, user);
+	} else if (cmd.command == "STATS") {
+		code = STATS(cmd, user);
+	} else if (cmd.command == "MONITOR") {
+		code = MONITOR(cmd, user);
+	} else if (cmd.command == "ISON") {
+		code = ISON(cmd, user);
+	} else if (cmd.command == "USERHOST") {
+		code = USERHOST(cmd, user);
 	} else {
 		code = ERR_UNKNOWNCOMMAND;
 	}
+	handler.end();
 	if (code) {
 		sendMessage(code, cmd, user);
 	}
+	if (!label.empty())
+		IO::endLabel(fd, _name);
+	uint64_t took = Trace::now() - began;
+	if (config.slowCommand && took >= config.slowCommand * 1000000ULL)
+		noteSlow(cmd, nick, took, IO::queuedMessages() - queued);
 	log_level level = INFO;
 	if (code > 400)
 		level = ERROR;
-	log(level, "COMMAND", nick + " executed command " + cmd.command + " with code " + to_string(code));
+	if (logs(level))
+		log(level, "COMMAND", nick + " executed command " + string(cmd.command) + " with code " + to_string(code));
 }
 
 string Server::client_info(struct sockaddr_in &client_addr)
@@ -74,86 +129,293 @@ string Server::client_info(struct sockaddr_in &client_addr)
 	+ " Port: " + to_string(ntohs(client_addr.sin_port));
 }
 
-void Server::handleNewClient()
+void Server::handleNewClient(const Event &event)
 {
-	if (fds[0].revents & POLLIN) {
-		struct sockaddr_in client_addr;
-		socklen_t client_len = sizeof(client_addr);
-		int clientSocket = accept(fds[0].fd, (struct sockaddr *)&client_addr, &client_len);
-
-		if (clientSocket == -1) {
-			log(ERROR, "Connection", "Error accepting connection " + client_info(client_addr));
-			cerr << "Error accepting connection" << endl;
-			return;
-		}
-		pollfd new_pfd = {clientSocket, POLLIN, 0};
-		fds.push_back(new_pfd);
-		users[new_pfd.fd] = User(new_pfd.fd);
+	struct sockaddr_in client_addr = {};
+	socklen_t client_len = sizeof(client_addr);
+	int clientSocket = event.fd;
 
-		log(INFO, "Connection", "New client connected: " + client_info(client_addr));
+	if (clientSocket == -1 && (event.error == EMFILE || event.error == ENFILE)) {
+		shedClient(event.listener);
+		return;
+	}
+	if (clientSocket == -1) {
+		log(ERROR, "Connection", "Error accepting connection: " + string(strerror(event.error)));
+		cerr << "Error accepting connection" << endl;
+		return;
 	}
+	getpeername(clientSocket, (struct sockaddr *)&client_addr, &client_len);
+	if (users.size() >= clientLimit()) {
+		log(WARN, "Connection", "Refused client, server full: " + client_info(client_addr));
+		IO::sendString(clientSocket, "ERROR :Server full");
+		IO::forget(clientSocket);
+		loop->close(clientSocket);
+		return;
+	}
+	if (!config.tune(clientSocket))
+		log(DEBUG, "Connection", "Some socket options were refused for fd " + to_string(clientSocket));
+	bool tls = event.listener == _tlsListener;
+	loop->add(clientSocket, !tls);
+	if (tls) {
+		Tls::attach(clientSocket);
+		loop->setEvents(clientSocket, Tls::pollEvents(clientSocket));
+	}
+	users[clientSocket] = User(clientSocket); // indexed once NICK is accepted, not under its placeholder
+	Capture::opened(clientSocket);
+
+	log(INFO, "Connection", "New client connected: " + client_info(client_addr) + (tls ? " (TLS)" : ""));
 }
 
-void Server::handleClientMessages(size_t *index) {
+/*
+Out of descriptors, the waiting client cannot be accepted and the
+listener stays readable. The spare descriptor is closed to accept and
+turn it away, then taken again.
+*/
+void Server::shedClient(int listener)
+{
+	pollfd		waiting = {listener, POLLIN, 0};
+	const char	full[] = "ERROR :Server full\r\n";
 
-	if ((fds[*index].revents & POLLIN) == false)
+	log(WARN, "Connection", "Refused client, out of file descriptors");
+	if (_spareFd == -1 || poll(&waiting, 1, 0) != 1)
 		return;
+	close(_spareFd);
+	int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd != -1) {
+		send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(fd);
+	}
+	_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
 
-	int fd = fds[*index].fd;
-	vector<cmd> commands = IO::recvCommands(fd);
+// drives a pending TLS handshake, returns false once the connection is usable
+bool Server::handleHandshake(int fd) {
+	if (!Tls::has(fd) || Tls::mode(fd) != Tls::HANDSHAKE)
+		return false;
+
+	int ret = Tls::handshake(fd);
+	if (ret < 0) {
+		execute_command({"", "QUIT", "TLS handshake failed"}, users[fd]);
+		return true;
+	}
+	if (ret == 1) // replies queued during the handshake still need POLLOUT
+		loop->setEvents(fd, IO::wantsWrite(fd) ? (POLLIN | POLLOUT) : POLLIN);
+	else
+		loop->setEvents(fd, Tls::pollEvents(fd));
+	return true;
+}
+
+void Server::handleClientMessages(const Event &event) {
+	int fd = event.fd;
+
+	if (handleHandshake(fd))
+		return;
+	if (!IO::connection(fd).closing.empty())
+		return; // dropped, reaped at the end of this iteration
+	if (event.kind == Event::WRITABLE) {
+		IO::flush(fd);
+		return;
+	}
+
+	std::pmr::vector<cmd> commands = IO::recvCommands(fd);
 
 	if (commands[0].command == "PARTIAL")
 		return;
 
 	if (commands[0].command != "DISCONNECT" && commands[0].command != "ERROR") {
 		for (const auto &c : commands) {
-			execute_command(c, users[fd]);
+			if (!users.count(fd))
+				break; // quit by an earlier command
+			if (!IO::admit(fd)) {
+				IO::sendString(fd, "ERROR :Closing Link: " + users[fd].getNickname() + " (Excess Flood)");
+				execute_command({"", "QUIT", "Excess Flood"}, users[fd]);
+				break;
+			}
+			auto wait = held.find(fd);
+			if (wait == held.end()) {
+				execute_command(c, users[fd]);
+			} else if (wait->second.commands.size() < config.heldMax) {
+				wait->second.commands.push_back(c);
+			} else {
+				execute_command({"", "QUIT", "Excess Flood"}, users[fd]);
+				break;
+			}
 		}
 		return;
 	}
 
 	if (commands[0].command == "DISCONNECT") {
 		log(INFO, "Connection", "Client disconnected: " + users[fd].getNickname());
-	} else {// "ERROR"
-		close(fd);
-		throw runtime_error("recv() failed");
+	} else if (commands[0].arguments.empty()) {// "ERROR"
+		log(ERROR, "Connection", "recv() failed for " + users[fd].getNickname() + ": " + strerror(errno));
+	} else {
+		return; // dropped by IO (RecvQ), reaped at the end of this iteration
 	}
 
 	execute_command({"", "QUIT", "disconnected"}, users[fd]);
-	*index -= 1;
 }
 
-void Server::start() {
+/*
+Keeps the command in the slow log for STATS s. Arguments are cut to 64
+characters, control characters become '?', and the arguments of PASS,
+OPER and AUTHENTICATE are not kept at all.
+*/
+void Server::noteSlow(const cmd &cmd, const string &nick, uint64_t duration, uint64_t fanout) {
+	string arguments(string_view(cmd.arguments).substr(0, 64));
+
+	if (cmd.command == "PASS" || cmd.command == "OPER" || cmd.command == "AUTHENTICATE")
+		arguments = "*";
+	for (char &c : arguments)
+		if ((unsigned char)c < ' ' || c == 0x7f)
+			c = '?';
+	log(WARN, "Slow", string(cmd.command) + " from " + nick + " took " + to_string(duration / 1000000) + " ms");
+	slowLog.push_back({time(nullptr), string(string_view(cmd.command).substr(0, 32)), arguments, nick, duration, fanout});
+	if (slowLog.size() > SLOWLOG_MAX)
+		slowLog.pop_front();
+}
+
+// makes the client's later commands wait until release(), returns the suspension's id
+unsigned long Server::hold(int fd) {
+	Held &wait = held[fd];
+	wait.id = ++nextHold;
+	return wait.id;
+}
+
+// whether the suspension is still the client's: false once it left (and the fd was maybe reused)
+bool Server::resumed(int fd, unsigned long id) {
+	auto it = held.find(fd);
+	return it != held.end() && it->second.id == id;
+}
+
+// runs the commands held back, in order, until one suspends again
+void Server::release(int fd) {
+	auto it = held.find(fd);
+	if (it == held.end())
+		return;
+	deque<cmd> waiting = std::move(it->second.commands);
+	held.erase(it);
+	while (!waiting.empty() && users.count(fd)) {
+		if (held.count(fd)) {
+			deque<cmd> &queue = held[fd].commands;
+			queue.insert(queue.end(), waiting.begin(), waiting.end());
+			return;
+		}
+		cmd next = std::move(waiting.front());
+		waiting.pop_front();
+		execute_command(next, users[fd]);
+	}
+}
+
+// POLLOUT only for connections with a SendQ, TLS handshakes pick their own events
+void Server::updatePollEvents() {
+	for (int fd : IO::takeFlipped()) {
+		if (!users.count(fd) || (Tls::has(fd) && Tls::mode(fd) == Tls::HANDSHAKE))
+			continue;
+		loop->setEvents(fd, IO::wantsWrite(fd) ? (POLLIN | POLLOUT) : POLLIN);
+	}
+}
+
+/*
+Clients IO gave up on (SendQ or RecvQ over its limit, write errors) quit
+with the reason once the loop is done with them. Their queues are
+already gone, so the ERROR line is a best effort direct write.
+*/
+void Server::reapDropped() {
+	for (int fd : IO::takeDropped()) {
+		auto user = users.find(fd);
+		if (user == users.end())
+			continue;
+		string reason = IO::connection(fd).closing;
+		string line = "ERROR :Closing Link: " + user->second.getNickname() + " (" + reason + ")\r\n";
+		if (!Tls::has(fd))
+			loop->write(fd, line.c_str(), line.size());
+		execute_command({"", "QUIT", reason.c_str()}, user->second);
+	}
+}
 
+void Server::start() {
 	signal(SIGINT, signal_handler);
 	signal(SIGTERM, signal_handler);
+	signal(SIGUSR2, signal_handler);
+	signal(SIGHUP, signal_handler);
+	signal(SIGUSR1, signal_handler);
+	signal(SIGPIPE, SIG_IGN);
 
-	while (this->running)
-	{
-		if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
-			throw runtime_error("Poll error");
+	while (this->running && iterate())
+		;
+}
 
-		handleNewClient();
+// one round of the event loop, false once a hot upgrade handed the clients over
+bool Server::iterate() {
+	// while LIST or WHO replies are being paged out, the loop only checks for new input
+	updatePollEvents();
+	Watchdog::idle();
+	loop->wait(listsReady() ? 0 : -1, events);
+	uint64_t began = Trace::now();
+	Watchdog::busy(began);
+
+	for (const Event &event : events) {
+		if (event.kind == Event::ACCEPT)
+			handleNewClient(event);
+		else if (event.fd == Workers::fd())
+			Workers::complete();
+		else if (users.count(event.fd))
+			handleClientMessages(event); // not for clients that quit earlier in this round
+	}
 
-		for (size_t index = 1; index < this->fds.size(); index++)
-			handleClientMessages(&index);
+	for (auto it = pendingLists.begin(); it != pendingLists.end(); )
+		continueList((it++)->first);
+	for (auto it = pendingWhos.begin(); it != pendingWhos.end(); )
+		continueWho((it++)->first);
+
+	reapDropped();
+	Arena::reset(); // what this round parsed is done with
+
+	uint64_t took = Trace::now() - began;
+	loopStats.iterations++;
+	loopStats.longest = max(loopStats.longest, took);
+	if (config.slowLoop && took >= config.slowLoop * 1000000ULL) {
+		loopStats.slow++;
+		log(WARN, "Slow", "Loop iteration took " + to_string(took / 1000000) + " ms for "
+			+ to_string(events.size()) + " events");
 	}
+
+	if (reloading) {
+		reloading = 0;
+		reload();
+	}
+	if (dumping) {
+		dumping = 0;
+		if (config.trace.empty())
+			log(WARN, "Trace", "SIGUSR1 ignored, tracing is off (trace in the config)");
+		else
+			Trace::dump(config.trace);
+	}
+	if (upgrading && held.empty()) { // not while handlers wait for a worker
+		upgrading = 0;
+		Watchdog::idle(); // the handover may take a while
+		if (hotUpgrade())
+			return false;
+	}
+	return true;
 }
 
-int Server::createSocket() {
-	int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+int Server::createSocket(int port) {
+	int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	if (serverSocket == -1)  {
 		throw runtime_error("Error: socket failed: " + string(strerror(errno)));
 	}
 
 	int opt = 1;
 	if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+		close(serverSocket);
 		throw runtime_error("setsockopt failed: " + string(strerror(errno)));
 	}
+	config.tune(serverSocket); // accepted sockets inherit the buffer sizes
 	
 	sockaddr_in serverAddress{};
 	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(this->_port);
+	serverAddress.sin_port = htons(port);
 	serverAddress.sin_addr.s_addr = INADDR_ANY;
 
 	if (bind(serverSocket, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) == -1) {
@@ -161,41 +423,277 @@ int Server::createSocket() {
 		throw runtime_error("binding failed: " + string(strerror(errno)));
 	}
 
-	if (listen(serverSocket, _maxClients) == -1) {
+	if (listen(serverSocket, config.backlog) == -1) {
 		close (serverSocket);
 		throw runtime_error("listening failed: " + string(strerror(errno)));
 	}
 
-	log(INFO, "Server", "Server started on port " + to_string(_port));
+	log(INFO, "Server", "Server started on port " + to_string(port));
 	return serverSocket;
 }
 
-Server::Server(const string port, const string password): _port(stoi(port)), _password(password) {
-	fds.push_back({createSocket(), POLLIN, 0});
+/*
+The plaintext listener is on the given port. With tls_cert and tls_key
+set, a TLS listener is opened on 6697 as well; giving 6697 as the port
+makes the server TLS only. The ports in listen come from syncListeners.
+*/
+void Server::openListeners() {
+	if (!config.tlsCert.empty() && !config.tlsKey.empty())
+		Tls::init(config.tlsCert, config.tlsKey);
+	else if (_port == TLS_PORT)
+		throw runtime_error("port " + to_string(TLS_PORT) + " is TLS only, set tls_cert and tls_key");
+
+	if (_port != TLS_PORT)
+		_listenerFds.push_back(createSocket(_port));
+	if (Tls::enabled()) {
+		_tlsListener = createSocket(TLS_PORT);
+		_listenerFds.push_back(_tlsListener);
+		log(INFO, "Server", "TLS enabled on port " + to_string(TLS_PORT));
+	}
+	for (int fd : _listenerFds)
+		loop->addListener(fd);
+	syncListeners();
 }
 
-void Server::cleanup() {
-	for (pollfd pfd : fds) {
-		close(pfd.fd); // also close socket (fds[0]) here
+static int listenerPort(int fd) {
+	sockaddr_in	address{};
+	socklen_t	length = sizeof(address);
+
+	if (getsockname(fd, (sockaddr *)&address, &length) == -1)
+		return -1;
+	return ntohs(address.sin_port);
+}
+
+/*
+Opens the plaintext ports in listen that are not open yet and closes
+the ones no longer listed, except the port given on the command line.
+Every listener gets the current backlog and socket options.
+*/
+void Server::syncListeners() {
+	set<int> wanted(config.listen.begin(), config.listen.end());
+
+	if (_port != TLS_PORT)
+		wanted.insert(_port);
+	if (wanted.erase(TLS_PORT))
+		log(WARN, "Server", "listen: " + to_string(TLS_PORT) + " is the TLS port, skipped");
+	for (auto it = _listenerFds.begin(); it != _listenerFds.end(); ) {
+		int port = listenerPort(*it);
+		if (*it == _tlsListener || wanted.erase(port)) {
+			listen(*it, config.backlog);
+			config.tune(*it);
+			++it;
+			continue;
+		}
+		loop->remove(*it);
+		close(*it);
+		it = _listenerFds.erase(it);
+		log(INFO, "Server", "Stopped listening on port " + to_string(port));
+	}
+	for (int port : wanted) {
+		try {
+			int fd = createSocket(port);
+			_listenerFds.push_back(fd);
+			loop->addListener(fd);
+		} catch (const exception &e) {
+			log(ERROR, "Server", "Cannot listen on port " + to_string(port) + ": " + e.what());
+		}
+	}
+}
+
+// events in the config picks the backend: poll (default) or uring (io_uring, falls back to poll)
+void Server::openLoop() {
+	loop = EventLoop::create(config.events.c_str());
+	IO::setLoop(loop.get());
+	log(INFO, "Server", "Event loop: " + string(loop->name()));
+	log(INFO, "Server", "Byte kernels: " + string(Simd::name()));
+}
+
+/*
+Connections are only bounded by descriptors: the soft RLIMIT_NOFILE is
+raised to the hard limit, and max_clients (0 by default) is capped at
+what that leaves after FD_RESERVE.
+*/
+void Server::raiseFdLimit() {
+	rlimit	limit;
+	rlim_t	before;
+
+	getrlimit(RLIMIT_NOFILE, &limit);
+	before = limit.rlim_cur;
+	if (limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+			limit.rlim_cur = before;
+	}
+	_fdLimit = limit.rlim_cur;
+	if (_spareFd == -1)
+		_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	log(INFO, "Server", "File descriptors: " + to_string(_fdLimit)
+		+ (_fdLimit != before ? " (raised from " + to_string(before) + ")" : "")
+		+ ", room for " + to_string(clientLimit()) + " clients");
+}
+
+size_t Server::clientLimit() const {
+	size_t room = _fdLimit > FD_RESERVE ? _fdLimit - FD_RESERVE : 0;
+
+	return config.maxClients ? min(config.maxClients, room) : room;
+}
+
+// accounts in the config enables SASL: the accounts are read and the hash workers started
+void Server::loadAccounts() {
+	Accounts loaded;
+
+	if (!config.accounts.empty())
+		loaded.load(config.accounts);
+	accounts = std::move(loaded);
+	if (accounts.empty() || Workers::fd() != -1)
+		return;
+	Workers::start(clamp(thread::hardware_concurrency(), 1u, (unsigned)WORKERS_MAX));
+	loop->add(Workers::fd(), false);
+}
+
+// the settings that need no more than a variable set
+void Server::applyConfig() {
+	_name = config.name;
+	if (_fdLimit && config.maxClients > clientLimit())
+		log(WARN, "Config", "max_clients " + to_string(config.maxClients) + " is above what the fd limit allows");
+	IO::setLimits(config.io);
+	setLogLevel(config.logLevel);
+	Trace::enable(!config.trace.empty());
+	Watchdog::start(config.watchdog);
+	renderWelcome();
+}
+
+/*
+SIGHUP: the config file is read again and applied to everything that is
+running. events, capture and the TLS certificate stay as they were until
+the server is restarted or upgraded.
+*/
+void Server::reload() {
+	Config	next;
+	size_t	refused = 0;
+
+	if (config.path.empty()) {
+		log(WARN, "Config", "SIGHUP ignored, no config file (IRCSERV_CONFIG)");
+		return;
 	}
+	try {
+		next = Config::load(config.path.c_str());
+	} catch (const exception &e) {
+		log(ERROR, "Config", string(e.what()) + ", keeping the running settings");
+		return;
+	}
+	if (next.events != config.events || next.capture != config.capture
+		|| next.tlsCert != config.tlsCert || next.tlsKey != config.tlsKey)
+		log(WARN, "Config", "events, capture, tls_cert and tls_key change on the next restart or upgrade");
+	next.events = config.events;
+	next.capture = config.capture;
+	next.tlsCert = config.tlsCert;
+	next.tlsKey = config.tlsKey;
+	config = next;
+
+	applyConfig();
+	try {
+		loadAccounts();
+	} catch (const exception &e) {
+		log(ERROR, "Config", string(e.what()) + ", keeping the loaded accounts");
+	}
+	syncListeners();
+	for (const auto &[fd, user] : users)
+		refused += !config.tune(fd);
+	if (refused)
+		log(WARN, "Config", "Socket options refused on " + to_string(refused) + " connections");
+	log(INFO, "Config", "Reloaded " + config.path);
+}
+
+Server::Server(const string port, const string password, const Config &settings)
+	: config(settings), _port(stoi(port)), _password(password) {
+	raiseFdLimit();
+	Capture::start(settings.capture.c_str());
+	applyConfig();
+	openLoop();
+	loadAccounts();
+	openListeners();
+}
+
+/*
+A server on a transport the caller built, such as a SimNet: no
+listeners, no signal handlers and no descriptor limit to raise. The
+caller drives it with iterate().
+*/
+Server::Server(const string password, const Config &settings, unique_ptr<EventLoop> transport)
+	: config(settings), _port(0), _password(password) {
+	_fdLimit = SIZE_MAX;
+	applyConfig();
+	loop = std::move(transport);
+	IO::setLoop(loop.get());
+	loadAccounts();
+}
+
+/*
+The welcome burst (001-005) only differs per client in the nick and the
+nick!user@host mask, so everything around them is rendered once here.
+*/
+void Server::renderWelcome() {
+	time_t		now = time(nullptr);
+	char		created[64];
+
+	strftime(created, sizeof(created), "%a %b %d %Y at %H:%M:%S", localtime(&now));
+	_welcome = {
+		{":" + _name + " 001 ", " :Welcome to the Internet Relay Network "},
+		{":" + _name + " 002 ", " :Your host is " + _name + ", running version ircserv-1.0\r\n"},
+		{":" + _name + " 003 ", " :This server was created " + string(created) + "\r\n"},
+		{":" + _name + " 004 ", " " + _name + " ircserv-1.0 o beIiklot\r\n"},
+		{":" + _name + " 005 ", " CASEMAPPING=ascii CHANTYPES=#&+! CHANMODES=beI,k,l,it EXCEPTS INVEX"
+			" TARGMAX=PRIVMSG:" + to_string(config.targMax) + ",NOTICE:" + to_string(config.targMax)
+			+ " MODES=" + to_string(config.modesMax) + " MAXLIST=beI:" + to_string(MAXLIST) + " ELIST=CMNTU SAFELIST UTF8ONLY"
+			" MONITOR=" + to_string(MONITOR_MAX) + " :are supported by this server\r\n"},
+	};
+}
+
+void Server::completeRegistration(User &user) {
+	const string &nick = user.getNickname();
+	string burst;
+
+	burst.reserve(512);
+	burst.append(_welcome[0].first).append(nick).append(_welcome[0].second).append(user.getHostmask()).append("\r\n");
+	for (size_t i = 1; i < _welcome.size(); ++i)
+		burst += _welcome[i].first + nick + _welcome[i].second;
+	burst.resize(burst.size() - 2); // sendString appends the last CRLF
+	IO::sendString(user.getFd(), burst);
+	notifyWatchers(nick, &user);
+	log(INFO, "Registration", nick + " registered");
+}
+
+void Server::cleanup() {
+	if (_spareFd != -1)
+		close(_spareFd);
+	for (int fd : _listenerFds)
+		close(fd);
+	for (const auto &[fd, user] : users)
+		close(fd);
 }
 
 Server::~Server() {
+	Watchdog::stop();
+	Workers::stop();
 	cleanup();
+	Capture::stop();
 	log(INFO, "Server", "Shutting down server");
 }
 
 void Server::signal_handler(int signal) {
 	if (signal == SIGINT || signal == SIGTERM)
 		running = 0;
+	else if (signal == SIGUSR2)
+		upgrading = 1;
+	else if (signal == SIGHUP)
+		reloading = 1;
+	else if (signal == SIGUSR1)
+		dumping = 1;
 }
 
 const User* Server::getUser(const string &nickname) {
-	for (const auto &pair : users) {
-		if (compareIgnoreCase(pair.second.getNickname(),nickname))
-			return &pair.second;
-	}
-	return nullptr;
+	return findUserByNickName(nickname);
 }
 
 const User* Server::getUser(int fd) {
@@ -205,61 +703,108 @@ const User* Server::getUser(int fd) {
 }
 
 Channel* Server::findChannelByName(const string& channelName) {
-	auto it = this->channels.find(toLowerString(channelName));
-	if (it != this->channels.end()) {
-		return &it->second;
-	}
-	return nullptr;
+	ChannelTable::Entry *entry = channels.find(channelName);
+	return entry ? &entry->channel : nullptr;
 }
 
 User* Server::findUserByNickName(const string& nickName) {
-	for (auto &it : this->users) {
-		if (compareIgnoreCase(it.second.getNickname(), nickName))
-			return (&it.second);
-	}
-	return nullptr;
+	auto it = nickIndex.find(toLowerString(nickName));
+	if (it == nickIndex.end())
+		return nullptr;
+	return &users.at(it->second);
 }
 
-bool	Server::_nickIsUsed(string nick) {
-	for (auto &[fd, user] : this->users) {
-		if (compareIgnoreCase(user.getNickname(), nick)) {
-			return (true);
-		}
+bool	Server::_nickIsUsed(const string &nick, int self) {
+	auto it = nickIndex.find(toLowerString(nick));
+	return it != nickIndex.end() && it->second != self;
+}
+
+// returns username, or username with the next free numeric suffix if it is taken
+string	Server::_uniqueUsername(const string &username) {
+	string key = toLowerString(username);
+
+	if (!userIndex.count(key))
+		return username;
+	log(DEBUG, "USER", "Username " + username + " is taken. Creating unique username...");
+	unsigned &next = userSuffix[key];
+	for (;;) {
+		string suffix = to_string(++next);
+		string candidate = username.substr(0, 10 - min<size_t>(suffix.size(), 10)) + suffix;
+		if (!userIndex.count(toLowerString(candidate)))
+			return candidate;
 	}
-	return (false);
 }
 
-bool	Server::_userIsUsed(string username) {
-	for (auto &it : this->users) {
-		if (compareIgnoreCase(it.second.getUsername(), username)) {
-			return (true);
-		}
+// never takes a nick from the client holding it; NICK checks _nickIsUsed first
+void	Server::indexNick(int fd, const string &nick) {
+	auto [it, added] = nickIndex.try_emplace(toLowerString(nick), fd);
+	if (!added && it->second != fd) {
+		log(WARN, "Nick", "Not indexing " + nick + " for fd " + to_string(fd) + ", fd " + to_string(it->second) + " holds it");
+		return;
 	}
-	return (false);
+	nickPrefixes.insert(nick, fd);
+}
+
+// username and host, once USER is accepted
+void	Server::indexUser(const User &user) {
+	userIndex[toLowerString(user.getUsername())] = user.getFd();
+	userPrefixes.insert(user.getUsername(), user.getFd());
+	hostPrefixes.insert(user.getHostname(), user.getFd());
+}
+
+void	Server::unindexUser(const User &user) {
+	auto nick = nickIndex.find(toLowerString(user.getNickname()));
+	if (nick != nickIndex.end() && nick->second == user.getFd())
+		nickIndex.erase(nick);
+	nickPrefixes.erase(user.getNickname(), user.getFd());
+	if (!user.getUserIsSet())
+		return;
+	auto name = userIndex.find(toLowerString(user.getUsername()));
+	if (name != userIndex.end() && name->second == user.getFd())
+		userIndex.erase(name);
+	userPrefixes.erase(user.getUsername(), user.getFd());
+	hostPrefixes.erase(user.getHostname(), user.getFd());
 }
 
 //user create and join a new channel
 int Server::createChannel(Channel*& channel, User &user, const std::string &channelName, const std::string &key) {
-	auto [it, inserted] = this->channels.emplace(toLowerString(channelName), Channel(channelName, key));
-	channel = &it->second;
+	channel = &channels.insert(channelName, Channel(channelName, key)).channel;
 
 	int code = user.join(*channel, key);
 	if (!code) {
 		channel->addOperator(user);
 	}
+	channelChanged(channelName);
 	return code;
 }
 
+// keeps the directory in step with a channel's membership, dropping it once empty
+void Server::channelChanged(const string &name) {
+	ChannelTable::Entry *entry = channels.find(name);
+	if (!entry)
+		return;
+	if (!entry->channel.getUserList().empty()) {
+		directory.update(entry->key, entry->channel);
+		return;
+	}
+	log(DEBUG, "Channel", "Channel erased: " + entry->channel.getChannelName());
+	directory.remove(entry->key);
+	channels.erase(name);
+}
+
 void Server::removeUser(int UserFd) {
-	shutdown(UserFd, SHUT_RDWR);
-	close(UserFd);
+	unwatchAll(UserFd);
+	if (this->users[UserFd].getIsRegistered())
+		notifyWatchers(this->users[UserFd].getNickname(), nullptr);
+	loop->remove(UserFd);
+	loop->close(UserFd);
+	unindexUser(this->users[UserFd]);
+	Tls::release(UserFd);
+	IO::forget(UserFd);
+	Capture::closed(UserFd);
+	pendingLists.erase(UserFd);
+	pendingWhos.erase(UserFd);
+	held.erase(UserFd);
 	this->users.erase(UserFd);
-	this->fds.erase(
-		std::remove_if(this->fds.begin(), this->fds.end(),
-			[UserFd](const struct pollfd &pfd) {
-				return pfd.fd == UserFd;
-			}),
-			this->fds.end()
-	);
 	log(INFO, "Connection", "Client disconnected: fd " + std::to_string(UserFd));
 }
@@ -0,0 +1,142 @@
+#include "../includes/SimNet.hpp"
+#include <algorithm>
+#include <cerrno>
+
+int SimNet::connect()
+{
+	int fd = nextFd++;
+	peers[fd];
+	connecting.push_back(fd);
+	return fd;
+}
+
+void SimNet::wake(int fd)
+{
+	Peer &peer = peers[fd];
+	if (!peer.accepted || peer.closed || peer.listed)
+		return;
+	peer.listed = true;
+	ready.push_back(fd);
+}
+
+void SimNet::send(int fd, std::string_view bytes)
+{
+	peers[fd].toServer.append(bytes);
+	wake(fd);
+}
+
+void SimNet::hangUp(int fd)
+{
+	peers[fd].hungUp = true;
+	wake(fd);
+}
+
+std::string SimNet::take(int fd)
+{
+	auto it = peers.find(fd);
+	if (it == peers.end())
+		return "";
+	std::string inbox;
+	inbox.swap(it->second.inbox);
+	if (it->second.closed)
+		peers.erase(it);
+	return inbox;
+}
+
+size_t SimNet::lines(int fd) const
+{
+	auto it = peers.find(fd);
+	return it == peers.end() ? 0 : it->second.lines;
+}
+
+bool SimNet::closed(int fd) const
+{
+	auto it = peers.find(fd);
+	return it == peers.end() || it->second.closed;
+}
+
+// bytes sent before the accept are reported once the server has the client
+void SimNet::add(int fd, bool)
+{
+	Peer &peer = peers[fd];
+	peer.accepted = true;
+	if (!peer.toServer.empty() || peer.hungUp)
+		wake(fd);
+}
+
+void SimNet::remove(int fd)
+{
+	auto it = peers.find(fd);
+	if (it != peers.end())
+		it->second.listed = false; // wait() skips it
+}
+
+void SimNet::setEvents(int fd, short events)
+{
+	auto it = peers.find(fd);
+	if (it != peers.end())
+		it->second.events = events;
+}
+
+// never blocks: what is pending now, or nothing
+void SimNet::wait(int, std::vector<Event> &events)
+{
+	events.clear();
+	for (int fd : connecting)
+		events.push_back({Event::ACCEPT, fd, SIM_LISTENER, 0});
+	connecting.clear();
+	std::sort(ready.begin(), ready.end());
+	for (int fd : ready) {
+		auto it = peers.find(fd);
+		if (it == peers.end() || !it->second.listed)
+			continue;
+		it->second.listed = false;
+		events.push_back({Event::READABLE, fd, -1, 0});
+	}
+	ready.clear();
+}
+
+ssize_t SimNet::read(int fd, std::string &out)
+{
+	auto it = peers.find(fd);
+	if (it == peers.end() || (it->second.toServer.empty() && it->second.hungUp))
+		return 0;
+	Peer &peer = it->second;
+	if (peer.toServer.empty()) {
+		errno = EAGAIN;
+		return -1;
+	}
+	size_t n = peer.toServer.size();
+	if (out.empty())
+		out.swap(peer.toServer);
+	else
+		out += peer.toServer;
+	peer.toServer.clear();
+	if (peer.hungUp)
+		wake(fd); // the EOF comes after the data, on the next wait()
+	return n;
+}
+
+ssize_t SimNet::write(int fd, const char *data, size_t len)
+{
+	auto it = peers.find(fd);
+	if (it == peers.end() || it->second.hungUp) {
+		errno = EPIPE;
+		return -1;
+	}
+	if (keep)
+		it->second.inbox.append(data, len);
+	it->second.lines += std::count(data, data + len, '\n');
+	written += len;
+	return len;
+}
+
+void SimNet::close(int fd)
+{
+	auto it = peers.find(fd);
+	if (it == peers.end())
+		return;
+	it->second.closed = true;
+	it->second.toServer.clear();
+	remove(fd);
+}
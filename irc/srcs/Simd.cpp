@@ -0,0 +1,284 @@
+#include "../includes/Simd.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define SIMD_X86
+#endif
+
+// length of the valid UTF-8 sequence at p (1 for ASCII), 0 if there is none
+static size_t utf8Sequence(const unsigned char *p, size_t len)
+{
+	unsigned char c = p[0];
+
+	if (c < 0x80)
+		return 1;
+	if (c < 0xC2) // a continuation byte, or an overlong 2-byte form
+		return 0;
+	if (c < 0xE0)
+		return len >= 2 && (p[1] & 0xC0) == 0x80 ? 2 : 0;
+	if (c < 0xF0) {
+		if (len < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80)
+			return 0;
+		if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F)) // overlong, surrogate
+			return 0;
+		return 3;
+	}
+	if (c < 0xF5) {
+		if (len < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+			return 0;
+		if ((c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] > 0x8F)) // overlong, above U+10FFFF
+			return 0;
+		return 4;
+	}
+	return 0;
+}
+
+// scalar
+
+static size_t findEolScalar(const char *data, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+		if (data[i] == '\r' || data[i] == '\n')
+			return i;
+	return len;
+}
+
+static char foldByte(char c)
+{
+	return (unsigned char)(c - 'A') < 26 ? c + ('a' - 'A') : c;
+}
+
+static void foldScalar(char *data, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+		data[i] = foldByte(data[i]);
+}
+
+static bool equalFoldedScalar(const char *a, const char *b, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+		if (foldByte(a[i]) != foldByte(b[i]))
+			return false;
+	return true;
+}
+
+static bool validUtf8Scalar(const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	for (size_t i = 0; i < len; ) {
+		size_t n = utf8Sequence(p + i, len - i);
+		if (!n)
+			return false;
+		i += n;
+	}
+	return true;
+}
+
+#ifdef SIMD_X86
+
+// SSE2: 16 bytes at a time
+
+__attribute__((target("sse2")))
+static size_t findEolSse2(const char *data, size_t len)
+{
+	const __m128i	cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+	size_t			i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		int hits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (hits)
+			return i + __builtin_ctz(hits);
+	}
+	return i + findEolScalar(data + i, len - i);
+}
+
+// bytes above 0x7f are negative for the signed compares, so they stay as they are
+__attribute__((target("sse2")))
+static inline __m128i foldSse2(__m128i v)
+{
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static void foldSse2(char *data, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+		_mm_storeu_si128((__m128i *)(data + i), foldSse2(_mm_loadu_si128((const __m128i *)(data + i))));
+	foldScalar(data + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static bool equalFoldedSse2(const char *a, const char *b, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = foldSse2(_mm_loadu_si128((const __m128i *)(a + i)));
+		__m128i y = foldSse2(_mm_loadu_si128((const __m128i *)(b + i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF)
+			return false;
+	}
+	return equalFoldedScalar(a + i, b + i, len - i);
+}
+
+// ASCII runs are skipped 16 bytes at a time, multi-byte sequences are checked one by one
+__attribute__((target("sse2")))
+static bool validUtf8Sse2(const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	for (size_t i = 0; i < len; ) {
+		if (i + 16 <= len) {
+			int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+			if (!high) {
+				i += 16;
+				continue;
+			}
+			i += __builtin_ctz(high);
+		}
+		size_t n = utf8Sequence(p + i, len - i);
+		if (!n)
+			return false;
+		i += n;
+	}
+	return true;
+}
+
+/*
+AVX2: the same, 32 bytes at a time. The 16-byte steps for what is left
+are compiled in here as well, VEX encoded: calling the SSE2 functions
+after 256-bit work costs an AVX/SSE transition on some CPUs.
+*/
+
+__attribute__((target("avx2")))
+static size_t findEolAvx2(const char *data, size_t len)
+{
+	const __m256i	cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+	size_t			i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+		unsigned hits = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+		if (hits)
+			return i + __builtin_ctz(hits);
+	}
+	if (i + 16 <= len) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		int hits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+		if (hits)
+			return i + __builtin_ctz(hits);
+		i += 16;
+	}
+	return i + findEolScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i foldAvx2(__m256i v)
+{
+	__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+	return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static void foldAvx2(char *data, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+		_mm256_storeu_si256((__m256i *)(data + i), foldAvx2(_mm256_loadu_si256((const __m256i *)(data + i))));
+	if (i + 16 <= len) {
+		_mm_storeu_si128((__m128i *)(data + i), foldSse2(_mm_loadu_si128((const __m128i *)(data + i))));
+		i += 16;
+	}
+	foldScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static bool equalFoldedAvx2(const char *a, const char *b, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i x = foldAvx2(_mm256_loadu_si256((const __m256i *)(a + i)));
+		__m256i y = foldAvx2(_mm256_loadu_si256((const __m256i *)(b + i)));
+		if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xFFFFFFFFu)
+			return false;
+	}
+	if (i + 16 <= len) {
+		__m128i x = foldSse2(_mm_loadu_si128((const __m128i *)(a + i)));
+		__m128i y = foldSse2(_mm_loadu_si128((const __m128i *)(b + i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF)
+			return false;
+		i += 16;
+	}
+	return equalFoldedScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static bool validUtf8Avx2(const char *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	for (size_t i = 0; i < len; ) {
+		if (i + 32 <= len) {
+			unsigned high = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(p + i)));
+			if (!high) {
+				i += 32;
+				continue;
+			}
+			i += __builtin_ctz(high);
+		}
+		size_t n = utf8Sequence(p + i, len - i);
+		if (!n)
+			return false;
+		i += n;
+	}
+	return true;
+}
+
+#endif
+
+static const SimdKernels scalarKernels = {"scalar", findEolScalar, foldScalar, equalFoldedScalar, validUtf8Scalar};
+#ifdef SIMD_X86
+static const SimdKernels sse2Kernels = {"sse2", findEolSse2, foldSse2, equalFoldedSse2, validUtf8Sse2};
+static const SimdKernels avx2Kernels = {"avx2", findEolAvx2, foldAvx2, equalFoldedAvx2, validUtf8Avx2};
+#endif
+
+// usable before the pick below, by anything that runs earlier at startup
+const SimdKernels *Simd::active = &scalarKernels;
+
+const std::vector<const SimdKernels *> &Simd::supported()
+{
+	static const std::vector<const SimdKernels *> kernels = [] {
+		std::vector<const SimdKernels *> found = {&scalarKernels};
+#ifdef SIMD_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			found.push_back(&sse2Kernels);
+		if (__builtin_cpu_supports("avx2"))
+			found.push_back(&avx2Kernels);
+#endif
+		return found;
+	}();
+	return kernels;
+}
+
+void Simd::pick(const char *cap)
+{
+	for (const SimdKernels *kernels : supported()) {
+		active = kernels;
+		if (cap && !strcmp(cap, kernels->name))
+			break;
+	}
+}
+
+static const bool picked = (Simd::pick(getenv("IRCSERV_SIMD")), true);
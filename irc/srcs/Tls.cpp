@@ -0,0 +1,225 @@
+#include "../includes/Tls.hpp"
+#include "../includes/Utils.hpp"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/tls.h>
+#include <cerrno>
+
+#define TLS_TICKETS			2
+#define RECORD_ALERT		21
+#define RECORD_HANDSHAKE	22
+#define RECORD_DATA			23
+#define HANDSHAKE_KEYUPDATE	24
+
+SSL_CTX							*Tls::ctx = nullptr;
+std::map<int, Tls::Session>		Tls::sessions;
+
+static std::string sslError()
+{
+	char buf[256];
+	unsigned long e = ERR_get_error();
+
+	if (e == 0)
+		return strerror(errno);
+	ERR_error_string_n(e, buf, sizeof(buf));
+	ERR_clear_error();
+	return buf;
+}
+
+void Tls::init(const std::string &cert, const std::string &key)
+{
+	SSL_CTX *c = SSL_CTX_new(TLS_server_method());
+	if (!c)
+		throw std::runtime_error("TLS: " + sslError());
+
+	SSL_CTX_set_min_proto_version(c, TLS1_2_VERSION);
+	SSL_CTX_set_options(c, SSL_OP_ENABLE_KTLS);
+	// resumption: stateless tickets (TLS 1.3 and 1.2) plus the server side cache
+	SSL_CTX_set_session_cache_mode(c, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(c, reinterpret_cast<const unsigned char *>("ircserv"), 7);
+	SSL_CTX_set_num_tickets(c, TLS_TICKETS);
+	SSL_CTX_set_mode(c, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+	if (SSL_CTX_use_certificate_chain_file(c, cert.c_str()) != 1
+		|| SSL_CTX_use_PrivateKey_file(c, key.c_str(), SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key(c) != 1) {
+		std::string reason = sslError();
+		SSL_CTX_free(c);
+		throw std::runtime_error("TLS: cannot load " + cert + " / " + key + ": " + reason);
+	}
+	ctx = c;
+}
+
+void Tls::attach(const int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	SSL *ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, fd);
+	SSL_set_accept_state(ssl);
+	sessions[fd] = {ssl, HANDSHAKE, false};
+}
+
+// kernel offloaded session inherited over a hot upgrade
+void Tls::adopt(const int fd)
+{
+	sessions[fd] = {nullptr, KERNEL, false};
+}
+
+// 1: established, 0: waiting for the socket (see pollEvents), -1: failed
+int Tls::handshake(const int fd)
+{
+	Session &s = sessions.at(fd);
+	int ret = SSL_do_handshake(s.ssl);
+
+	if (ret != 1) {
+		int err = SSL_get_error(s.ssl, ret);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+			s.wantWrite = (err == SSL_ERROR_WANT_WRITE);
+			return 0;
+		}
+		log(WARN, "TLS", "Handshake failed on fd " + std::to_string(fd) + ": " + sslError());
+		return -1;
+	}
+
+	bool tx = BIO_get_ktls_send(SSL_get_wbio(s.ssl));
+	bool rx = BIO_get_ktls_recv(SSL_get_rbio(s.ssl));
+	std::string info = std::string(SSL_get_version(s.ssl)) + " " + SSL_get_cipher_name(s.ssl)
+		+ (SSL_session_reused(s.ssl) ? " (resumed)" : "");
+	if (tx && rx) {
+		// the kernel owns the record layer now, the socket is a plain socket again
+		SSL_free(s.ssl);
+		s.ssl = nullptr;
+		s.mode = KERNEL;
+		info += ", kTLS";
+	} else {
+		s.mode = USERSPACE;
+		info += std::string(", userspace records") + (tx ? " (kTLS tx only)" : "");
+	}
+	log(INFO, "TLS", "fd " + std::to_string(fd) + " established: " + info);
+	return 1;
+}
+
+short Tls::pollEvents(const int fd)
+{
+	const Session &s = sessions.at(fd);
+	return (s.mode == HANDSHAKE && s.wantWrite) ? POLLOUT : POLLIN;
+}
+
+/*
+A kTLS socket hands out one record type per recvmsg() and says which in
+a control message; without room for it, any record that is not data
+fails with EIO. An alert (close_notify or fatal) ends the connection like
+EOF. A handshake record after the handshake is a KeyUpdate or similar
+that only the freed SSL object could have answered, so the connection
+is dropped.
+*/
+static ssize_t kernelRead(const int fd, std::string &out)
+{
+	char			buf[4096];
+	char			control[CMSG_SPACE(sizeof(unsigned char))];
+	struct iovec	iov = {buf, sizeof(buf)};
+	struct msghdr	msg = {};
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t n = recvmsg(fd, &msg, 0);
+	if (n <= 0)
+		return n;
+
+	unsigned char type = RECORD_DATA;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+		type = *CMSG_DATA(cmsg);
+	if (type == RECORD_DATA) {
+		out.append(buf, n);
+		return n;
+	}
+	if (type == RECORD_ALERT) {
+		if (n >= 2 && buf[1] != 0) // anything but close_notify
+			log(WARN, "TLS", "fd " + std::to_string(fd) + " sent alert " + std::to_string(static_cast<unsigned char>(buf[1])));
+		return 0;
+	}
+	if (type == RECORD_HANDSHAKE && buf[0] == HANDSHAKE_KEYUPDATE)
+		log(WARN, "TLS", "fd " + std::to_string(fd) + " sent a KeyUpdate, which kTLS sessions cannot follow; closing");
+	else
+		log(WARN, "TLS", "fd " + std::to_string(fd) + " sent an unexpected record of type " + std::to_string(type) + "; closing");
+	errno = EIO;
+	return -1;
+}
+
+// like recv(): bytes appended to out, 0 on EOF, -1 with errno set (EAGAIN: nothing yet)
+ssize_t Tls::read(const int fd, std::string &out)
+{
+	Session	&s = sessions.at(fd);
+	char	buf[4096];
+	ssize_t	total = 0;
+
+	if (s.mode == KERNEL)
+		return kernelRead(fd, out);
+	if (s.mode == HANDSHAKE) {
+		errno = EAGAIN;
+		return -1;
+	}
+	for (;;) {
+		int n = SSL_read(s.ssl, buf, sizeof(buf));
+		if (n > 0) {
+			out.append(buf, n);
+			total += n;
+			continue;
+		}
+		int err = SSL_get_error(s.ssl, n);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+			break;
+		if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && errno == 0))
+			return total;
+		ERR_clear_error();
+		errno = EIO;
+		return total ? total : -1;
+	}
+	if (total == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return total;
+}
+
+/*
+Like a non-blocking send(): the bytes taken, 0 while the handshake is
+still running, -1 with errno set (EAGAIN: socket full, retry with the
+same data once it is writable).
+*/
+ssize_t Tls::write(const int fd, const char *data, size_t len)
+{
+	Session	&s = sessions.at(fd);
+
+	if (s.mode == HANDSHAKE)
+		return 0;
+	if (s.mode == KERNEL)
+		return send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	int n = SSL_write(s.ssl, data, len);
+	if (n > 0)
+		return n;
+	int err = SSL_get_error(s.ssl, n);
+	if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+		errno = EAGAIN;
+		return -1;
+	}
+	ERR_clear_error();
+	errno = EIO;
+	return -1;
+}
+
+void Tls::release(const int fd)
+{
+	auto it = sessions.find(fd);
+	if (it == sessions.end())
+		return;
+	if (it->second.ssl)
+		SSL_free(it->second.ssl);
+	sessions.erase(it);
+}
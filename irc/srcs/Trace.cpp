@@ -0,0 +1,104 @@
+#include "../includes/Trace.hpp"
+#include "../includes/Utils.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+std::atomic<bool>	Trace::enabled = false;
+
+#if __has_include(<sys/sdt.h>)
+unsigned short	ircserv_span_semaphore __attribute__((section(".probes"))) = 0;
+#endif
+
+/*
+A thread's spans. Only its own thread writes to it; the lock is for the
+dump, which copies the rings of all threads from the loop thread.
+*/
+struct Ring
+{
+	std::mutex				lock;
+	std::vector<SpanRecord>	spans;
+	uint64_t				written = 0;
+	pid_t					tid = gettid();
+};
+
+static std::mutex							registryLock;
+static std::vector<std::shared_ptr<Ring>>	rings;	// kept after their thread exits
+static thread_local std::shared_ptr<Ring>	mine;
+
+void Trace::enable(bool on)
+{
+	if (on != Trace::on())
+		log(INFO, "Trace", on ? "Tracing on, SIGUSR1 writes the spans" : "Tracing off");
+	enabled.store(on, std::memory_order_relaxed);
+}
+
+void Trace::record(const char *name, size_t length, uint64_t start, int fd, uint32_t count)
+{
+	if (!mine) {
+		mine = std::make_shared<Ring>();
+		mine->spans.resize(TRACE_RING);
+		std::lock_guard<std::mutex> guard(registryLock);
+		rings.push_back(mine);
+	}
+	std::lock_guard<std::mutex>	guard(mine->lock);
+	SpanRecord					&span = mine->spans[mine->written++ % TRACE_RING];
+
+	length = std::min(length, size_t(TRACE_NAME - 1));
+	memcpy(span.name, name, length);
+	span.name[length] = '\0';
+	span.start = start;
+	span.duration = now() - start;
+	span.fd = fd;
+	span.count = count;
+}
+
+// names can come from clients (unknown commands): anything odd becomes '?'
+static void putName(FILE *out, const char *name)
+{
+	for (; *name; ++name)
+		fputc((*name >= ' ' && *name <= '~' && *name != '"' && *name != '\\') ? *name : '?', out);
+}
+
+// Chrome trace JSON: complete ("X") events in µs, one track per thread
+bool Trace::dump(const std::string &path)
+{
+	FILE	*out = fopen(path.c_str(), "we");
+	pid_t	pid = getpid();
+	size_t	total = 0;
+	bool	first = true;
+
+	if (!out) {
+		log(ERROR, "Trace", "Cannot write " + path + ": " + strerror(errno));
+		return false;
+	}
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+	std::lock_guard<std::mutex> registry(registryLock);
+	for (const std::shared_ptr<Ring> &ring : rings) {
+		std::vector<SpanRecord>	spans;
+		uint64_t				written;
+		{
+			std::lock_guard<std::mutex> guard(ring->lock);
+			spans = ring->spans;
+			written = ring->written;
+		}
+		fprintf(out, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",", pid, ring->tid, ring->tid == pid ? "loop" : "worker");
+		first = false;
+		uint64_t from = written > TRACE_RING ? written - TRACE_RING : 0;
+		for (uint64_t i = from; i < written; ++i) {
+			const SpanRecord &span = spans[i % TRACE_RING];
+			fputs(",\n{\"ph\":\"X\",\"cat\":\"ircserv\",\"name\":\"", out);
+			putName(out, span.name);
+			fprintf(out, "\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"fd\":%d,\"count\":%u}}",
+				pid, ring->tid, span.start / 1e3, span.duration / 1e3, span.fd, span.count);
+		}
+		total += written - from;
+	}
+	fputs("\n]}\n", out);
+	bool ok = fclose(out) == 0;
+	log(ok ? INFO : ERROR, "Trace", "Wrote " + std::to_string(total) + " spans to " + path);
+	return ok;
+}
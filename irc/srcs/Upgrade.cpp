@@ -0,0 +1,475 @@
+#include "../includes/Server.hpp"
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <climits>
+#include <cerrno>
+
+/*
+Hot upgrade (SIGUSR2):
+The running server forks and execs its own binary again with
+IRCSERV_UPGRADE_FD pointing to one end of an AF_UNIX socketpair.
+Over that socket the old process passes every open socket (listening
+sockets first, then the clients) with SCM_RIGHTS, followed by a blob
+holding users, channels and the partial input of every connection.
+TLS clients survive only when their session is offloaded to the kernel
+(kTLS); the others are asked to reconnect.
+The new process rebuilds its state, answers with a single byte and
+the old process exits. If anything fails, the old process keeps serving.
+
+Wire format (all integers in host byte order, same binary family):
+	u32 fdCount
+	fd batches: u32 n + n fds as SCM_RIGHTS, until fdCount is reached
+	int[fdCount] fd numbers in the old process, to remap the state
+	u64 blobSize + blob
+
+Clients that cannot be handed over (userspace TLS) are left out of the
+fds and the state. The blob ends with the PART lines their channels
+should see; the new process sends them once it has answered, and only
+then does the old one tell those clients to reconnect.
+*/
+
+#define UPGRADE_ENV		"IRCSERV_UPGRADE_FD"
+#define UPGRADE_BATCH	200 // SCM_MAX_FD is 253
+#define UPGRADE_MAGIC	0x49524341 // "IRCA", bumped whenever the layout changes
+#define UPGRADE_TIMEOUT	10 // seconds the new process gets to read the state and answer
+
+static void putU32(string &out, uint32_t v) {
+	out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void putStr(string &out, const string &s) {
+	putU32(out, s.size());
+	out += s;
+}
+
+struct Reader {
+	const string	&in;
+	size_t			pos;
+
+	uint32_t u32() {
+		uint32_t v;
+		if (pos + sizeof(v) > in.size())
+			throw runtime_error("upgrade: truncated state");
+		memcpy(&v, in.data() + pos, sizeof(v));
+		pos += sizeof(v);
+		return v;
+	}
+	string str() {
+		uint32_t len = u32();
+		if (pos + len > in.size())
+			throw runtime_error("upgrade: truncated state");
+		string s = in.substr(pos, len);
+		pos += len;
+		return s;
+	}
+};
+
+static bool writeAll(int sock, const void *data, size_t len) {
+	const char *p = static_cast<const char *>(data);
+	while (len > 0) {
+		ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool readAll(int sock, void *data, size_t len) {
+	char *p = static_cast<char *>(data);
+	while (len > 0) {
+		ssize_t n = recv(sock, p, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool sendFds(int sock, const vector<int> &list) {
+	for (size_t off = 0; off < list.size(); off += UPGRADE_BATCH) {
+		uint32_t	n = min<size_t>(UPGRADE_BATCH, list.size() - off);
+		char		control[CMSG_SPACE(sizeof(int) * UPGRADE_BATCH)] = {};
+		iovec		iov = {&n, sizeof(n)};
+		msghdr		msg = {};
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+		cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int) * n);
+		memcpy(CMSG_DATA(c), list.data() + off, sizeof(int) * n);
+		if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(n))
+			return false;
+	}
+	return true;
+}
+
+static vector<int> recvFds(int sock, uint32_t count) {
+	vector<int> list;
+
+	while (list.size() < count) {
+		uint32_t	n = 0;
+		char		control[CMSG_SPACE(sizeof(int) * UPGRADE_BATCH)] = {};
+		iovec		iov = {&n, sizeof(n)};
+		msghdr		msg = {};
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(n))
+			throw runtime_error("upgrade: lost the fd stream");
+		cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		if (!c || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(int) * n))
+			throw runtime_error("upgrade: bad fd batch");
+		size_t at = list.size();
+		list.resize(at + n);
+		memcpy(list.data() + at, CMSG_DATA(c), sizeof(int) * n);
+	}
+	return list;
+}
+
+// the members of a set of fds that are not leaving, as a count and the fds
+static void putFds(string &out, const set<int> &leaving, const vector<int> &fds) {
+	size_t at = out.size();
+	uint32_t n = 0;
+
+	putU32(out, 0);
+	for (int fd : fds)
+		if (!leaving.count(fd)) {
+			putU32(out, fd);
+			n++;
+		}
+	memcpy(&out[at], &n, sizeof(n));
+}
+
+// leaving: clients that stay behind, left out everywhere and parted from their channels
+string Server::serializeState(const set<int> &leaving) {
+	string out;
+
+	putU32(out, UPGRADE_MAGIC);
+	putU32(out, _listenerFds.size());
+	for (int fd : _listenerFds) {
+		putU32(out, fd);
+		putU32(out, fd == _tlsListener);
+	}
+	putU32(out, users.size() - leaving.size());
+	for (const auto &[fd, user] : users) {
+		if (leaving.count(fd))
+			continue;
+		putU32(out, fd);
+		putStr(out, user.getNickname());
+		putStr(out, user.getUsername());
+		putStr(out, user.getHostname());
+		putStr(out, user.getServername());
+		putStr(out, user.getRealname());
+		putU32(out, user.getRegState() | user.getIsOperator() << 8
+			| (Tls::has(fd) && Tls::mode(fd) == Tls::KERNEL) << 9 | user.isAuthenticating() << 10);
+		putStr(out, IO::getPending(fd));
+		putStr(out, IO::getQueued(fd));
+		putU32(out, IO::caps(fd));
+		putStr(out, user.getAccount());
+		putStr(out, user.getSasl());
+		auto list = monitored.find(fd);
+		putU32(out, list == monitored.end() ? 0 : list->second.size());
+		if (list != monitored.end())
+			for (const auto &[key, nick] : list->second)
+				putStr(out, nick);
+	}
+	putU32(out, channels.size());
+	for (const auto &[key, channel] : channels) {
+		putStr(out, channel.getChannelName());
+		putStr(out, channel.getChannelTopic());
+		putStr(out, channel.getPassword());
+		putU32(out, channel.isInviteOnly() | channel.isTopicRestricted() << 1);
+		putU32(out, channel.getUserLimit());
+		putU32(out, channel.getCreatedAt());
+		putU32(out, channel.getTopicSetAt());
+		vector<int> members, invited;
+		for (const auto &member : channel.getUserList())
+			members.push_back(member.first);
+		for (const auto &invite : channel.getInviteList())
+			invited.push_back(invite.first);
+		putFds(out, leaving, members);
+		putFds(out, leaving, invited);
+		putFds(out, leaving, vector<int>(channel.getOperators().begin(), channel.getOperators().end()));
+		for (char mode : string("beI")) {
+			putU32(out, channel.getMaskList(mode).size());
+			for (const MaskList::Entry &e : channel.getMaskList(mode).list()) {
+				putStr(out, e.mask);
+				putStr(out, e.setBy);
+				putU32(out, e.setAt);
+			}
+		}
+	}
+	vector<pair<string, vector<int>>> parts;
+	for (int fd : leaving)
+		for (const auto &[key, channel] : channels) {
+			if (!channel.findUser(fd))
+				continue;
+			vector<int> members;
+			for (const auto &member : channel.getUserList())
+				members.push_back(member.first);
+			parts.push_back({users.at(fd).line("PART", channel.getChannelName(), "Server upgrade"), members});
+		}
+	putU32(out, parts.size());
+	for (const auto &[line, members] : parts) {
+		putStr(out, line);
+		putFds(out, leaving, members);
+	}
+	return out;
+}
+
+// returns what the clients that stayed behind leave for the others to see, per fd
+map<int, string> Server::restoreState(const string &blob, const map<int, int> &fdMap) {
+	Reader in = {blob, 0};
+
+	if (in.u32() != UPGRADE_MAGIC)
+		throw runtime_error("upgrade: state from an incompatible binary");
+
+	for (uint32_t count = in.u32(); count > 0; --count) {
+		int fd = fdMap.at(in.u32());
+		if (in.u32()) {
+			_tlsListener = fd;
+			if (config.tlsCert.empty() || config.tlsKey.empty())
+				throw runtime_error("upgrade: TLS listener handed over without tls_cert/tls_key");
+			Tls::init(config.tlsCert, config.tlsKey);
+		}
+		_listenerFds.push_back(fd);
+		loop->addListener(fd);
+	}
+
+	for (uint32_t count = in.u32(); count > 0; --count) {
+		int		original = in.u32();
+		int		fd = fdMap.at(original);
+		User	user(fd);
+		string	nick = in.str(), username = in.str(), host = in.str();
+		string	server = in.str(), real = in.str();
+		uint32_t flags = in.u32();
+
+		user.setNickname(nick);
+		if (!username.empty())
+			user.setUsername(username);
+		user.setHostname(host);
+		if (!server.empty())
+			user.setServername(server);
+		if (!real.empty())
+			user.setRealname(real);
+		user.setRegState(flags & 0xff);
+		user.setIsOperator(flags & 0x100);
+		if (flags & 0x200)
+			Tls::adopt(fd);
+		users[fd] = user;
+		Capture::remapped(original, fd);
+		if (user.getNickIsSet())
+			indexNick(fd, user.getNickname());
+		if (user.getUserIsSet())
+			indexUser(user);
+		IO::setPending(fd, in.str());
+		IO::setQueued(fd, in.str());
+		IO::connection(fd).caps = in.u32();
+		users[fd].setAccount(in.str());
+		users[fd].setSasl(flags & 0x400, in.str());
+		for (uint32_t n = in.u32(); n > 0; --n)
+			watch(fd, in.str());
+		loop->add(fd, !Tls::has(fd));
+	}
+
+	for (uint32_t count = in.u32(); count > 0; --count) {
+		string	name = in.str();
+		auto	&[key, channel] = channels.insert(name, Channel(name));
+
+		channel.setChannelTopic(in.str());
+		channel.setPassword(in.str());
+		uint32_t flags = in.u32();
+		channel.setInviteOnly(flags & 1);
+		channel.setTopicRestriction(flags & 2);
+		channel.setUserLimit(in.u32());
+		time_t created = in.u32();
+		channel.setTimes(created, in.u32());
+		for (uint32_t n = in.u32(); n > 0; --n) {
+			int fd = fdMap.at(in.u32());
+			channel.addUser(fd, &users.at(fd));
+		}
+		for (uint32_t n = in.u32(); n > 0; --n) {
+			int fd = fdMap.at(in.u32());
+			channel.addInvite(fd, &users.at(fd));
+		}
+		for (uint32_t n = in.u32(); n > 0; --n)
+			channel.addOperator(users.at(fdMap.at(in.u32())));
+		for (char mode : string("beI")) {
+			for (uint32_t n = in.u32(); n > 0; --n) {
+				string mask = in.str();
+				string setBy = in.str();
+				channel.addMask(mode, mask, setBy, in.u32());
+			}
+		}
+		directory.update(key, channel);
+	}
+
+	map<int, string> parts;
+	for (uint32_t count = in.u32(); count > 0; --count) {
+		string line = in.str();
+		for (uint32_t n = in.u32(); n > 0; --n) {
+			string &out = parts[fdMap.at(in.u32())];
+			out += (out.empty() ? "" : "\r\n") + line;
+		}
+	}
+	return parts;
+}
+
+// new process side: take over the sockets and state handed over on upgradeFd
+Server::Server(const string port, const string password, const Config &settings, int upgradeFd)
+	: config(settings), _port(stoi(port)), _password(password) {
+	uint32_t	fdCount;
+	uint64_t	blobSize;
+
+	if (!readAll(upgradeFd, &fdCount, sizeof(fdCount)) || fdCount == 0)
+		throw runtime_error("upgrade: no sockets received");
+	raiseFdLimit(); // before the sockets arrive
+	vector<int> received = recvFds(upgradeFd, fdCount);
+	vector<int> original(fdCount);
+	if (!readAll(upgradeFd, original.data(), sizeof(int) * fdCount)
+		|| !readAll(upgradeFd, &blobSize, sizeof(blobSize)))
+		throw runtime_error("upgrade: truncated handover");
+	string blob(blobSize, '\0');
+	if (!readAll(upgradeFd, blob.data(), blobSize))
+		throw runtime_error("upgrade: truncated handover");
+
+	map<int, int> fdMap;
+	for (size_t i = 0; i < fdCount; ++i)
+		fdMap[original[i]] = received[i];
+	Capture::start(settings.capture.c_str());
+	applyConfig();
+	openLoop();
+	loadAccounts();
+	map<int, string> parts = restoreState(blob, fdMap);
+	syncListeners();
+
+	if (!writeAll(upgradeFd, "K", 1))
+		throw runtime_error("upgrade: old process vanished");
+	close(upgradeFd);
+	for (const auto &[fd, lines] : parts)
+		IO::sendString(fd, lines);
+	log(INFO, "Server", "Upgrade complete: took over " + to_string(users.size()) + " clients and "
+		+ to_string(channels.size()) + " channels on port " + to_string(_port));
+}
+
+// old process side: returns true when the new binary took over
+bool Server::hotUpgrade() {
+	int sv[2];
+
+	// the binary on disk now, even when started by a relative path; a rebuilt one shows as "(deleted)"
+	string binary(PATH_MAX, '\0');
+	ssize_t len = readlink("/proc/self/exe", binary.data(), binary.size());
+	if (len <= 0) {
+		log(ERROR, "Upgrade", "readlink /proc/self/exe failed: " + string(strerror(errno)));
+		return false;
+	}
+	binary.resize(len);
+	if (binary.size() > 10 && binary.compare(binary.size() - 10, 10, " (deleted)") == 0)
+		binary.resize(binary.size() - 10);
+	log(INFO, "Server", "Hot upgrade requested, starting " + binary);
+
+	// TLS state in userspace cannot be handed over, only kernel (kTLS) sessions can
+	set<int> userspaceTls;
+	for (const auto &[fd, user] : users)
+		if (Tls::has(fd) && Tls::mode(fd) != Tls::KERNEL)
+			userspaceTls.insert(fd);
+	Capture::flush(); // the new process appends its own segment
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+		log(ERROR, "Upgrade", "socketpair failed: " + string(strerror(errno)));
+		return false;
+	}
+
+	// other threads may hold the malloc lock across fork(), so everything the child needs is built here
+	string			port = to_string(_port);
+	string			fdVar = string(UPGRADE_ENV "=") + to_string(sv[1]);
+	vector<char *>	envp;
+	for (char **var = environ; *var; ++var)
+		if (strncmp(*var, UPGRADE_ENV "=", sizeof(UPGRADE_ENV)) != 0)
+			envp.push_back(*var);
+	envp.push_back(fdVar.data());
+	envp.push_back(nullptr);
+	char *argv[] = {program_invocation_name, port.data(), const_cast<char *>(_password.c_str()), nullptr};
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		log(ERROR, "Upgrade", "fork failed: " + string(strerror(errno)));
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if (pid == 0) {
+		fcntl(sv[1], F_SETFD, 0); // the new process keeps this end
+		execve(binary.c_str(), argv, envp.data());
+		_exit(127);
+	}
+	close(sv[1]);
+	// a new process that hangs must not freeze this one: the reads and writes below give up
+	struct timeval timeout = {UPGRADE_TIMEOUT, 0};
+	setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// whatever the event loop holds goes back into the queues, which are handed over
+	loop->quiesce();
+	for (const auto &[fd, user] : users) {
+		if (Tls::has(fd))
+			continue;
+		string input = IO::getPending(fd);
+		while (loop->read(fd, input) > 0)
+			;
+		IO::setPending(fd, input);
+		IO::setQueued(fd, loop->takeUnsent(fd) + IO::getQueued(fd));
+	}
+
+	vector<int> list = _listenerFds;
+	for (const auto &[fd, user] : users)
+		if (!userspaceTls.count(fd))
+			list.push_back(fd);
+	string		blob = serializeState(userspaceTls);
+	uint32_t	fdCount = list.size();
+	uint64_t	blobSize = blob.size();
+	char		ack = 0;
+
+	bool ok = writeAll(sv[0], &fdCount, sizeof(fdCount))
+		&& sendFds(sv[0], list)
+		&& writeAll(sv[0], list.data(), sizeof(int) * list.size())
+		&& writeAll(sv[0], &blobSize, sizeof(blobSize))
+		&& writeAll(sv[0], blob.data(), blob.size())
+		&& readAll(sv[0], &ack, 1) && ack == 'K';
+	close(sv[0]);
+
+	if (!ok) {
+		log(ERROR, "Upgrade", "New process did not take over, continuing with the old one");
+		kill(pid, SIGKILL);
+		waitpid(pid, nullptr, 0);
+		loop->resume();
+		return false;
+	}
+	// the new process tells their channels, these only hear it from here
+	for (int fd : userspaceTls)
+		IO::sendString(fd, "ERROR :Server upgrade, please reconnect");
+	log(INFO, "Upgrade", "Handed over " + to_string(users.size() - userspaceTls.size()) + " clients to pid "
+		+ to_string(pid) + ", " + to_string(userspaceTls.size()) + " TLS clients asked to reconnect");
+	return true;
+}
+
+int Server::upgradeFdFromEnv() {
+	const char *value = getenv(UPGRADE_ENV);
+	if (!value)
+		return -1;
+	int fd = atoi(value);
+	unsetenv(UPGRADE_ENV);
+	return fd;
+}
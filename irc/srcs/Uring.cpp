@@ -0,0 +1,602 @@
+#include "../includes/Uring.hpp"
+#include "../includes/Utils.hpp"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+static int uringSetup(unsigned entries, io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int ring, unsigned submit, unsigned wait, unsigned flags, const void *arg, size_t size)
+{
+	return syscall(__NR_io_uring_enter, ring, submit, wait, flags, arg, size);
+}
+
+static int uringRegister(int ring, unsigned op, void *arg, unsigned count)
+{
+	return syscall(__NR_io_uring_register, ring, op, arg, count);
+}
+
+#define GEN_MASK	0xffffff	// generations wrap at 24 bits, what user_data has room for
+
+// user_data: fd | operation << 32 | generation << 40
+static uint64_t tag(int fd, uint8_t op, uint32_t gen)
+{
+	return static_cast<uint32_t>(fd) | static_cast<uint64_t>(op) << 32 | static_cast<uint64_t>(gen & GEN_MASK) << 40;
+}
+
+UringLoop::UringLoop()
+{
+	try {
+		setup();
+		if (bufRing && !probe())
+			provideBuffers();
+		if (!probe())
+			throw std::runtime_error("io_uring: no multishot recv");
+	} catch (...) {
+		teardown();
+		throw;
+	}
+}
+
+UringLoop::~UringLoop()
+{
+	teardown();
+}
+
+void UringLoop::setup()
+{
+	io_uring_params p = {};
+
+	p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	ring = uringSetup(URING_ENTRIES, &p);
+	if (ring < 0 && errno == EINVAL) {
+		p = {};
+		ring = uringSetup(URING_ENTRIES, &p);
+	}
+	if (ring < 0)
+		throw std::runtime_error(std::string("io_uring_setup: ") + strerror(errno));
+	unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	if ((p.features & needed) != needed)
+		throw std::runtime_error("io_uring: kernel too old");
+
+	ringsSize = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+		p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+	rings = mmap(nullptr, ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+	if (rings == MAP_FAILED) {
+		rings = nullptr;
+		throw std::runtime_error(std::string("io_uring mmap: ") + strerror(errno));
+	}
+	char *base = static_cast<char *>(rings);
+	sqHead = reinterpret_cast<unsigned *>(base + p.sq_off.head);
+	sqTail = reinterpret_cast<unsigned *>(base + p.sq_off.tail);
+	sqMask = *reinterpret_cast<unsigned *>(base + p.sq_off.ring_mask);
+	sqEntries = p.sq_entries;
+	cqHead = reinterpret_cast<unsigned *>(base + p.cq_off.head);
+	cqTail = reinterpret_cast<unsigned *>(base + p.cq_off.tail);
+	cqMask = *reinterpret_cast<unsigned *>(base + p.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe *>(base + p.cq_off.cqes);
+	unsigned *array = reinterpret_cast<unsigned *>(base + p.sq_off.array);
+	for (unsigned i = 0; i < p.sq_entries; ++i)
+		array[i] = i; // slot i always holds sqe i
+	sqLocal = *sqTail;
+
+	sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+	void *mapped = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+	if (mapped == MAP_FAILED)
+		throw std::runtime_error(std::string("io_uring mmap: ") + strerror(errno));
+	sqes = static_cast<io_uring_sqe *>(mapped);
+
+	mapped = mmap(nullptr, URING_BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED)
+		throw std::runtime_error(std::string("io_uring buffer ring: ") + strerror(errno));
+	bufRing = static_cast<io_uring_buf_ring *>(mapped);
+	buffers.resize(URING_BUFFERS * URING_BUFFER_SIZE);
+
+	io_uring_buf_reg reg = {};
+	reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = 0;
+	if (uringRegister(ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		provideBuffers();
+		return;
+	}
+	for (uint16_t bid = 0; bid < URING_BUFFERS; ++bid)
+		recycle(bid);
+}
+
+/*
+Without a working buffer ring (before Linux 5.19, or a kernel that
+never hands out its entries) the same buffers are given to the kernel
+with IORING_OP_PROVIDE_BUFFERS instead, and returned ones are provided
+again in runs on the next submit.
+*/
+void UringLoop::provideBuffers()
+{
+	if (bufRing) {
+		io_uring_buf_reg reg = {};
+		uringRegister(ring, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		munmap(bufRing, URING_BUFFERS * sizeof(io_uring_buf));
+		bufRing = nullptr;
+		log(WARN, "Server", "io_uring buffer ring unusable, providing buffers one by one");
+	}
+	returned.clear();
+	for (uint16_t bid = 0; bid < URING_BUFFERS; ++bid)
+		returned.push_back(bid);
+}
+
+void UringLoop::teardown()
+{
+	if (bufRing)
+		munmap(bufRing, URING_BUFFERS * sizeof(io_uring_buf));
+	if (sqes)
+		munmap(sqes, sqesSize);
+	if (rings)
+		munmap(rings, ringsSize);
+	if (ring >= 0)
+		::close(ring);
+	bufRing = nullptr;
+	sqes = nullptr;
+	rings = nullptr;
+	ring = -1;
+}
+
+/*
+Multishot recv needs Linux 6.0, which no feature flag tells apart: one
+byte over a socketpair must arrive with the recv still armed.
+*/
+bool UringLoop::probe()
+{
+	int					sv[2];
+	std::vector<Event>	events;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+		throw std::runtime_error(std::string("socketpair: ") + strerror(errno));
+	add(sv[0], true);
+	wait(0, events);
+	::send(sv[1], "x", 1, MSG_NOSIGNAL);
+	for (int tries = 0; tries < 10 && events.empty(); ++tries)
+		wait(100, events);
+	Client *c = find(sv[0]);
+	bool ok = c->staged == "x" && c->armed && !c->readError;
+	remove(sv[0]);
+	::close(sv[0]);
+	::close(sv[1]);
+	return ok;
+}
+
+UringLoop::Client *UringLoop::find(int fd)
+{
+	auto it = clients.find(fd);
+	return it == clients.end() ? nullptr : it->second.get();
+}
+
+// the client a completion belongs to, including removed ones still sending
+UringLoop::Client *UringLoop::owner(int fd, uint32_t gen)
+{
+	Client *c = find(fd);
+	if (c && c->gen == gen)
+		return c;
+	for (const auto &r : retired)
+		if (r->fd == fd && r->gen == gen)
+			return r.get();
+	return nullptr;
+}
+
+unsigned UringLoop::space() const
+{
+	return sqEntries - (sqLocal - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+}
+
+io_uring_sqe *UringLoop::sqe(uint64_t userData)
+{
+	if (space() == 0)
+		submit(0, nullptr);
+	io_uring_sqe *s = &sqes[sqLocal & sqMask];
+	memset(s, 0, sizeof(*s));
+	s->user_data = userData;
+	sqLocal++;
+	outstanding++;
+	return s;
+}
+
+io_uring_sqe *UringLoop::sqe(Client &c, Op op)
+{
+	io_uring_sqe *s = sqe(tag(c.fd, op, c.gen));
+	s->fd = c.fd;
+	return s;
+}
+
+// hands queued sqes to the kernel and waits for up to one completion
+void UringLoop::submit(unsigned wait, const __kernel_timespec *ts)
+{
+	if (!returned.empty())
+		provideReturned();
+	__atomic_store_n(sqTail, sqLocal, __ATOMIC_RELEASE);
+	unsigned pending = sqLocal - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	if (pending == 0 && wait == 0)
+		return;
+
+	io_uring_getevents_arg	arg = {0, 0, 0, reinterpret_cast<uint64_t>(ts)};
+	unsigned				flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	if (ts)
+		flags |= IORING_ENTER_EXT_ARG;
+	if (uringEnter(ring, pending, wait, flags, ts ? &arg : nullptr, ts ? sizeof(arg) : 0) < 0
+		&& errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY)
+		throw std::runtime_error(std::string("io_uring_enter: ") + strerror(errno));
+}
+
+void UringLoop::recycle(uint16_t bid)
+{
+	if (!bufRing) {
+		returned.push_back(bid);
+		return;
+	}
+	io_uring_buf &b = bufRing->bufs[bufTail & (URING_BUFFERS - 1)];
+
+	b.addr = reinterpret_cast<uint64_t>(buffers.data() + bid * URING_BUFFER_SIZE);
+	b.len = URING_BUFFER_SIZE;
+	b.bid = bid;
+	bufTail++;
+	__atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+
+// one PROVIDE_BUFFERS per run of consecutive buffer ids
+void UringLoop::provideReturned()
+{
+	std::vector<uint16_t> bids = std::exchange(returned, {});
+
+	std::sort(bids.begin(), bids.end());
+	for (size_t start = 0, end; start < bids.size(); start = end) {
+		for (end = start + 1; end < bids.size() && bids[end] == bids[end - 1] + 1; ++end)
+			;
+		io_uring_sqe *s = sqe(tag(-1, OP_PROVIDE, 0));
+		s->opcode = IORING_OP_PROVIDE_BUFFERS;
+		s->fd = end - start;
+		s->addr = reinterpret_cast<uint64_t>(buffers.data() + bids[start] * URING_BUFFER_SIZE);
+		s->len = URING_BUFFER_SIZE;
+		s->off = bids[start];
+		s->buf_group = 0;
+	}
+}
+
+void UringLoop::arm(Client &c)
+{
+	if (c.armed || quiet)
+		return;
+	if (c.listener) {
+		io_uring_sqe *s = sqe(c, OP_ACCEPT);
+		s->opcode = IORING_OP_ACCEPT;
+		s->ioprio = IORING_ACCEPT_MULTISHOT;
+		s->accept_flags = SOCK_CLOEXEC;
+	} else if (c.stream) {
+		if (c.eof || c.readError)
+			return;
+		io_uring_sqe *s = sqe(c, OP_RECV);
+		s->opcode = IORING_OP_RECV;
+		s->ioprio = IORING_RECV_MULTISHOT;
+		s->flags = IOSQE_BUFFER_SELECT;
+		s->buf_group = 0;
+	} else {
+		io_uring_sqe *s = sqe(c, OP_POLL);
+		s->opcode = IORING_OP_POLL_ADD;
+		s->poll32_events = c.events;
+	}
+	c.armed = true;
+}
+
+// links the unsent part of the chain buffer as sends of up to URING_SEND_CHUNK
+void UringLoop::sendChain(Client &c)
+{
+	size_t		left = c.chain.size() - c.chainSent;
+	unsigned	links = (left + URING_SEND_CHUNK - 1) / URING_SEND_CHUNK;
+
+	if (space() < links)
+		submit(0, nullptr); // a chain must not be split over two submissions
+	for (size_t off = c.chainSent; off < c.chain.size(); off += URING_SEND_CHUNK) {
+		size_t			len = std::min<size_t>(URING_SEND_CHUNK, c.chain.size() - off);
+		io_uring_sqe	*s = sqe(c, OP_SEND);
+
+		s->opcode = IORING_OP_SEND;
+		s->addr = reinterpret_cast<uint64_t>(c.chain.data() + off);
+		s->len = len;
+		s->msg_flags = MSG_NOSIGNAL | MSG_WAITALL; // a short send breaks the link
+		if (off + len < c.chain.size())
+			s->flags = IOSQE_IO_LINK;
+		c.inflight++;
+	}
+}
+
+void UringLoop::cancel(Client &c)
+{
+	io_uring_sqe *s = sqe(c, OP_CANCEL);
+
+	s->opcode = IORING_OP_ASYNC_CANCEL;
+	s->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+void UringLoop::readable(Client &c, std::vector<Event> &events)
+{
+	if (c.reported == round)
+		return;
+	c.reported = round;
+	events.push_back({Event::READABLE, c.fd, -1, 0});
+}
+
+void UringLoop::complete(const io_uring_cqe &cqe, std::vector<Event> &events)
+{
+	int			fd = static_cast<int>(cqe.user_data & 0xffffffff);
+	Op			op = static_cast<Op>((cqe.user_data >> 32) & 0xff);
+	uint32_t	gen = cqe.user_data >> 40;
+	bool		more = cqe.flags & IORING_CQE_F_MORE;
+	Client		*c = owner(fd, gen);
+
+	if (!more)
+		outstanding--;
+	if (op == OP_RECV && (cqe.flags & IORING_CQE_F_BUFFER)) {
+		uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+		if (c && cqe.res > 0)
+			c->staged.append(buffers.data() + bid * URING_BUFFER_SIZE, cqe.res);
+		recycle(bid);
+	}
+	if (!c) {
+		if (op == OP_ACCEPT && cqe.res >= 0)
+			::close(cqe.res); // the listener is gone
+		return;
+	}
+
+	switch (op) {
+	case OP_ACCEPT:
+		if (cqe.res >= 0)
+			events.push_back({Event::ACCEPT, cqe.res, fd, 0});
+		else if (cqe.res != -ECANCELED)
+			events.push_back({Event::ACCEPT, -1, fd, -cqe.res});
+		break;
+	case OP_RECV:
+		if (cqe.res == 0)
+			c->eof = true;
+		else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+			c->readError = -cqe.res;
+		if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+			readable(*c, events);
+		break;
+	case OP_POLL:
+		if (cqe.res > 0 && (cqe.res & POLLOUT))
+			events.push_back({Event::WRITABLE, fd, -1, 0});
+		if (cqe.res > 0 && (cqe.res & (POLLIN | POLLHUP | POLLERR)))
+			readable(*c, events);
+		break;
+	case OP_SEND:
+		c->inflight--;
+		if (cqe.res > 0)
+			c->chainSent += cqe.res;
+		else if (cqe.res < 0 && cqe.res != -ECANCELED && !c->writeError)
+			c->writeError = -cqe.res;
+		if (c->inflight > 0)
+			return;
+		if (find(fd) != c) {
+			for (auto it = retired.begin(); it != retired.end(); ++it)
+				if (it->get() == c) {
+					retired.erase(it);
+					break;
+				}
+			return;
+		}
+		if (c->chainSent == c->chain.size() || c->writeError) {
+			c->chain.clear();
+			c->chain.shrink_to_fit();
+			c->chainSent = 0;
+		} else if (!quiet) {
+			sendChain(*c); // a send that ended short without an error
+			return;
+		}
+		events.push_back({Event::WRITABLE, fd, -1, 0});
+		return;
+	default:
+		return;
+	}
+	if (!more) {
+		c->armed = false;
+		if (cqe.res != -ECANCELED)
+			rearm.push_back(fd);
+	}
+}
+
+void UringLoop::reap(std::vector<Event> &events)
+{
+	unsigned head = *cqHead;
+	unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; ++head)
+		complete(cqes[head & cqMask], events);
+	__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+void UringLoop::addListener(int fd)
+{
+	auto c = std::make_unique<Client>();
+
+	c->fd = fd;
+	c->gen = nextGen++ & GEN_MASK;
+	c->listener = true;
+	c->stream = false;
+	clients[fd] = std::move(c);
+	rearm.push_back(fd);
+}
+
+void UringLoop::add(int fd, bool stream)
+{
+	auto c = std::make_unique<Client>();
+
+	c->fd = fd;
+	c->gen = nextGen++ & GEN_MASK;
+	c->listener = false;
+	c->stream = stream;
+	clients[fd] = std::move(c);
+	rearm.push_back(fd);
+}
+
+/*
+Everything still in flight on fd is cancelled and submitted right away,
+before the caller closes it. A send chain keeps its buffer until its
+last completion arrives.
+*/
+void UringLoop::remove(int fd)
+{
+	auto it = clients.find(fd);
+	if (it == clients.end())
+		return;
+	std::unique_ptr<Client> c = std::move(it->second);
+	clients.erase(it);
+	if (c->armed || c->inflight)
+		cancel(*c);
+	submit(0, nullptr);
+	if (c->inflight)
+		retired.push_back(std::move(c));
+}
+
+// readiness clients only: an armed poll gets its mask updated in place
+void UringLoop::setEvents(int fd, short events)
+{
+	Client *c = find(fd);
+	if (!c || c->stream || c->listener || c->events == events)
+		return;
+	c->events = events;
+	if (!c->armed)
+		return;
+	io_uring_sqe *s = sqe(*c, OP_UPDATE);
+	s->opcode = IORING_OP_POLL_REMOVE;
+	s->addr = tag(fd, OP_POLL, c->gen);
+	s->len = IORING_POLL_UPDATE_EVENTS;
+	s->poll32_events = events;
+}
+
+void UringLoop::wait(int timeoutMs, std::vector<Event> &events)
+{
+	events.clear();
+	round++;
+	for (int fd : std::exchange(rearm, {}))
+		if (Client *c = find(fd))
+			arm(*c);
+	for (int fd : std::exchange(ready, {}))
+		if (Client *c = find(fd))
+			readable(*c, events);
+	reap(events);
+	if (!events.empty() || timeoutMs == 0) {
+		submit(0, nullptr);
+	} else if (timeoutMs < 0) {
+		submit(1, nullptr);
+	} else {
+		__kernel_timespec ts = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000LL};
+		submit(1, &ts);
+	}
+	reap(events);
+}
+
+ssize_t UringLoop::read(int fd, std::string &out)
+{
+	Client *c = find(fd);
+	if (!c || !c->stream) {
+		char	buf[512];
+		ssize_t	n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (n > 0)
+			out.append(buf, n);
+		return n;
+	}
+	if (!c->staged.empty()) {
+		size_t n = c->staged.size();
+		if (out.empty())
+			out.swap(c->staged);
+		else
+			out += c->staged;
+		c->staged.clear();
+		c->staged.shrink_to_fit();
+		if (c->eof || c->readError)
+			ready.push_back(fd); // the end is reported after the data
+		return n;
+	}
+	if (c->readError) {
+		errno = c->readError;
+		return -1;
+	}
+	if (c->eof)
+		return 0;
+	errno = EAGAIN;
+	return -1;
+}
+
+// takes up to URING_WRITE_MAX bytes once the previous chain is done
+ssize_t UringLoop::write(int fd, const char *data, size_t len)
+{
+	Client *c = find(fd);
+	if (!c || !c->stream)
+		return ::send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (c->writeError) {
+		errno = c->writeError;
+		return -1;
+	}
+	if (!c->chain.empty() || quiet) {
+		errno = EAGAIN;
+		return -1;
+	}
+	len = std::min<size_t>(len, URING_WRITE_MAX);
+	c->chain.assign(data, len);
+	c->chainSent = 0;
+	sendChain(*c);
+	return len;
+}
+
+/*
+Cancels every accept, recv, poll and send and waits for all of them to
+complete. Received bytes stay staged for read(); connections accepted
+in the meantime are closed, their clients will retry.
+*/
+void UringLoop::quiesce()
+{
+	std::vector<Event> events;
+
+	quiet = true;
+	for (const auto &[fd, c] : clients)
+		if (c->armed || c->inflight)
+			cancel(*c);
+	while (outstanding > 0) {
+		submit(1, nullptr);
+		reap(events);
+		for (const Event &e : events)
+			if (e.kind == Event::ACCEPT && e.fd >= 0)
+				::close(e.fd);
+		events.clear();
+	}
+	rearm.clear();
+}
+
+void UringLoop::resume()
+{
+	quiet = false;
+	for (const auto &[fd, c] : clients) {
+		rearm.push_back(fd);
+		if (c->eof || c->readError)
+			ready.push_back(fd);
+		if (!c->chain.empty())
+			sendChain(*c);
+	}
+}
+
+std::string UringLoop::takeUnsent(int fd)
+{
+	Client *c = find(fd);
+	if (!c || c->inflight)
+		return "";
+	std::string unsent = c->chain.substr(c->chainSent);
+	c->chain.clear();
+	c->chainSent = 0;
+	return unsent;
+}
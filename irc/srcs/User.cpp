@@ -8,6 +8,8 @@
 #include <vector>
 #include <optional>
 
+static unsigned long nextMaskId = 0;
+
 User::User() :
 	nickname("Unknown"),
 	username(""),
@@ -16,10 +18,12 @@ User::User() :
 	realname(""),
 	fd(-1),
 	isOperator(false),
-	isAuth(false),
-	nickIsSet(false),
-	userIsSet(false),
-	isRegistered(false) {}
+	regState(REG_NONE),
+	maskId(++nextMaskId),
+	authenticating(false)
+{
+	updatePrefix();
+}
 
 User::User(const int fd) :
 	nickname("User" + to_string(fd -3)),
@@ -29,10 +33,12 @@ User::User(const int fd) :
 	realname(""),
 	fd(fd),
 	isOperator(false),
-	isAuth(false),
-	nickIsSet(false),
-	userIsSet(false),
-	isRegistered(false) {}
+	regState(REG_NONE),
+	maskId(++nextMaskId),
+	authenticating(false)
+{
+	updatePrefix();
+}
 
 User::User(const User &other) :
 	nickname(other.nickname),
@@ -42,10 +48,13 @@ User::User(const User &other) :
 	realname(other.realname),
 	fd(other.fd),
 	isOperator(other.isOperator),
-	isAuth(other.isAuth),
-	nickIsSet(other.nickIsSet),
-	userIsSet(other.userIsSet),
-	isRegistered(other.isRegistered) {}
+	regState(other.regState),
+	maskId(other.maskId),
+	prefix(other.prefix),
+	account(other.account),
+	authenticating(other.authenticating),
+	sasl(other.sasl),
+	channels(other.channels) {}
 
 User& User::operator=(const User &other)
 {
@@ -58,44 +67,63 @@ User& User::operator=(const User &other)
 	realname = other.realname;
 	fd = other.fd;
 	isOperator = other.isOperator;
-	isAuth = other.isAuth;
-	nickIsSet = other.nickIsSet;
-	userIsSet = other.userIsSet;
-	isRegistered = other.isRegistered;
+	regState = other.regState;
+	maskId = other.maskId;
+	prefix = other.prefix;
+	account = other.account;
+	authenticating = other.authenticating;
+	sasl = other.sasl;
+	channels = other.channels;
 	return *this;
 }
 
+// records a registration step, true only on the step that completes registration
+bool User::advance(const RegState step)
+{
+	regState |= step;
+	if (regState != (REG_PASS | REG_NICK | REG_USER))
+		return false;
+	regState |= REG_DONE;
+	return true;
+}
+
 int	User::setNickname(const std::string &nickname)
 {
-	regex nick_regex(R"(^[A-Za-z\[\]\\`_^{}|][-A-Za-z0-9\[\]\\`_^{}|]{0,8}$)");
+	static const regex nick_regex(R"(^[A-Za-z\[\]\\`_^{}|][-A-Za-z0-9\[\]\\`_^{}|]{0,8}$)");
 	if (regex_match(nickname, nick_regex) == false)
 		return ERR_ERRONEUSNICKNAME;
 	this->nickname = nickname;
+	maskId = ++nextMaskId;
+	updatePrefix();
 	return 0;
 }
 
 int User::setUsername(const std::string &username)
 {
-	regex user_regex(R"(^[^\s@]{1,10}$)");
+	static const regex user_regex(R"(^[^\s@]{1,10}$)");
 	if (regex_match(username, user_regex) == false)
 		return 1;
 	this->username = username;
+	maskId = ++nextMaskId;
+	updatePrefix();
 	return 0;
 }
 
 int User::setHostname(const std::string &hostname)
 {
 	return 0;
-	regex host_regex(R"(^(?=.{1,255}$)([a-zA-Z0-9]([a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?(\.[a-zA-Z0-9]{1,})*)$)");
+	static const regex host_regex(R"(^(?=.{1,255}$)([a-zA-Z0-9]([a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?(\.[a-zA-Z0-9]{1,})*)$)");
 	if (regex_match(hostname, host_regex) == false)
 		return 1;
 	this->hostname = hostname;
+	maskId = ++nextMaskId;
+	updatePrefix();
 	return 0;
 }
 
 int User::setServername(const std::string &servername)
 {
-	regex server_regex(R"(^(?=.{1,255}$)([a-zA-Z0-9]([a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?(\.[a-zA-Z0-9]{1,})*)$)");
+	static const regex server_regex(R"(^(?=.{1,255}$)([a-zA-Z0-9]([a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?(\.[a-zA-Z0-9]{1,})*)$)");
 	if (regex_match(servername, server_regex) == false)
 		return 1;
 	this->servername = servername;
@@ -104,7 +132,7 @@ int User::setServername(const std::string &servername)
 
 int User::setRealname(const std::string &realname)
 {
-	regex real_regex(R"(^[\x20-\x7E]{1,50}$)");
+	static const regex real_regex(R"(^[\x20-\x7E]{1,50}$)");
 	if (regex_match(realname, real_regex) == false)
 		return 1;
 	this->realname = realname;
@@ -112,34 +140,54 @@ int User::setRealname(const std::string &realname)
 	return 0;
 }
 
-string User::getFullIdentifier() const
+// the prefix every message from this user carries, kept so relaying one builds nothing but the line
+void User::updatePrefix()
+{
+	prefix.clear();
+	prefix.reserve(3 + nickname.size() + username.size() + hostname.str().size());
+	prefix.append(":").append(nickname).append("!").append(username).append("@").append(hostname.str());
+}
+
+// "<prefix> <command> <params>[ :<trailing>]\r\n" in a single allocation
+std::string User::line(std::string_view command, std::string_view params, std::string_view trailing) const
 {
-	return ":" + nickname + "!" + username + "@" + hostname;
+	std::string line;
+
+	line.reserve(prefix.size() + command.size() + params.size() + trailing.size() + 6);
+	line.append(prefix).append(" ").append(command).append(" ").append(params);
+	if (!trailing.empty())
+		line.append(" :").append(trailing);
+	line.append("\r\n");
+	return line;
 }
 
-int User::privmsg(const User &recipient, const std::string &message) const
+// command is PRIVMSG or NOTICE; the line is serialized once for every recipient
+int User::privmsg(const User &recipient, std::string_view message, std::string_view command) const
 {
 	if (message.empty())
 		return ERR_NOTEXTTOSEND;
-	IO::sendCommand(recipient.fd, {getFullIdentifier(), "PRIVMSG", recipient.nickname + " " + message});
+	std::string line = this->line(command, recipient.nickname, message);
+	IO::sendString(recipient.fd, line);
+	if (IO::caps(fd) & CAP_ECHO_MESSAGE)
+		IO::sendString(fd, line);
 	return 0;
 }
 
-int User::privmsg(const Channel &channel, const std::string &message) const
+int User::privmsg(const Channel &channel, std::string_view message, std::string_view command) const
 {
 	if(!channel.findUser(fd))
 		return ERR_NOTONCHANNEL;
+	if (channel.isBanned(*this) && !channel.isOperator(*this))
+		return ERR_CANNOTSENDTOCHAN;
+	std::string line = this->line(command, channel.getChannelName(), message);
+	Span span("broadcast", fd);
+	span.count = channel.getUserList().size();
+	// a failed send only affects that member, who is dropped on their next poll
 	for (const auto &pair : channel.getUserList())
-		log(DEBUG, "User::privmsg", std::to_string(pair.first) + " is on channel " + channel.getChannelName());
-	for (const auto &pair : channel.getUserList())
-	{
-		if (pair.first == fd)
-			continue;
-		int ret = IO::sendCommand(pair.first, {getFullIdentifier(), "PRIVMSG", channel.getChannelName() + " " + message});
-		log(DEBUG, "User::privmsg", std::to_string(ret));
-		if (ret < 0)
-			return ret;
-	}
+		if (pair.first != fd)
+			IO::sendString(pair.first, line);
+	if (IO::caps(fd) & CAP_ECHO_MESSAGE)
+		IO::sendString(fd, line);
 	return 0;
 }
 
@@ -152,14 +200,16 @@ int User::join(Channel &channel)
 
 int User::join(Channel &channel, const string &password)
 {
+	if (channel.isBanned(*this) && !channel.IsInvited(getFd()))
+		return ERR_BANNEDFROMCHAN;
 	if (password != channel.getPassword())
 		return ERR_BADCHANNELKEY;
-	if (channel.isInviteOnly() && !channel.IsInvited(getFd()))
+	if (channel.isInviteOnly() && !channel.IsInvited(getFd()) && !channel.isInviteExcepted(*this))
 		return ERR_INVITEONLYCHAN;
 	if (channel.getUserLimit() <= channel.getUserList().size())
 		return ERR_CHANNELISFULL;
 	channel.addUser(fd, this);
-	if (IO::sendCommandAll(channel.getUserList(), {getFullIdentifier(), "JOIN", channel.getChannelName()}) < 0)
+	if (IO::sendStringAll(channel.getUserList(), line("JOIN", channel.getChannelName())) < 0)
 		throw runtime_error("send failed");
 	return 0;
 }
@@ -168,13 +218,8 @@ int User::part(Channel &channel, const std::string &message)
 {
 	if (!channel.findUser(fd).has_value())
 		return ERR_NOTONCHANNEL;
-	for (const auto &pair : channel.getUserList())
-	{
-		User* u = pair.second;
-		if (IO::sendCommand(u->fd, {getFullIdentifier(),
-			"PART", channel.getChannelName() + (message.empty() ? "" : " " + message)}) < 0)
-			return -1;
-	}
+	if (IO::sendStringAll(channel.getUserList(), line("PART", channel.getChannelName(), message)) < 0)
+		return -1;
 	log(DEBUG, "User::part", "User " + std::to_string(fd) + " parted channel " + channel.getChannelName());
 	channel.removeUser(fd);
 	channel.removeOperator(*this); 
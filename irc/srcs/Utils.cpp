@@ -1,4 +1,5 @@
 #include "Utils.hpp"
+#include "Simd.hpp"
 
 int countWords(const 	string &s) {
 	size_t pos = s.find(":");
@@ -19,17 +20,14 @@ int countWords(const 	string &s) {
 	return count;
 }
 
-vector<string> commaSplit(string str) {
-	vector<string> result;
+// "a,,b," -> a, "", b: empty items are kept, except after a last comma
+std::pmr::vector<string_view> commaSplit(string_view str) {
+	std::pmr::vector<string_view> result(Arena::get());
 
-	if (str.empty()) {
-		return result;
-	}
-
-	istringstream ss(str);
-	string word;
-	while (getline(ss, word, ',')) {
-		result.push_back(word);
+	for (size_t start = 0; start < str.size(); ) {
+		size_t comma = min(str.find(',', start), str.size());
+		result.push_back(str.substr(start, comma - start));
+		start = comma + 1;
 	}
 	return (result);
 }
@@ -47,15 +45,14 @@ vector<string> commaSplit(string str) {
 bool isValidChannelName(const string& channelName) {
 	if (channelName.empty() || channelName.size() > 50)
 		return (false);
-	regex channelRegex(R"(^[&#+!][^\x07\s,]*$)");
-	return regex_match(channelName, channelRegex);
+	if (string("&#+!").find(channelName[0]) == string::npos)
+		return (false);
+	return channelName.find_first_of(" \x07,\t\n\v\f\r", 1) == string::npos;
 }
 
 
 bool matchesWildcard(const string &pattern, const string &target) {
-	string regexPattern = "^" + regex_replace(pattern, regex("\\*"), ".*") + "$";
-	regex re(regexPattern);
-	return regex_match(target, re);
+	return Mask(pattern).matches(target);
 }
 
 bool targetIsUser(char c) {
@@ -76,17 +73,30 @@ bool isJoinedChannel(User &user, Channel &channel) {
 // trims spaces and : from end
 string trim(const string &str)
 {
-	const string spaces = " \r\n\t\f\v:";
-	size_t end;
+	return string(trim(string_view(str)));
+}
 
-	if (str.find_first_not_of(spaces) == string::npos)
-		return ""; // if contains only spaces
+string_view trim(string_view str)
+{
+	size_t end = str.size();
 
-	for (end = str.size() - 1;; --end)
-		if (spaces.find(str[end]) == string::npos) // non-space char
-			break;
+	while (end && (str[end - 1] == ' ' || str[end - 1] == ':' || (str[end - 1] >= '\t' && str[end - 1] <= '\r')))
+		--end;
+	return str.substr(0, end);
+}
+
+static log_level minimumLevel = DEBUG;
 
-	return str.substr(0, end + 1);
+// log_level from the config, lower levels are not printed
+void setLogLevel(log_level level)
+{
+	minimumLevel = level;
+}
+
+// whether log() prints at this level, so callers can skip building the details
+bool logs(log_level level)
+{
+	return (level != DEBUG || DEBUG_MODE) && level >= minimumLevel;
 }
 
 void log(const log_level level, const string &event, const string &details)
@@ -96,6 +106,8 @@ void log(const log_level level, const string &event, const string &details)
 
 	if (level == DEBUG && DEBUG_MODE == false)
 		return;
+	if (level < minimumLevel)
+		return;
 
 	time_t now = time(nullptr);
 	tm *ltm = localtime(&now);
@@ -121,7 +133,9 @@ void log(const log_level level, const string &event, const string &details)
 			break;
 	}
 	cout << RESET;
-	cout << "[" << event << "] " << trim(details) << endl;
+	// trimmed like trim(), without copying every line sent
+	size_t end = details.find_last_not_of(" \r\n\t\f\v:");
+	cout << "[" << event << "] " << string_view(details).substr(0, end + 1) << endl;
 }
 
 /*
@@ -132,27 +146,33 @@ JOIN target1,target2... pw1,pw2...
 QUIT [:][message]
 PART target1,target2 [:][message]
 */
-parsedArgs		parseArgs(const std::string& args, int argNum, bool withTrailing) {
-	parsedArgs			result;
-	std::istringstream	iss(args);
-	std::string			temp;
-	int 				limit = withTrailing ? (argNum - 1) : argNum;
+parsedArgs		parseArgs(string_view args, int argNum, bool withTrailing) {
+	const char	*spaces = " \t\n\v\f\r";
+	parsedArgs	result;
+	size_t		at = 0;
+	int 		limit = withTrailing ? (argNum - 1) : argNum;
+	auto		word = [&]() {
+		at = min(args.find_first_not_of(spaces, at), args.size());
+		size_t end = min(args.find_first_of(spaces, at), args.size());
+		string_view w = args.substr(at, end - at);
+		at = end;
+		return w;
+	};
 
 	result.size = 0;
-	while (result.size < limit && iss >> temp) {
-		result.args.push_back(temp);
+	result.args.reserve(max(limit, 0));
+	while (result.size < limit) {
+		string_view w = word();
+		if (w.empty())
+			break;
+		result.args.push_back(w);
 		result.size++;
 	}
 
 	if (withTrailing) {
 		size_t 	pos = args.find(":");
-		if (pos != std::string::npos) {
-			result.trailing = args.substr(pos + 1);
-		} else {
-			iss >> result.trailing;
-		}
+		result.trailing = pos != string_view::npos ? args.substr(pos + 1) : word();
 		if (!result.trailing.empty()) {
-			//cout << result.trailing <<endl;
 			result.size++;
 		}
 	}
@@ -160,13 +180,37 @@ parsedArgs		parseArgs(const std::string& args, int argNum, bool withTrailing) {
 }
 
 
-std::string toLowerString(const std::string& s) {
-    std::string result = s;
-    std::transform(result.begin(), result.end(), result.begin(),
-                   [](unsigned char c){ return std::tolower(c); });
+bool isValidPassword(const string& s) {
+	if (s.empty())
+		return false;
+	// Regex: only a-z, A-Z, 0-9, and 3 to 20 letters
+	std::regex pattern("^[a-zA-Z0-9]{3,20}$");
+	return std::regex_match(s, pattern);
+}
+
+std::string toLowerString(std::string_view s) {
+    std::string result(s);
+    Simd::fold(result.data(), result.size());
     return result;
 }
 
-bool compareIgnoreCase(const std::string& a, const std::string& b) {
-    return toLowerString(a) == toLowerString(b);
+// CASEMAPPING=ascii, without folding copies of both
+bool compareIgnoreCase(std::string_view a, std::string_view b) {
+    return Simd::equalFolded(a, b);
+}
+
+// value of one IRCv3 message tag ("a=1;label=x" -> "x"), empty if absent
+string tagValue(string_view tags, const string &key) {
+	size_t start = 0;
+
+	while (start < tags.size()) {
+		size_t end = tags.find(';', start);
+		if (end == string::npos)
+			end = tags.size();
+		if (tags.compare(start, key.size(), key) == 0
+			&& start + key.size() < end && tags[start + key.size()] == '=')
+			return string(tags.substr(start + key.size() + 1, end - start - key.size() - 1));
+		start = end + 1;
+	}
+	return "";
 }
\ No newline at end of file
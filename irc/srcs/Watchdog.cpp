@@ -0,0 +1,80 @@
+#include "../includes/Watchdog.hpp"
+#include "../includes/Trace.hpp"
+#include "../includes/Utils.hpp"
+#include <csignal>
+#include <execinfo.h>
+#include <unistd.h>
+
+std::atomic<uint64_t>	Watchdog::busySince{0};
+std::atomic<unsigned>	Watchdog::limitMs{0};
+std::thread				Watchdog::thread;
+std::mutex				Watchdog::lock;
+std::condition_variable	Watchdog::wakeup;
+bool					Watchdog::stopping = false;
+pthread_t				Watchdog::loopThread;
+
+// runs on the loop thread, interrupted wherever it is stuck
+void Watchdog::dumpStack(int)
+{
+	void		*frames[WATCHDOG_FRAMES];
+	int			count = backtrace(frames, WATCHDOG_FRAMES);
+	const char	header[] = "--- event loop stack ---\n";
+
+	if (write(STDERR_FILENO, header, sizeof(header) - 1) == -1)
+		return;
+	backtrace_symbols_fd(frames, count, STDERR_FILENO);
+}
+
+void Watchdog::start(unsigned ms)
+{
+	if (ms == limitMs)
+		return;
+	stop();
+	if (ms == 0)
+		return;
+
+	struct sigaction action = {};
+	void *warmup[1];
+	backtrace(warmup, 1); // loads libgcc now, not inside the signal handler
+	action.sa_handler = dumpStack;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(WATCHDOG_SIGNAL, &action, nullptr);
+
+	loopThread = pthread_self();
+	limitMs = ms;
+	stopping = false;
+	thread = std::thread(watch);
+	log(INFO, "Watchdog", "Dumping the loop's stack when it is busy for over " + std::to_string(ms) + " ms");
+}
+
+void Watchdog::stop()
+{
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	thread.join();
+	limitMs = 0;
+}
+
+void Watchdog::watch()
+{
+	uint64_t						reported = 0;
+	std::unique_lock<std::mutex>	guard(lock);
+
+	while (!wakeup.wait_for(guard, std::chrono::milliseconds(std::max(limitMs / 4, 10u)), [] { return stopping; })) {
+		uint64_t since = busySince.load(std::memory_order_relaxed);
+		if (!since || since == reported || Trace::now() - since < uint64_t(limitMs) * 1000000)
+			continue;
+		reported = since;
+		std::string line = "Watchdog: event loop busy for " + std::to_string((Trace::now() - since) / 1000000)
+			+ " ms, dumping its stack\n";
+		if (write(STDERR_FILENO, line.data(), line.size()) == -1)
+			continue;
+		pthread_kill(loopThread, WATCHDOG_SIGNAL);
+	}
+}
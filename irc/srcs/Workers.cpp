@@ -0,0 +1,103 @@
+#include "../includes/Workers.hpp"
+#include "../includes/Utils.hpp"
+#include "../includes/Trace.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+std::vector<std::thread>				Workers::threads;
+std::mutex								Workers::lock;
+std::condition_variable					Workers::wakeup;
+std::deque<Workers::Item>				Workers::queue;
+std::vector<std::coroutine_handle<>>	Workers::done;
+bool									Workers::stopping = false;
+int										Workers::wake = -1;
+size_t									Workers::inFlight = 0;
+
+void Workers::start(unsigned count)
+{
+	wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake == -1)
+		throw runtime_error("eventfd failed: " + string(strerror(errno)));
+	stopping = false;
+	for (unsigned i = 0; i < count; ++i)
+		threads.emplace_back(worker);
+	log(INFO, "Workers", "Started " + to_string(count) + " worker threads");
+}
+
+// coroutines still waiting for a worker are destroyed without being resumed
+void Workers::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	for (std::thread &thread : threads)
+		thread.join();
+	threads.clear();
+	for (Item &item : queue)
+		item.handle.destroy();
+	for (std::coroutine_handle<> handle : done)
+		handle.destroy();
+	queue.clear();
+	done.clear();
+	inFlight = 0;
+	if (wake != -1)
+		close(wake);
+	wake = -1;
+}
+
+void Workers::submit(std::function<void()> work, std::coroutine_handle<> handle)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back({std::move(work), handle});
+	}
+	inFlight++;
+	wakeup.notify_one();
+}
+
+void Workers::worker()
+{
+	for (;;) {
+		Item		item;
+		uint64_t	one = 1;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wakeup.wait(guard, [] { return stopping || !queue.empty(); });
+			if (stopping)
+				return;
+			item = std::move(queue.front());
+			queue.pop_front();
+		}
+		{
+			Span span("worker");
+			item.work();
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done.push_back(item.handle);
+		}
+		if (write(wake, &one, sizeof(one)) == -1)
+			log(ERROR, "Workers", "eventfd write failed: " + string(strerror(errno)));
+	}
+}
+
+// loop thread, when fd() is readable: resumes the coroutines whose work is done
+void Workers::complete()
+{
+	uint64_t								count;
+	std::vector<std::coroutine_handle<>>	finished;
+
+	if (read(wake, &count, sizeof(count)) == -1 && errno != EAGAIN)
+		log(ERROR, "Workers", "eventfd read failed: " + string(strerror(errno)));
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		finished.swap(done);
+	}
+	for (std::coroutine_handle<> handle : finished) {
+		inFlight--;
+		handle.resume();
+	}
+}
@@ -1,109 +1,108 @@
 #include "Server.hpp"
+#include "Simd.hpp"
 
-int	Server::PING(cmd cmd, User &user) {
+int	Server::PING(const cmd &cmd, User &user) {
 	(void)user;
 	if (cmd.arguments.empty()) {
 		return (ERR_NOORIGIN);
-	} else if (cmd.arguments != this->_name) {
+	} else if (string_view(cmd.arguments) != this->_name) {
 		return (ERR_NOSUCHSERVER);
 	} else {
 		return (RPL_PONG);
 	}
 }
 
-int	Server::PONG(cmd cmd, User &user) {
+int	Server::PONG(const cmd &cmd, User &user) {
 	if (cmd.arguments.empty()) {
 		return (ERR_NOORIGIN);
-	} else if (cmd.arguments != user.getFullIdentifier()) {
+	} else if (string_view(cmd.arguments) != user.getFullIdentifier()) {
 		return (ERR_NOSUCHSERVER);
 	} else {
 		return (0);
 	}
 }
 
-int	Server::PASS(cmd cmd, User &user) {
+int	Server::PASS(const cmd &cmd, User &user) {
 	if (cmd.arguments.empty()) {
 		return (ERR_NEEDMOREPARAMS);
-	} else if (cmd.arguments != this->_password) {
-		return (ERR_PASSWDMISMATCH);
 	} else if (user.getAuth()) {
 		return (ERR_ALREADYREGISTRED);
-	} else {
-		user.setAuth(true);
-		return (0);
+	} else if (string_view(cmd.arguments) != (config.password.empty() ? _password : config.password)) {
+		return (ERR_PASSWDMISMATCH);
 	}
+	if (user.advance(REG_PASS))
+		completeRegistration(user);
+	return (0);
 }
 
-int	Server::NICK(cmd cmd, User &user) {
+int	Server::NICK(const cmd &cmd, User &user) {
 	if (cmd.arguments.empty()) {
 		return (ERR_NONICKNAMEGIVEN);
-	} else if (_nickIsUsed(cmd.arguments)) {
+	}
+	string nick(cmd.arguments);
+	if (_nickIsUsed(nick, user.getFd())) {
 		return (ERR_NICKNAMEINUSE);
-	} 
+	}
 	string oldNick = user.getNickname();
-	if (user.setNickname(cmd.arguments)) {
+	string oldPrefix = user.getFullIdentifier();
+	if (user.setNickname(nick)) {
 		return (ERR_ERRONEUSNICKNAME);
 	}
-	
-	if (user.getNickIsSet()) {
-		IO::sendString(user.getFd(), ":" + oldNick + "!user@host NICK :" + user.getNickname());
-	} else {
-		user.setNickIsSet(true);
-		sendMessage(RPL_WHOISUSER, cmd, user);
-	}
-	
-	if (user.getUserIsSet() && !user.getIsRegistered()) {
-		user.setIsRegistered(true);
-		return (RPL_WELCOME);
+	if (user.getNickIsSet()) { // the placeholder nick of a new connection was never indexed
+		auto old = nickIndex.find(toLowerString(oldNick));
+		if (old != nickIndex.end() && old->second == user.getFd())
+			nickIndex.erase(old);
+		nickPrefixes.erase(oldNick, user.getFd());
 	}
+	indexNick(user.getFd(), user.getNickname());
 
+	if (user.getNickIsSet()) {
+		for (const string &name : user.getChannels())
+			if (Channel *channel = findChannelByName(name))
+				channel->renameUser(user.getFd(), oldNick);
+		IO::sendString(user.getFd(), oldPrefix + " NICK :" + user.getNickname());
+		if (user.getIsRegistered() && toLowerString(oldNick) != toLowerString(user.getNickname())) {
+			notifyWatchers(oldNick, nullptr);
+			notifyWatchers(user.getNickname(), &user);
+		}
+	} else if (user.advance(REG_NICK)) {
+		completeRegistration(user);
+	}
 	return (0);
 }
 
-int	Server::USER(cmd cmd, User &user) {
+int	Server::USER(const cmd &cmd, User &user) {
 	parsedArgs userArgs = parseArgs(cmd.arguments, 4, true);
 
-	if (_userIsUsed(userArgs.args[0])) { // add unique number to end so things will work with irssi.
-		log(DEBUG, "USER", "Username " + userArgs.args[0] + " is taken. Creating unique username...");
-		for (int i = 1;; ++i)
-		{
-			if (!_userIsUsed(userArgs.args[0] + to_string(i))) {
-				userArgs.args[0] += to_string(i);
-				break;
-			}
-		}
-	}
-	
 	if (userArgs.size < 4) {
 		return (ERR_NEEDMOREPARAMS);
-	} else if (user.setUsername(userArgs.args[0])
-		|| user.setHostname(userArgs.args[1])
-		|| user.setServername(userArgs.args[2])
-		|| user.setRealname(userArgs.trailing)) {
+	} else if (user.getUserIsSet()) {
+		return (ERR_ALREADYREGISTRED);
+	}
+	// add unique number to end so things will work with irssi.
+	if (user.setUsername(_uniqueUsername(string(userArgs.args[0])))
+		|| user.setHostname(string(userArgs.args[1]))
+		|| user.setServername(string(userArgs.args[2]))
+		|| user.setRealname(string(userArgs.trailing))) {
 		return ERR_ERRONEUSUSER;
 	}
+	indexUser(user);
 
-	user.setUserIsSet(true);
-	sendMessage(RPL_WHOISUSER, cmd, user);
-
-	if (user.getNickIsSet() && !user.getIsRegistered()) {
-		user.setIsRegistered(true);
-		return (RPL_WELCOME);
-	}
+	if (user.advance(REG_USER))
+		completeRegistration(user);
 	return (0);
 }
 
-int	Server::JOIN(cmd cmd, User &user) {
+int	Server::JOIN(const cmd &cmd, User &user) {
 	if (cmd.arguments.empty()) {
 		return (ERR_NEEDMOREPARAMS);
 	} else if (cmd.arguments == "0") {
 		partAll(user, "");
 		return (0);
 	}
-	parsedArgs 		joinArgs = parseArgs(cmd.arguments, 2, false);
-	vector<string>	channels, keys;
+	parsedArgs 						joinArgs = parseArgs(cmd.arguments, 2, false);
+	std::pmr::vector<string_view>	channels = commaSplit(joinArgs.args[0]), keys(Arena::get());
 
-	channels = commaSplit(joinArgs.args[0]);
 	if (joinArgs.size == 2) {
 		keys = commaSplit(joinArgs.args[1]);
 	}
@@ -117,20 +116,23 @@ int	Server::JOIN(cmd cmd, User &user) {
 	for (size_t index = 0; index < channelSize; ++index) {
 		int		code = 0;
 		Channel *channel;
+		string	name(channels[index]);
 
-		if (!isValidChannelName(channels[index])) {
+		if (!isValidChannelName(name)) {
 			code = ERR_BADCHANMASK;
 		} else {
-			string keyValue = (index < keySize) ? keys[index] : "";
-			channel = this->findChannelByName(channels[index]);
-			code = (channel == nullptr) ? 
-					createChannel(channel, user, channels[index], keyValue) :
-					user.join(*channel, keyValue);
+			string keyValue(index < keySize ? keys[index] : "");
+			channel = this->findChannelByName(name);
+			if (channel == nullptr) {
+				code = createChannel(channel, user, name, keyValue);
+			} else if (!(code = user.join(*channel, keyValue))) {
+				channelChanged(name);
+			}
 		}
 
 		if (code) {
-			cmd.arguments = channels[index];
-			return (code);
+			sendMessage(code, cmd.with(name), user);
+			return (0);
 		}
 		sendMessage(RPL_TOPIC, cmd, user, *channel);
 		sendMessage(RPL_NAMREPLY, cmd, user, *channel);
@@ -139,76 +141,84 @@ int	Server::JOIN(cmd cmd, User &user) {
 	return (0);
 }
 
-int	Server::PRIVMSG(cmd cmd, User &user) {
+int	Server::PRIVMSG(const cmd &cmd, User &user) {
+	return (relay(cmd, user, false));
+}
+
+int	Server::NOTICE(const cmd &cmd, User &user) {
+	return (relay(cmd, user, true));
+}
+
+/*
+PRIVMSG and NOTICE to a comma separated list of up to config.targMax nicks and
+channels. Every distinct target gets the line once; a failing target
+gets its own error reply (never for NOTICE) and the others still go out.
+*/
+int	Server::relay(const cmd &cmd, User &user, bool notice) {
 	if (cmd.arguments.empty()) {
-		return (ERR_NORECIPIENT);
+		return (notice ? 0 : ERR_NORECIPIENT);
 	}
 
 	parsedArgs priArgs = parseArgs(cmd.arguments, 2, true);
 	if (priArgs.size < 2) {
-		return (ERR_NOTEXTTOSEND);
-	}
-
-	string target = priArgs.args[0];
-	cmd.arguments = target;
-	if (target.find(',') != string::npos) {
-		return (ERR_TOOMANYTARGETS);
-	} else if (targetIsUser(target[0])) {
-		string nickName;
-		size_t pos = target.find('!');
-		if (pos != string::npos) {
-			nickName = target.substr(0, pos);
-		} else {
-			nickName = target;
-		}
-		User *targetUser = findUserByNickName(nickName);
-		if (targetUser == nullptr) {
-			return (ERR_NOSUCHNICK);
-		} else {
-			return(user.privmsg(*targetUser, priArgs.trailing));
-		}
-	} else {
-		Channel *targetChannel = findChannelByName(target);
+		return (notice ? 0 : ERR_NOTEXTTOSEND);
+	}
 
-		if (targetChannel == nullptr) {
-			return (ERR_NOSUCHNICK);
+	std::pmr::vector<string_view> targets = commaSplit(priArgs.args[0]);
+
+	if (targets.size() > config.targMax) {
+		if (!notice)
+			sendMessage(ERR_TOOMANYTARGETS, cmd.with(priArgs.args[0]), user);
+		return (0);
+	}
+	for (size_t i = 0; i < targets.size(); ++i) {
+		string_view target = targets[i];
+		// at most targMax of them, so looking back beats hashing every one
+		if (target.empty() || any_of(targets.begin(), targets.begin() + i,
+				[&](string_view earlier) { return compareIgnoreCase(earlier, target); }))
+			continue;
+		int code;
+		if (targetIsUser(target[0])) {
+			User *targetUser = findUserByNickName(string(target.substr(0, target.find('!'))));
+			code = targetUser ? user.privmsg(*targetUser, priArgs.trailing, cmd.command) : ERR_NOSUCHNICK;
 		} else {
-			return (user.privmsg(*targetChannel, priArgs.trailing));
+			Channel *targetChannel = findChannelByName(string(target));
+			code = targetChannel ? user.privmsg(*targetChannel, priArgs.trailing, cmd.command) : ERR_NOSUCHNICK;
 		}
+		if (code > 0 && !notice)
+			sendMessage(code, cmd.with(target), user);
 	}
+	return (0);
 }
 
 void Server::partAll(User &user, const string &message)
 {
-	for (auto it = channels.begin(); it != channels.end(); )
+	vector<Channel *> joined;
+
+	// collected first: part() changes the user's list and channelChanged may erase from the table
+	for (const string &name : user.getChannels())
+		if (Channel *channel = findChannelByName(name))
+			joined.push_back(channel);
+	for (Channel *c : joined)
 	{
-		Channel &c = it->second;
-		auto u = c.findUser(user.getFd());
-		if (u != std::nullopt)
-		{
-			log(DEBUG, "partAll", "User parted channel");
-			user.part(c, (message.empty() ? user.getNickname() + " left" : message));
-			if (c.getUserList().empty())
-			{
-				log(DEBUG, "Server::partAll", "Channel erased: " + c.getChannelName());
-				it = channels.erase(it);
-				continue;
-			}
-		}
-		it++;
+		log(DEBUG, "partAll", "User parted channel");
+		user.part(*c, (message.empty() ? user.getNickname() + " left" : message));
+		channelChanged(c->getChannelName());
 	}
 }
 
-int	Server::QUIT(cmd cmd, User &user) {
-	string message = cmd.arguments.empty() ? 
-		user.getNickname() + " quit" : 
-		cmd.arguments;
-	partAll(user, cmd.arguments);
+int	Server::QUIT(const cmd &cmd, User &user) {
+	string_view reason = cmd.arguments;
+	if (!reason.empty() && reason[0] == ':')
+		reason.remove_prefix(1);
+	// UTF8ONLY: a reason that is not UTF-8 is dropped, the client still quits
+	string message(Simd::validUtf8(reason) ? reason : "");
+	partAll(user, message);
 	Server::removeUser(user.getFd());
 	return 0;
 }
 
-int	Server::PART(cmd cmd, User &user) {
+int	Server::PART(const cmd &cmd, User &user) {
 	if (cmd.arguments.empty()) {
 		return (ERR_NEEDMOREPARAMS);
 	}
@@ -221,10 +231,10 @@ int	Server::PART(cmd cmd, User &user) {
 		message += partArgs.trailing;
 	}
 
-	vector<string> channelList = commaSplit(partArgs.args[0]);
+	std::pmr::vector<string_view> channelList = commaSplit(partArgs.args[0]);
 
 	for (size_t index = 0; index < channelList.size(); index++) {
-		string channelName = channelList[index];
+		string channelName(channelList[index]);
 		if (channelName.empty())
 			continue;
 		Channel *channel = this->findChannelByName(channelName);
@@ -236,21 +246,17 @@ int	Server::PART(cmd cmd, User &user) {
 			cerr << "Sending messages failes" <<endl;
 			return (-1);
 		}
-		if (channel->getUserList().empty())
-		{
-			log(DEBUG, "Server::partAll", "Channel erased: " + channel->getChannelName());
-			channels.erase(channel->getChannelName());
-		}
+		channelChanged(channelName);
 	}
 	return 0;
 }
 
-int	Server::WHOIS(cmd cmd, User &user) {
+int	Server::WHOIS(const cmd &cmd, User &user) {
 	if (cmd.arguments.empty()) {
 		return (ERR_NONICKNAMEGIVEN);
 	}
 	parsedArgs	whoArgs = parseArgs(cmd.arguments, 1, false);
-	string		target = whoArgs.args[0];
+	string		target(whoArgs.args[0]);
 
 	if (targetIsUser(target[0])) {
 		User *targetUser = findUserByNickName(target);
@@ -258,11 +264,262 @@ int	Server::WHOIS(cmd cmd, User &user) {
 		if (targetUser == nullptr) {
 			return (ERR_NOSUCHNICK);
 		} else {
-			cmd.arguments = targetUser->getNickname() + " " + targetUser->getUsername() + " " + targetUser->getHostname() + " * :" + targetUser->getRealname();
-			sendMessage(RPL_WHOISUSER, cmd, user);
+			sendMessage(RPL_WHOISUSER, cmd.with(targetUser->getNickname() + " " + targetUser->getUsername() + " "
+				+ targetUser->getHostname() + " * :" + targetUser->getRealname()), user);
+			if (!targetUser->getAccount().empty()) {
+				sendMessage(RPL_WHOISACCOUNT, cmd.with(targetUser->getNickname() + " " + targetUser->getAccount()
+					+ " :is logged in as"), user);
+			}
 			return (0);
 		}
 	}
 	return (0);
 }
 
+
+#define WHO_PAGE 100			// replies queued per event loop iteration
+#define LIST_SENDQ (16 << 10)	// no further page of LIST or WHO while this much is still queued
+
+string	Server::whoReply(const User &user, const User &target, const string &channel, bool isOp) {
+	return ":" + _name + " 352 " + user.getNickname() + " " + channel + " " + target.getUsername()
+		+ " " + target.getHostname() + " " + _name + " " + target.getNickname()
+		+ (isOp ? " H@" : " H") + " :0 " + target.getRealname() + "\r\n";
+}
+
+/*
+Registered users matching a WHO mask. A nick!user@host mask is matched
+part by part, anything else against nick, username and host. Candidates
+come from the prefix index of the part with the longest literal prefix;
+only masks starting with a wildcard scan every user.
+*/
+vector<const User *>	Server::whoMatches(const string &pattern) {
+	vector<const User *>	found;
+	size_t					bang = pattern.find('!'), at = pattern.find('@');
+	Mask					nick, name, host;
+	const PrefixIndex		*index = nullptr;
+	string					prefix;
+
+	if (bang == string::npos && at == string::npos) {
+		nick = name = host = Mask(pattern);
+	} else {
+		size_t nameStart = (bang != string::npos) ? bang + 1 : 0;
+		nick = Mask(bang != string::npos ? pattern.substr(0, bang) : "*");
+		name = Mask(pattern.substr(nameStart, (at != string::npos ? at : pattern.size()) - nameStart));
+		host = Mask(at != string::npos ? pattern.substr(at + 1) : "*");
+	}
+	bool anyPart = (bang == string::npos && at == string::npos);
+	auto matches = [&](const User &u) {
+		if (!u.getIsRegistered())
+			return false;
+		if (anyPart)
+			return nick.matches(u.getNickname()) || name.matches(u.getUsername()) || host.matches(u.getHostname());
+		return nick.matches(u.getNickname()) && name.matches(u.getUsername()) && host.matches(u.getHostname());
+	};
+
+	if (!anyPart) {
+		const pair<const Mask *, const PrefixIndex *> parts[] = {
+			{&nick, &nickPrefixes}, {&name, &userPrefixes}, {&host, &hostPrefixes}};
+		for (const auto &[mask, tree] : parts) {
+			if (mask->literalPrefix().size() > prefix.size()) {
+				prefix = mask->literalPrefix();
+				index = tree;
+			}
+		}
+		if (index) {
+			index->scan(prefix, [&](int fd) {
+				if (matches(users.at(fd)))
+					found.push_back(&users.at(fd));
+			});
+			return found;
+		}
+	} else if (!nick.literalPrefix().empty()) {
+		set<int> seen;
+		for (const PrefixIndex *tree : {&nickPrefixes, &userPrefixes, &hostPrefixes})
+			tree->scan(nick.literalPrefix(), [&](int fd) {
+				if (seen.insert(fd).second && matches(users.at(fd)))
+					found.push_back(&users.at(fd));
+			});
+		return found;
+	}
+	for (const auto &[fd, u] : users)
+		if (matches(u))
+			found.push_back(&u);
+	return found;
+}
+
+/*
+WHO <mask> [o]: the matches are collected at once, the replies paged
+out like LIST, WHO_PAGE per loop iteration while the client keeps up,
+so WHO * on a big server does not overflow the asker's SendQ. Whoever
+quits or leaves the channel meanwhile is skipped.
+*/
+int	Server::WHO(const cmd &cmd, User &user) {
+	parsedArgs	whoArgs = parseArgs(cmd.arguments, 2, false);
+	bool		opersOnly = (whoArgs.size == 2 && whoArgs.args[1] == "o");
+	int			fd = user.getFd();
+	WhoQuery	query;
+
+	query.mask = whoArgs.args.empty() ? "*" : string(whoArgs.args[0]);
+	if (!targetIsUser(query.mask[0])) {
+		Channel *channel = findChannelByName(query.mask);
+		if (channel != nullptr) {
+			query.channel = channel->getChannelName();
+			for (const auto &[memberFd, member] : channel->getUserList())
+				if (!opersOnly || member->getIsOperator())
+					query.targets.push_back(memberFd);
+		}
+	} else {
+		for (const User *target : whoMatches(query.mask))
+			if (!opersOnly || target->getIsOperator())
+				query.targets.push_back(target->getFd());
+	}
+	pendingWhos[fd] = std::move(query);
+	if (IO::connection(fd).labeled) {
+		while (pendingWhos.count(fd))
+			continueWho(fd);
+	} else {
+		continueWho(fd);
+	}
+	return (0);
+}
+
+void	Server::continueWho(int fd) {
+	if (IO::queued(fd) >= LIST_SENDQ && !IO::connection(fd).labeled)
+		return;
+	WhoQuery	&query = pendingWhos.at(fd);
+	const User	&user = users.at(fd);
+	Channel		*channel = query.channel.empty() ? nullptr : findChannelByName(query.channel);
+	string		chunk;
+
+	for (size_t sent = 0; sent < WHO_PAGE && query.next < query.targets.size(); ++query.next) {
+		auto target = users.find(query.targets[query.next]);
+		if (target == users.end())
+			continue;
+		if (query.channel.empty())
+			chunk += whoReply(user, target->second, "*", false);
+		else if (channel && channel->findUser(target->first))
+			chunk += whoReply(user, target->second, query.channel, channel->isOperator(target->second));
+		else
+			continue;
+		sent++;
+	}
+	if (query.next == query.targets.size()) {
+		chunk += ":" + _name + " 315 " + user.getNickname() + " " + query.mask + " :End of WHO list\r\n";
+		pendingWhos.erase(fd);
+	}
+	if (!chunk.empty())
+		IO::sendString(fd, chunk);
+}
+
+#define LIST_PAGE 100			// channels visited per event loop iteration
+
+/*
+LIST [conditions]: the reply is paged out of the channel directory a
+few channels per loop iteration, and only while the client keeps up
+with reading, so a full listing never stalls the other clients. Inside a labeled response it is sent at once instead,
+since the batch has to be closed when the command returns.
+*/
+int	Server::LIST(const cmd &cmd, User &user) {
+	parsedArgs	listArgs = parseArgs(cmd.arguments, 1, false);
+	ListQuery	query;
+	int			fd = user.getFd();
+
+	IO::sendString(fd, ":" + _name + " 321 " + user.getNickname() + " Channel :Users  Name");
+	if (listArgs.size == 1 && !query.parse(string(listArgs.args[0]))) {
+		IO::sendString(fd, ":" + _name + " 323 " + user.getNickname() + " :End of /LIST");
+		return (0);
+	}
+	pendingLists[fd] = query;
+	if (IO::connection(fd).labeled) {
+		while (pendingLists.count(fd))
+			continueList(fd);
+	} else {
+		continueList(fd);
+	}
+	return (0);
+}
+
+// a pending listing can go on once its client has read most of the last pages
+bool	Server::listsReady() {
+	for (const auto &[fd, query] : pendingLists)
+		if (IO::queued(fd) < LIST_SENDQ)
+			return true;
+	for (const auto &[fd, query] : pendingWhos)
+		if (IO::queued(fd) < LIST_SENDQ)
+			return true;
+	return false;
+}
+
+void	Server::continueList(int fd) {
+	if (IO::queued(fd) >= LIST_SENDQ && !IO::connection(fd).labeled)
+		return;
+	ListQuery	&query = pendingLists.at(fd);
+	const User	&user = users.at(fd);
+	string		chunk;
+
+	bool done = directory.page(query, LIST_PAGE, [&](const Channel &channel, size_t count) {
+		chunk += ":" + _name + " 322 " + user.getNickname() + " " + channel.getChannelName()
+			+ " " + to_string(count) + " :" + channel.getChannelTopic() + "\r\n";
+	});
+	if (done) {
+		chunk += ":" + _name + " 323 " + user.getNickname() + " :End of /LIST\r\n";
+		pendingLists.erase(fd);
+	}
+	if (!chunk.empty())
+		IO::sendString(fd, chunk);
+}
+
+// OPER <name> <password>: any name, the password is oper_password from the config
+int	Server::OPER(const cmd &cmd, User &user) {
+	parsedArgs		operArgs = parseArgs(cmd.arguments, 2, false);
+	const string	&password = config.operPassword;
+
+	if (operArgs.size < 2) {
+		return (ERR_NEEDMOREPARAMS);
+	} else if (password.empty()) {
+		return (ERR_NOOPERHOST);
+	} else if (operArgs.args[1] != password) {
+		return (ERR_PASSWDMISMATCH);
+	}
+	user.setIsOperator(true);
+	IO::sendString(user.getFd(), ":" + _name + " 381 " + user.getNickname() + " :You are now an IRC operator");
+	log(INFO, "OPER", user.getNickname() + " is now an operator (" + string(operArgs.args[0]) + ")");
+	return (0);
+}
+
+/*
+STATS z: send and receive queue usage; STATS s: event loop timing and
+the slow command log, newest first. Both for operators.
+*/
+int	Server::STATS(const cmd &cmd, User &user) {
+	parsedArgs	statsArgs = parseArgs(cmd.arguments, 1, false);
+	string		query(statsArgs.size ? statsArgs.args[0] : "");
+	string		head = ":" + _name + " 249 " + user.getNickname() + " " + query + " :";
+	string		reply;
+
+	if ((query == "z" || query == "s") && !user.getIsOperator()) {
+		return (ERR_NOPRIVILEGES);
+	}
+	if (query == "s") {
+		time_t now = time(nullptr);
+		reply += head + "Loop " + to_string(loopStats.iterations) + " iterations, " + to_string(loopStats.slow)
+			+ " over " + to_string(config.slowLoop) + " ms, longest " + to_string(loopStats.longest / 1000) + " us, "
+			+ to_string(Arena::spills) + " arena spills\r\n";
+		for (auto it = slowLog.rbegin(); it != slowLog.rend(); ++it)
+			reply += head + to_string(it->duration / 1000) + " us " + to_string(now - it->at) + "s ago "
+				+ it->nick + ": " + it->command + " " + it->arguments + " (" + to_string(it->fanout) + " messages)\r\n";
+	}
+	if (query == "z") {
+		QueueStats		q = IO::stats();
+		const IOLimits	&limits = IO::getLimits();
+		reply += head + "RecvQ " + to_string(q.recvQ) + " bytes (limit "
+			+ to_string(limits.recvQ) + " per client)\r\n";
+		reply += head + "SendQ " + to_string(q.sendQ) + " bytes, largest " + to_string(q.largestSendQ)
+			+ " (limit " + to_string(limits.sendQ) + " per client)\r\n";
+		reply += head + "Queues " + to_string(q.recvQ + q.sendQ) + " of " + to_string(limits.queues)
+			+ " bytes, " + to_string(users.size()) + " clients, " + to_string(q.evicted) + " dropped\r\n";
+	}
+	IO::sendString(user.getFd(), reply + ":" + _name + " 219 " + user.getNickname() + " "
+		+ (query.empty() ? "*" : query) + " :End of STATS report");
+	return (0);
+}
@@ -3,15 +3,7 @@
 
 using namespace std;
 
-bool isValidPassword(const string& s) {
-	if (s.empty())
-		return false;
-	// Regex: only a-z, A-Z, 0-9, and 3 to 20 letters
-	std::regex pattern("^[a-zA-Z0-9]{3,20}$");
-	return std::regex_match(s, pattern);
-}
-
-void validate_args(int ac, char **av) {
+void validate_args(int ac, char **av, const Config &config) {
 
 	if (ac != 3) {
 		cerr << "Error: invalid arguments!" << endl;
@@ -19,9 +11,9 @@ void validate_args(int ac, char **av) {
 		exit (EXIT_FAILURE);
 	}
 	int port = atoi(av[1]);
-	if ((port < 6660 || port > 6669) && port != 6697) {
+	if ((port < config.portMin || port > config.portMax) && port != TLS_PORT) {
 		cerr << "Error: invalid port!" << endl;
-		cerr << "Usage: valid port range: 6660-6669 or 6697" << endl;
+		cerr << "Usage: valid port range: " << config.portMin << "-" << config.portMax << " or " << TLS_PORT << endl;
 		exit (EXIT_FAILURE);
 	}
 	if (!isValidPassword(av[2])) {
@@ -31,9 +23,23 @@ void validate_args(int ac, char **av) {
 }
 
 int main(int ac, char **av) {
-	validate_args(ac, av);
+	Config config;
+
+	try {
+		config = Config::load(getenv("IRCSERV_CONFIG"));
+	} catch (const exception &e) {
+		cerr << "Error: " << e.what() << endl;
+		return (EXIT_FAILURE);
+	}
+	validate_args(ac, av, config);
 	try {
-		Server server(av[1], av[2]);
+		int upgradeFd = Server::upgradeFdFromEnv();
+		if (upgradeFd != -1) {
+			Server server(av[1], av[2], config, upgradeFd);
+			server.start();
+			return 0;
+		}
+		Server server(av[1], av[2], config);
 		server.start();
 	} catch (const exception &e) {
 		cerr << "Error: " << e.what() << endl;
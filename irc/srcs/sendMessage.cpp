@@ -1,6 +1,6 @@
 #include "../includes/Server.hpp"
 
-string	Server::createMessage(int code, cmd cmd, User &user) {
+string	Server::createMessage(int code, const cmd &cmd, User &user) {
 	string message;
 
 	message = ":" + this->_name + " ";
@@ -9,9 +9,7 @@ string	Server::createMessage(int code, cmd cmd, User &user) {
 	}
 	message += to_string(code) + " " + user.getNickname() + " ";
 	
-	if (code == RPL_WELCOME) {
-		message += ":Welcome to the Internet Relay Network " + user.getFullIdentifier();
-	} else if (code == ERR_NEEDMOREPARAMS) {
+	if (code == ERR_NEEDMOREPARAMS) {
 		message += cmd.command + " :Not enough parameters";
 	} else if (code == ERR_PASSWDMISMATCH) {
 		message += ":Password incorrect";
@@ -39,6 +37,8 @@ string	Server::createMessage(int code, cmd cmd, User &user) {
 		message += cmd.arguments + " :No such server";
 	} else if (code == ERR_INVITEONLYCHAN) {
 		message += cmd.arguments + " :Cannot join channel (+i)";
+	} else if (code == ERR_BANNEDFROMCHAN) {
+		message += cmd.arguments + " :Cannot join channel (+b)";
 	} else if (code == ERR_CHANNELISFULL) {
 		message += cmd.arguments + " :Cannot join channel (+l)";
 	} else if (code == ERR_BADCHANNELKEY) {
@@ -65,12 +65,32 @@ string	Server::createMessage(int code, cmd cmd, User &user) {
 		message += cmd.arguments + " :Cannot send to channel"; 
 	} else if (code == ERR_TOOMANYTARGETS) {
 		message += cmd.arguments + " :Too many targets";
-	} else if (code == RPL_WHOISUSER) {
+	} else if (code == RPL_WHOISUSER || code == RPL_WHOISACCOUNT || code == RPL_LOGGEDIN) {
 		message += cmd.arguments;
+	} else if (code == RPL_SASLSUCCESS) {
+		message += ":SASL authentication successful";
+	} else if (code == RPL_SASLMECHS) {
+		message += "PLAIN :are available SASL mechanisms";
+	} else if (code == ERR_SASLFAIL) {
+		message += ":SASL authentication failed";
+	} else if (code == ERR_SASLTOOLONG) {
+		message += ":SASL message too long";
+	} else if (code == ERR_SASLABORTED) {
+		message += ":SASL authentication aborted";
+	} else if (code == ERR_SASLALREADY) {
+		message += ":You have already authenticated using SASL";
 	} else if (code == RPL_PONG) {
 		message = ":" + this->_name + " PONG "+ this->_name;
+	} else if (code == ERR_INVALIDCAPCMD) {
+		message += cmd.arguments + " :Invalid CAP command";
+	} else if (code == ERR_NOOPERHOST) {
+		message += ":No O-lines for your host";
+	} else if (code == ERR_NOPRIVILEGES) {
+		message += ":Permission Denied- You're not an IRC operator";
 	} else if (code == ERR_ERRONEUSUSER) {
 		message += cmd.arguments + " :Erroneous format";
+	} else if (code == ERR_UMODEUNKNOWNFLAG) {
+		message += ":Unknown MODE flag";
 	//last
 	} else {
 		message += cmd.command + " " + cmd.arguments;
@@ -80,7 +100,7 @@ string	Server::createMessage(int code, cmd cmd, User &user) {
 	return (message);
 }
 
-void Server::sendMessage(int code, cmd cmd, User &user) {
+void Server::sendMessage(int code, const cmd &cmd, User &user) {
 	if (!code)
 		return ;
 	string message = createMessage(code, cmd, user);
@@ -88,7 +108,7 @@ void Server::sendMessage(int code, cmd cmd, User &user) {
 		cerr << "send() error: " << strerror(errno) << endl;
 }
 
-std::string Server::createMessage(int code, cmd cmd, User &user, Channel &channel) {
+std::string Server::createMessage(int code, const cmd &cmd, User &user, Channel &channel) {
     std::string message;
 
     (void)cmd;
@@ -97,20 +117,21 @@ std::string Server::createMessage(int code, cmd cmd, User &user, Channel &channe
     if (code == RPL_TOPIC) {
         message += channel.getChannelName() + " :" + channel.getChannelTopic();
     } else if (code == RPL_NAMREPLY) {
-        message += "= " + channel.getChannelName() + " :";
-        for (auto &it : channel.getUserList()) {
-            bool isOp = channel.getOperators().count(it.second->getFd()) > 0; 
-            message += (isOp) ? "@" : "";
-            message += it.second->getNickname() + " ";
-        }
-        if (!message.empty() && message.back() == ' ')
-            message.pop_back();
+        std::string header = message + "= " + channel.getChannelName() + " :";
+        message.clear();
+        for (const std::string &chunk : channel.getNamesChunks())
+            if (!chunk.empty())
+                message += header + chunk + "\r\n";
+        if (message.empty())
+            message = header;
+        else
+            message.resize(message.size() - 2);
     }
     message += "\r\n";
     return message;
 }
 
-void Server::sendMessage(int code, cmd cmd, User &user, Channel &channel) {
+void Server::sendMessage(int code, const cmd &cmd, User &user, Channel &channel) {
 	if (!code)
 		return ;
 	string message = createMessage(code, cmd, user, channel);
@@ -0,0 +1,416 @@
+/*
+ircbench - load generator for ircserv.
+
+	./ircbench [-H host] [-p port] [-w password] [-n clients] [-t timeout] [-m messages]
+	           [-P server pid] [-j channels] [-b bytes] [-s seconds]
+
+register: opens all clients at once (a reconnect storm), sends
+PASS/NICK/USER on each and waits for 001. Reports registrations/sec
+and registration latency percentiles.
+
+-m: once registered, every client also sends itself that many PRIVMSGs
+in one write and waits until all have come back. Reports delivered
+messages/sec over the whole messaging phase.
+
+-P: idle memory. Reads the server's resident set (/proc/<pid>/status)
+before connecting and again once every client is registered and has
+joined its channels, and reports the growth per idle client. -j makes
+every client join that many channels of IDLE_CHANNEL_SIZE members, -b
+fails the run when a client costs more than that many bytes. The server
+has to run on the same host.
+
+Large runs over loopback spread the clients over several source addresses
+(127.0.0.1, 127.0.0.2, ...) since one address only has ~28k ephemeral ports.
+*/
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+#define PORTS_PER_SOURCE 20000
+#define IDLE_CHANNEL_SIZE 50
+
+struct Options {
+	string	host = "127.0.0.1";
+	int		port = 6667;
+	string	password = "pass123";
+	size_t	clients = 1000;
+	int		timeout = 60;
+	size_t	messages = 0;
+	pid_t	server = 0;
+	size_t	channels = 0;
+	size_t	budget = 0;
+	int		soak = 0;
+};
+
+enum State { CONNECTING, REGISTERING, MESSAGING, JOINING, REGISTERED, FAILED };
+
+struct Client {
+	int					fd = -1;
+	State				state = CONNECTING;
+	string				in;
+	Clock::time_point	start;
+	double				latency = 0;
+	size_t				received = 0;
+};
+
+static void usage() {
+	cerr << "Usage: ./ircbench [-H host] [-p port] [-w password] [-n clients] [-t timeout] [-m messages]"
+		" [-P server pid] [-j channels] [-b bytes] [-s seconds]" << endl;
+	exit(EXIT_FAILURE);
+}
+
+static Options parseOptions(int ac, char **av) {
+	Options opt;
+
+	for (int i = 1; i < ac; ++i) {
+		string flag = av[i];
+		if (i + 1 >= ac)
+			usage();
+		string value = av[++i];
+		if (flag == "-H")
+			opt.host = value;
+		else if (flag == "-p")
+			opt.port = stoi(value);
+		else if (flag == "-w")
+			opt.password = value;
+		else if (flag == "-n")
+			opt.clients = stoul(value);
+		else if (flag == "-t")
+			opt.timeout = stoi(value);
+		else if (flag == "-m")
+			opt.messages = stoul(value);
+		else if (flag == "-P")
+			opt.server = stoi(value);
+		else if (flag == "-j")
+			opt.channels = stoul(value);
+		else if (flag == "-b")
+			opt.budget = stoul(value);
+		else if (flag == "-s")
+			opt.soak = stoi(value);
+		else
+			usage();
+	}
+	return opt;
+}
+
+static void raiseFdLimit(size_t wanted) {
+	rlimit rl;
+
+	getrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur >= wanted)
+		return;
+	rl.rlim_cur = min<rlim_t>(wanted, rl.rlim_max);
+	setrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur < wanted)
+		cerr << "warning: fd limit is " << rl.rlim_cur << ", not all clients can connect" << endl;
+}
+
+// VmRSS of a process in bytes, 0 if it cannot be read
+static size_t residentBytes(pid_t pid) {
+	ifstream	status("/proc/" + to_string(pid) + "/status");
+	string		key;
+	size_t		kib;
+
+	while (status >> key) {
+		if (key == "VmRSS:" && status >> kib)
+			return kib * 1024;
+		status.ignore(1024, '\n');
+	}
+	return 0;
+}
+
+// channel j of client i: clients fill them IDLE_CHANNEL_SIZE at a time
+static string joinChannels(size_t index, size_t count) {
+	string join = "JOIN ";
+
+	for (size_t j = 0; j < count; ++j)
+		join += (j ? ",#idle" : "#idle") + to_string(j) + "_" + to_string(index / IDLE_CHANNEL_SIZE);
+	return join + "\r\n";
+}
+
+static int openClient(const Options &opt, size_t index) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+
+	if (opt.host.rfind("127.", 0) == 0 && opt.clients > PORTS_PER_SOURCE) {
+		sockaddr_in source{};
+		source.sin_family = AF_INET;
+		source.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index / PORTS_PER_SOURCE);
+		bind(fd, (sockaddr *)&source, sizeof(source));
+	}
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// complete lines containing what, removed from in
+static size_t countLines(string &in, const char *what) {
+	size_t count = 0, start = 0, end;
+
+	while ((end = in.find('\n', start)) != string::npos) {
+		if (string_view(in).substr(start, end - start).find(what) != string_view::npos)
+			++count;
+		start = end + 1;
+	}
+	in.erase(0, start);
+	return count;
+}
+
+// all messages at once; the replies stay well under the server's SendQ limit
+static bool sendMessages(Client &c, size_t index, size_t count) {
+	string nick = "b" + to_string(index);
+	string out;
+
+	for (size_t m = 0; m < count; ++m)
+		out += "PRIVMSG " + nick + " :benchmark message " + to_string(m) + "\r\n";
+	for (size_t off = 0; off < out.size(); ) {
+		ssize_t n = send(c.fd, out.data() + off, out.size() - off, MSG_NOSIGNAL);
+		if (n < 0 && errno == EAGAIN) {
+			usleep(100);
+			continue;
+		}
+		if (n <= 0)
+			return false;
+		off += n;
+	}
+	return true;
+}
+
+// writes the whole line, false if the connection is gone
+static bool sendLine(const Client &c, const string &line) {
+	return send(c.fd, line.data(), line.size(), MSG_NOSIGNAL) == (ssize_t)line.size();
+}
+
+/*
+Holds the registered clients for opt.soak seconds, answering PINGs, then
+pings each one (PING has to name the server). Returns how many answered
+before the timeout.
+*/
+static size_t soak(const Options &opt, vector<Client> &clients, int ep, const string &server) {
+	vector<epoll_event>	events(1024);
+	char				buf[4096];
+	Clock::time_point	until = Clock::now() + chrono::seconds(opt.soak);
+	bool				checking = false;
+	size_t				waiting = 0, alive = 0;
+
+	for (;;) {
+		if (!checking && Clock::now() >= until) {
+			for (Client &c : clients) {
+				c.received = 0;
+				if (c.state == REGISTERED && sendLine(c, "PING " + server + "\r\n"))
+					++waiting;
+			}
+			checking = true;
+			until = Clock::now() + chrono::seconds(opt.timeout);
+		}
+		if (checking && (waiting == 0 || Clock::now() >= until))
+			return alive;
+		int n = epoll_wait(ep, events.data(), events.size(), 100);
+		for (int e = 0; e < n; ++e) {
+			Client &c = clients[events[e].data.u64];
+			if (c.state != REGISTERED)
+				continue;
+			ssize_t got = recv(c.fd, buf, sizeof(buf), 0);
+			if (got <= 0) {
+				c.state = FAILED;
+				epoll_ctl(ep, EPOLL_CTL_DEL, c.fd, nullptr);
+				waiting -= checking && !c.received;
+				continue;
+			}
+			c.in.append(buf, got);
+			for (size_t end; (end = c.in.find('\n')) != string::npos; c.in.erase(0, end + 1)) {
+				string_view line = string_view(c.in).substr(0, end);
+				if (line.substr(0, 5) == "PING ")
+					sendLine(c, "PONG " + string(line.substr(5)) + "\n");
+				else if (checking && !c.received && line.find(" PONG ") != string_view::npos) {
+					c.received = 1;
+					--waiting;
+					++alive;
+				}
+			}
+		}
+	}
+}
+
+static double percentile(vector<double> &values, double p) {
+	if (values.empty())
+		return 0;
+	size_t at = min(values.size() - 1, (size_t)(p * values.size()));
+	nth_element(values.begin(), values.begin() + at, values.end());
+	return values[at];
+}
+
+int main(int ac, char **av) {
+	Options			opt = parseOptions(ac, av);
+	vector<Client>	clients(opt.clients);
+	int				ep = epoll_create1(EPOLL_CLOEXEC);
+	size_t			pending = opt.clients;
+
+	raiseFdLimit(opt.clients + 64);
+	size_t residentBefore = opt.server ? residentBytes(opt.server) : 0;
+	if (opt.server && !residentBefore) {
+		cerr << "cannot read the resident set of process " << opt.server << endl;
+		return EXIT_FAILURE;
+	}
+	Clock::time_point begin = Clock::now();
+	for (size_t i = 0; i < clients.size(); ++i) {
+		clients[i].start = Clock::now();
+		clients[i].fd = openClient(opt, i);
+		if (clients[i].fd == -1) {
+			clients[i].state = FAILED;
+			--pending;
+			continue;
+		}
+		epoll_event ev = {EPOLLOUT | EPOLLIN, {.u64 = i}};
+		epoll_ctl(ep, EPOLL_CTL_ADD, clients[i].fd, &ev);
+	}
+
+	vector<epoll_event> events(1024);
+	Clock::time_point deadline = begin + chrono::seconds(opt.timeout);
+	char buf[4096];
+	Clock::time_point messagingBegin, messagingEnd;
+	string server; // its name, from the first 001
+	while (pending > 0 && Clock::now() < deadline) {
+		int n = epoll_wait(ep, events.data(), events.size(), 100);
+		for (int e = 0; e < n; ++e) {
+			size_t	i = events[e].data.u64;
+			Client	&c = clients[i];
+
+			if (c.state == CONNECTING && (events[e].events & EPOLLOUT)) {
+				string nick = "b" + to_string(i);
+				string reg = "PASS " + opt.password + "\r\nNICK " + nick
+					+ "\r\nUSER " + nick + " bench localhost :ircbench\r\n";
+				epoll_event ev = {EPOLLIN, {.u64 = i}};
+				epoll_ctl(ep, EPOLL_CTL_MOD, c.fd, &ev);
+				if (send(c.fd, reg.data(), reg.size(), MSG_NOSIGNAL) != (ssize_t)reg.size()) {
+					c.state = FAILED;
+					--pending;
+					continue;
+				}
+				c.state = REGISTERING;
+			}
+			if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				|| (c.state != REGISTERING && c.state != MESSAGING && c.state != JOINING))
+				continue;
+			ssize_t got = recv(c.fd, buf, sizeof(buf), 0);
+			if (got <= 0) {
+				c.state = FAILED;
+				--pending;
+				epoll_ctl(ep, EPOLL_CTL_DEL, c.fd, nullptr);
+				continue;
+			}
+			c.in.append(buf, got);
+			if (c.state == JOINING) {
+				c.received += countLines(c.in, " 366 ");
+				if (c.received >= opt.channels) {
+					c.state = REGISTERED;
+					--pending;
+				}
+			} else if (c.state == MESSAGING) {
+				c.received += countLines(c.in, " PRIVMSG ");
+				if (c.received >= opt.messages) {
+					c.state = REGISTERED;
+					--pending;
+					messagingEnd = Clock::now();
+				}
+			} else if (size_t welcome = c.in.find(" 001 "); welcome != string::npos) {
+				if (server.empty()) {
+					size_t from = c.in.rfind('\n', welcome);
+					from = (from == string::npos) ? 0 : from + 1;
+					server = c.in.substr(from + 1, welcome - from - 1); // ":<server> 001"
+				}
+				c.latency = chrono::duration<double, milli>(Clock::now() - c.start).count();
+				c.in.clear();
+				c.in.shrink_to_fit();
+				if (opt.channels > 0) {
+					string join = joinChannels(i, opt.channels);
+					c.state = send(c.fd, join.data(), join.size(), MSG_NOSIGNAL) == (ssize_t)join.size() ? JOINING : FAILED;
+					if (c.state == FAILED)
+						--pending;
+				} else if (opt.messages == 0) {
+					c.state = REGISTERED;
+					--pending;
+				} else if (!sendMessages(c, i, opt.messages)) {
+					c.state = FAILED;
+					--pending;
+				} else {
+					c.state = MESSAGING;
+					if (messagingBegin == Clock::time_point())
+						messagingBegin = Clock::now();
+				}
+			} else if (c.in.size() > 8192) {
+				c.in.erase(0, c.in.size() - 16);
+			}
+		}
+	}
+	double elapsed = chrono::duration<double>(Clock::now() - begin).count();
+	size_t alive = opt.soak ? soak(opt, clients, ep, server) : 0;
+
+	vector<double> latencies;
+	size_t failed = 0, delivered = 0;
+	for (const Client &c : clients) {
+		if (c.state == REGISTERED || c.state == MESSAGING || c.state == JOINING)
+			latencies.push_back(c.latency);
+		if (c.state != REGISTERED)
+			++failed;
+		delivered += c.received;
+	}
+	cout << "clients:        " << opt.clients << endl;
+	cout << "registered:     " << latencies.size() << endl;
+	cout << "failed/timeout: " << failed << endl;
+	cout << "elapsed:        " << elapsed << " s" << endl;
+	cout << "registrations/s " << latencies.size() / elapsed << endl;
+	cout << "latency p50:    " << percentile(latencies, 0.50) << " ms" << endl;
+	cout << "latency p99:    " << percentile(latencies, 0.99) << " ms" << endl;
+	if (opt.messages > 0) {
+		double messaging = chrono::duration<double>(messagingEnd - messagingBegin).count();
+		cout << "delivered:      " << delivered << " of " << opt.messages * opt.clients << endl;
+		cout << "messages/s      " << (messaging > 0 ? delivered / messaging : 0) << endl;
+	}
+	if (opt.soak)
+		cout << "soak:           " << alive << " of " << opt.clients << " alive after " << opt.soak << " s" << endl;
+	bool overBudget = false;
+	if (opt.server) {
+		this_thread::sleep_for(chrono::seconds(1)); // let the server finish flushing
+		size_t	residentAfter = residentBytes(opt.server);
+		size_t	perClient = latencies.empty() || residentAfter < residentBefore
+			? 0 : (residentAfter - residentBefore) / latencies.size();
+		overBudget = opt.budget && perClient > opt.budget;
+		cout << "server RSS:     " << residentBefore / 1024 << " KiB -> " << residentAfter / 1024 << " KiB" << endl;
+		cout << "per idle client " << perClient << " bytes";
+		if (opt.budget)
+			cout << " (budget " << opt.budget << (overBudget ? ", over" : ", ok") << ")";
+		cout << endl;
+	}
+
+	for (const Client &c : clients)
+		if (c.fd != -1)
+			close(c.fd);
+	close(ep);
+	return failed || overBudget || (opt.soak && alive < opt.clients) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
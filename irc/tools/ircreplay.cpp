@@ -0,0 +1,412 @@
+/*
+ircreplay - plays a traffic capture (IRCSERV_CAPTURE) against a server.
+
+	./ircreplay [-H host] [-p port] [-w password] [-s speed] [-t timeout] <capture>
+
+Every captured connection is opened, fed its lines and closed at the
+captured times, divided by speed: 1 is the original pace (default), 10
+ten times faster, 0 as fast as possible (lines keep their order per
+connection only). Captured PASS lines carry the password given with -w.
+What the server sends back is read and counted.
+
+A separate probe client sends a PING every PROBE_MS and times the PONG,
+so the report shows how responsive the server stayed under the replayed
+load, next to the time it took to take in the whole capture.
+*/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+#define CAPTURE_MAGIC	"IRCCAP"
+#define PROBE_MS		10
+#define PROBE			SIZE_MAX	// epoll tag of the probe client
+
+enum Kind : uint8_t { OPEN = 1, LINE = 2, CLOSE = 3, REMAP = 4 };
+
+struct Options {
+	string	host = "127.0.0.1";
+	int		port = 6667;
+	string	password = "pass123";
+	double	speed = 1;
+	int		timeout = 600;
+	string	capture;
+};
+
+// one step of the replay, on a connection numbered in order of appearance
+struct Step {
+	uint64_t	at;		// µs since the start of the capture
+	Kind		kind;
+	size_t		conn;
+	string		line;
+};
+
+struct Conn {
+	int		fd = -1;
+	bool	connected = false;
+	bool	closing = false;	// CLOSE seen, shut down once out is sent
+	string	out;
+	string	in;
+};
+
+static void usage() {
+	cerr << "Usage: ./ircreplay [-H host] [-p port] [-w password] [-s speed] [-t timeout] <capture>" << endl;
+	exit(EXIT_FAILURE);
+}
+
+static Options parseOptions(int ac, char **av) {
+	Options opt;
+
+	for (int i = 1; i < ac; ++i) {
+		string flag = av[i];
+		if (flag[0] != '-') {
+			opt.capture = flag;
+			continue;
+		}
+		if (i + 1 >= ac)
+			usage();
+		string value = av[++i];
+		if (flag == "-H")
+			opt.host = value;
+		else if (flag == "-p")
+			opt.port = stoi(value);
+		else if (flag == "-w")
+			opt.password = value;
+		else if (flag == "-s")
+			opt.speed = stod(value);
+		else if (flag == "-t")
+			opt.timeout = stoi(value);
+		else
+			usage();
+	}
+	if (opt.capture.empty())
+		usage();
+	return opt;
+}
+
+struct Reader {
+	const string	&in;
+	size_t			pos = 0;
+
+	bool		done() const { return pos >= in.size(); }
+	uint8_t		byte() {
+		if (pos >= in.size())
+			throw runtime_error("truncated capture");
+		return in[pos++];
+	}
+	uint64_t	varint() {
+		uint64_t v = 0;
+		for (int shift = 0; ; shift += 7) {
+			uint8_t b = byte();
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return v;
+		}
+	}
+	string		bytes(size_t n) {
+		if (pos + n > in.size())
+			throw runtime_error("truncated capture");
+		pos += n;
+		return in.substr(pos - n, n);
+	}
+};
+
+// where the command word starts, after the optional @tags and :prefix
+static size_t commandStart(const string &text) {
+	size_t pos = 0;
+
+	for (char lead : {'@', ':'}) {
+		if (pos < text.size() && text[pos] == lead) {
+			pos = text.find_first_not_of(' ', text.find(' ', pos));
+			if (pos == string::npos)
+				return text.size();
+		}
+	}
+	return pos;
+}
+
+/*
+Turns the capture into steps on numbered connections: fds are reused
+over time, and a hot upgrade renumbers them (REMAP records at the start
+of its segment). Connections a new segment does not carry over are
+closed at its start.
+*/
+static vector<Step> load(const Options &opt, size_t &connections) {
+	ifstream		file(opt.capture, ios::binary);
+	string			data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	Reader			in = {data};
+	vector<Step>	steps;
+	map<int, size_t>	byFd, carried;
+	uint64_t		first = 0, now = 0;
+	bool			remapping = false;
+
+	if (!file)
+		throw runtime_error("cannot read " + opt.capture);
+	connections = 0;
+	while (!in.done()) {
+		if (data.compare(in.pos, 6, CAPTURE_MAGIC) == 0) {
+			in.bytes(8);
+			uint64_t start = 0;
+			for (int i = 0; i < 8; ++i)
+				start |= uint64_t(in.byte()) << (8 * i);
+			if (first == 0)
+				first = start;
+			now = start > first ? start - first : now;
+			remapping = true;
+			carried.clear();
+			continue;
+		}
+		Kind	kind = static_cast<Kind>(in.byte());
+		now += in.varint();
+		int		fd = in.varint();
+
+		if (kind == REMAP) {
+			int old = in.varint();
+			if (byFd.count(old))
+				carried[fd] = byFd[old];
+			continue;
+		}
+		if (remapping) {
+			for (const auto &[oldFd, conn] : byFd) {
+				bool kept = false;
+				for (const auto &[newFd, c] : carried)
+					kept = kept || c == conn;
+				if (!kept)
+					steps.push_back({now, CLOSE, conn, ""});
+			}
+			byFd = carried;
+			remapping = false;
+		}
+		if (kind == OPEN) {
+			byFd[fd] = connections++;
+			steps.push_back({now, OPEN, byFd[fd], ""});
+		} else if (kind == LINE) {
+			string line = in.bytes(in.varint());
+			if (!byFd.count(fd))
+				continue;
+			size_t start = commandStart(line);
+			if (line.compare(start, 5, "PASS ") == 0 || line.compare(start, 5, "pass ") == 0)
+				line = line.substr(0, start + 5) + opt.password;
+			steps.push_back({now, LINE, byFd[fd], line + "\r\n"});
+		} else if (kind == CLOSE) {
+			if (byFd.count(fd))
+				steps.push_back({now, CLOSE, byFd[fd], ""});
+			byFd.erase(fd);
+		} else {
+			throw runtime_error("bad record in capture");
+		}
+	}
+	return steps;
+}
+
+static int openClient(const Options &opt) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void raiseFdLimit(size_t wanted) {
+	rlimit rl;
+
+	getrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur >= wanted)
+		return;
+	rl.rlim_cur = min<rlim_t>(wanted, rl.rlim_max);
+	setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+static double percentile(vector<double> &values, double p) {
+	if (values.empty())
+		return 0;
+	size_t at = min(values.size() - 1, (size_t)(p * values.size()));
+	nth_element(values.begin(), values.begin() + at, values.end());
+	return values[at];
+}
+
+// sends what the connection has queued; false when the socket failed
+static bool flushOut(Conn &c) {
+	while (c.connected && !c.out.empty()) {
+		ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if (n < 0 && errno == EAGAIN)
+			return true;
+		if (n <= 0)
+			return false;
+		c.out.erase(0, n);
+	}
+	if (c.connected && c.closing && c.out.empty())
+		shutdown(c.fd, SHUT_WR);
+	return true;
+}
+
+int main(int ac, char **av) {
+	Options			opt = parseOptions(ac, av);
+	size_t			count = 0;
+	vector<Step>	steps;
+
+	try {
+		steps = load(opt, count);
+	} catch (const exception &e) {
+		cerr << "ircreplay: " << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+	raiseFdLimit(count + 64);
+
+	vector<Conn>	conns(count);
+	Conn			probe;
+	int				ep = epoll_create1(EPOLL_CLOEXEC);
+	size_t			next = 0, lines = 0, failed = 0, open = 0;
+	uint64_t		received = 0;
+	vector<double>	rtts;
+	Clock::time_point	probeSent, probeDue;
+	bool			probeWaiting = false, probeReady = false;
+	string			server;		// the server's name, the only PING it answers
+
+	auto watch = [&](int fd, uint32_t events, size_t tag, int op) {
+		epoll_event ev = {events, {.u64 = tag}};
+		epoll_ctl(ep, op, fd, &ev);
+	};
+
+	probe.fd = openClient(opt);
+	if (probe.fd == -1) {
+		cerr << "ircreplay: cannot connect to " << opt.host << ":" << opt.port << endl;
+		return EXIT_FAILURE;
+	}
+	probe.out = "PASS " + opt.password + "\r\nNICK rprobe\r\nUSER probe probe localhost :ircreplay\r\n";
+	watch(probe.fd, EPOLLIN | EPOLLOUT, PROBE, EPOLL_CTL_ADD);
+
+	Clock::time_point	begin = Clock::now();
+	Clock::time_point	deadline = begin + chrono::seconds(opt.timeout);
+	vector<epoll_event>	events(1024);
+	char				buf[16384];
+	bool				drained = false;
+
+	while (Clock::now() < deadline) {
+		// issue every step that is due
+		double elapsed = chrono::duration<double, micro>(Clock::now() - begin).count();
+		for (; next < steps.size() && (opt.speed == 0 || steps[next].at / opt.speed <= elapsed); ++next) {
+			const Step	&step = steps[next];
+			Conn		&c = conns[step.conn];
+
+			if (step.kind == OPEN) {
+				c.fd = openClient(opt);
+				if (c.fd == -1) {
+					failed++;
+					continue;
+				}
+				open++;
+				watch(c.fd, EPOLLIN | EPOLLOUT, step.conn, EPOLL_CTL_ADD);
+			} else if (c.fd != -1 && step.kind == LINE) {
+				c.out += step.line;
+				lines++;
+				if (!flushOut(c))
+					failed++;
+			} else if (c.fd != -1 && step.kind == CLOSE) {
+				c.closing = true;
+				flushOut(c);
+			}
+		}
+
+		// once everything went out, one last PING: its PONG means the server took it all in
+		bool sent = next == steps.size() && all_of(conns.begin(), conns.end(),
+			[](const Conn &c) { return c.fd == -1 || c.out.empty(); });
+		if (probeReady && !probeWaiting && (Clock::now() >= probeDue || sent)) {
+			probe.out += "PING " + server + "\r\n";
+			flushOut(probe);
+			probeSent = Clock::now();
+			probeWaiting = true;
+			drained = sent;
+		}
+
+		int timeout = (opt.speed == 0 || next == steps.size()) ? PROBE_MS : 1;
+		int n = epoll_wait(ep, events.data(), events.size(), timeout);
+		for (int e = 0; e < n; ++e) {
+			size_t	tag = events[e].data.u64;
+			Conn	&c = (tag == PROBE) ? probe : conns[tag];
+
+			if (c.fd == -1)
+				continue;
+			if ((events[e].events & EPOLLOUT) && !c.connected) {
+				c.connected = true;
+				watch(c.fd, EPOLLIN, tag, EPOLL_CTL_MOD);
+			}
+			if (!flushOut(c) && tag != PROBE)
+				failed++;
+			if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+				continue;
+			ssize_t got = recv(c.fd, buf, sizeof(buf), 0);
+			if (got <= 0) {
+				close(c.fd);
+				c.fd = -1;
+				if (tag == PROBE) {
+					cerr << "ircreplay: the server closed the probe connection" << endl;
+					return EXIT_FAILURE;
+				}
+				open--;
+				continue;
+			}
+			received += got;
+			if (tag != PROBE)
+				continue;
+			c.in.append(buf, got);
+			for (size_t end; (end = c.in.find('\n')) != string::npos; c.in.erase(0, end + 1)) {
+				string line = c.in.substr(0, end);
+				if (!probeReady && line.find(" 001 ") != string::npos) {
+					server = line.substr(1, line.find(' ') - 1);
+					probeReady = true;
+					probeDue = Clock::now();
+				} else if (probeWaiting && line.find(" PONG ") != string::npos) {
+					rtts.push_back(chrono::duration<double, milli>(Clock::now() - probeSent).count());
+					probeWaiting = false;
+					probeDue = Clock::now() + chrono::milliseconds(PROBE_MS);
+				}
+			}
+		}
+		if (drained && !probeWaiting)
+			break;
+	}
+	double elapsed = chrono::duration<double>(Clock::now() - begin).count();
+	double captured = steps.empty() ? 0 : steps.back().at / 1e6;
+
+	cout << "connections:    " << count << endl;
+	cout << "lines:          " << lines << endl;
+	cout << "failed:         " << failed << endl;
+	cout << "captured span:  " << captured << " s" << endl;
+	cout << "elapsed:        " << elapsed << " s" << (drained && !probeWaiting ? "" : " (timeout)") << endl;
+	cout << "lines/s         " << lines / elapsed << endl;
+	cout << "received:       " << received << " bytes" << endl;
+	cout << "probe RTT p50:  " << percentile(rtts, 0.50) << " ms" << endl;
+	cout << "probe RTT p99:  " << percentile(rtts, 0.99) << " ms" << endl;
+	cout << "probe RTT max:  " << (rtts.empty() ? 0 : *max_element(rtts.begin(), rtts.end())) << " ms" << endl;
+
+	for (const Conn &c : conns)
+		if (c.fd != -1)
+			close(c.fd);
+	close(probe.fd);
+	close(ep);
+	return (failed || !drained) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/*
+ircsim - the server on a simulated network (SimNet), in one process.
+
+	./ircsim [-n clients] [-c channel size] [-m messages]
+
+No sockets and no kernel: the clients are SimNet connections, the clock
+is virtual and moves one millisecond per loop round, and every run with
+the same options does the same work in the same order. What is left to
+time is the server itself: parsing, dispatch, fan-out and the queues.
+
+Three phases, each run until the server has nothing left to read:
+	register	every client sends PASS, NICK and USER (and must get 001)
+	join		every client joins its channel, -c clients each (default 50)
+	message		every client sends -m PRIVMSGs to its channel (default 10)
+and each reports its wall time, commands per second, the bytes the
+server wrote and the server's heap allocations per command: operator new
+is counted here, what the Arena hands out is not (includes/Arena.hpp).
+The message phase only counts the lines clients receive and checks that
+every one of them got all of its channel's messages.
+*/
+
+#include "Server.hpp"
+#include "SimNet.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+#define SIM_PASSWORD	"sim"
+#define SIM_TICK		0.001	// virtual seconds per loop round
+
+static size_t allocations;	// calls to operator new, the server runs on this thread only
+
+void *operator new(size_t size)
+{
+	allocations++;
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Options
+{
+	size_t	clients = 100000;
+	size_t	channel = 50;
+	size_t	messages = 10;
+};
+
+static void usage(const char *argv0)
+{
+	cerr << "usage: " << argv0 << " [-n clients] [-c channel size] [-m messages]" << endl;
+	exit(2);
+}
+
+// loop rounds until every client's input has been read
+static size_t drain(Server &server, SimNet &net)
+{
+	size_t rounds = 0;
+
+	do {
+		server.iterate();
+		net.advance(SIM_TICK);
+		rounds++;
+	} while (!net.idle());
+	return rounds;
+}
+
+static void report(const char *phase, size_t commands, Clock::time_point began, size_t rounds,
+	size_t written, size_t allocated)
+{
+	double seconds = chrono::duration<double>(Clock::now() - began).count();
+
+	printf("%-8s %10zu commands %8.3f s %12.0f commands/s %6zu rounds %10.1f MB written %8.2f allocs/command\n",
+		phase, commands, seconds, commands / seconds, rounds, written / 1e6, double(allocated) / commands);
+}
+
+int main(int argc, char **argv)
+{
+	Options	options;
+	int		opt;
+
+	while ((opt = getopt(argc, argv, "n:c:m:")) != -1) {
+		switch (opt) {
+			case 'n': options.clients = stoul(optarg); break;
+			case 'c': options.channel = stoul(optarg); break;
+			case 'm': options.messages = stoul(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (!options.clients || !options.channel)
+		usage(argv[0]);
+
+	Config config;
+	config.logLevel = ERROR;
+	config.io.floodBurst = 0;	// every client sends its whole phase at once
+
+	unique_ptr<SimNet>	transport = make_unique<SimNet>();
+	SimNet				&net = *transport;
+	Server				server(SIM_PASSWORD, config, std::move(transport));
+	vector<int>			clients(options.clients);
+	size_t				written = 0;
+	size_t				failed = 0;
+
+	Clock::time_point began = Clock::now();
+	for (size_t i = 0; i < options.clients; ++i) {
+		string nick = "s" + to_string(i);
+		clients[i] = net.connect();
+		net.send(clients[i], "PASS " SIM_PASSWORD "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 sim :" + nick + "\r\n");
+	}
+	size_t allocated = allocations;
+	size_t rounds = drain(server, net);
+	report("register", 3 * options.clients, began, rounds, net.bytesWritten() - written, allocations - allocated);
+	written = net.bytesWritten();
+	for (int fd : clients)
+		if (net.take(fd).find(" 001 ") == string::npos)
+			failed++;
+	if (failed) {
+		cerr << failed << " clients did not register" << endl;
+		return 1;
+	}
+
+	net.keepInboxes(false);
+	began = Clock::now();
+	for (size_t i = 0; i < options.clients; ++i)
+		net.send(clients[i], "JOIN #sim" + to_string(i / options.channel) + "\r\n");
+	allocated = allocations;
+	rounds = drain(server, net);
+	report("join", options.clients, began, rounds, net.bytesWritten() - written, allocations - allocated);
+	written = net.bytesWritten();
+
+	vector<size_t> before(options.clients);
+	for (size_t i = 0; i < options.clients; ++i)
+		before[i] = net.lines(clients[i]);
+	began = Clock::now();
+	for (size_t i = 0; i < options.clients; ++i) {
+		string line = "PRIVMSG #sim" + to_string(i / options.channel) + " :message from s" + to_string(i) + "\r\n";
+		string burst;
+		for (size_t m = 0; m < options.messages; ++m)
+			burst += line;
+		net.send(clients[i], burst);
+	}
+	allocated = allocations;
+	rounds = drain(server, net);
+	report("message", options.messages * options.clients, began, rounds, net.bytesWritten() - written,
+		allocations - allocated);
+	printf("arena spills: %llu\n", (unsigned long long)Arena::spills);
+
+	// everyone hears the others in their channel, the last channel may be short
+	for (size_t i = 0; i < options.clients; ++i) {
+		size_t first = i / options.channel * options.channel;
+		size_t members = min(options.channel, options.clients - first);
+		if (net.lines(clients[i]) - before[i] != options.messages * (members - 1))
+			failed++;
+	}
+	if (failed) {
+		cerr << failed << " clients missed messages" << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ircsimd - microbenchmarks for the byte kernels in srcs/Simd.cpp.
+
+	./ircsimd [-s milliseconds per case]
+
+Every kernel the CPU supports (scalar, sse2, avx2) is run on the same
+inputs, next to the code it replaced, which is copied here as before*:
+	framing		splitting 64 KiB of client traffic into lines
+	fold		lowercasing nick-sized keys and a 64 KiB buffer
+	compare		comparing nick pairs without regard to case
+	utf8		validating mostly-ASCII text with some multi-byte characters
+	trim		stripping the end of command arguments
+	channel		checking channel names
+Each case reports bytes per cycle (time stamp counter cycles) and
+nanoseconds per call. Built with -O2, like a release build would be.
+*/
+
+#include "Simd.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+#define BUFFER_BYTES	65536
+#define KEYS			4096
+
+static double	budgetMs = 200;
+static uint64_t	sink;	// results go here, so nothing is optimized away
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+#endif
+}
+
+// runs body until the budget is spent, body returns the bytes it went through
+static void measure(const string &name, const string &variant, size_t calls, const function<size_t()> &body)
+{
+	size_t				bytes = 0, runs = 0;
+	Clock::time_point	began = Clock::now();
+	uint64_t			start = cycles();
+
+	while (runs < 3 || Clock::now() - began < chrono::duration<double, milli>(budgetMs)) {
+		bytes += body();
+		runs++;
+	}
+	uint64_t spent = cycles() - start;
+	double ns = chrono::duration<double, nano>(Clock::now() - began).count();
+	printf("%-8s %-14s %8.3f bytes/cycle %10.1f ns/call\n", name.c_str(), variant.c_str(),
+		double(bytes) / spent, ns / (runs * calls));
+}
+
+// the code the kernels replaced
+
+static size_t beforeFraming(const string &buffer)
+{
+	istringstream	stream(buffer);
+	string			line;
+	size_t			lines = 0;
+
+	while (getline(stream, line))
+		lines += !line.empty() && line != "\r";
+	return lines;
+}
+
+static size_t beforeFindCrLf(const string &buffer)
+{
+	size_t lines = 0;
+
+	for (size_t start = 0, end; (end = buffer.find("\r\n", start)) != string::npos; start = end + 2)
+		lines++;
+	return lines;
+}
+
+static string beforeLower(const string &s)
+{
+	string result = s;
+	transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return tolower(c); });
+	return result;
+}
+
+static string beforeTrim(const string &str)
+{
+	const string	spaces = " \r\n\t\f\v:";
+	size_t			end;
+
+	if (str.find_first_not_of(spaces) == string::npos)
+		return "";
+	for (end = str.size() - 1;; --end)
+		if (spaces.find(str[end]) == string::npos)
+			break;
+	return str.substr(0, end + 1);
+}
+
+static bool beforeChannel(const string &name)
+{
+	static const regex channelRegex(R"(^[&#+!][^\x07\s,]*$)");
+	return regex_match(name, channelRegex);
+}
+
+// and what replaced them, where it is not a kernel
+
+static string_view afterTrim(string_view str)
+{
+	size_t end = str.size();
+
+	while (end && (str[end - 1] == ' ' || str[end - 1] == ':' || (str[end - 1] >= '\t' && str[end - 1] <= '\r')))
+		--end;
+	return str.substr(0, end);
+}
+
+static bool afterChannel(const string &name)
+{
+	return string("&#+!").find(name[0]) != string::npos && name.find_first_of(" \x07,\t\n\v\f\r", 1) == string::npos;
+}
+
+// inputs
+
+static string traffic()
+{
+	static const char *lines[] = {
+		"PRIVMSG #general :did anyone look at the release notes yet?\r\n",
+		"@label=a17;time=2026-10-19T12:00:00.000Z PRIVMSG #dev :build is green again\r\n",
+		"PING :IRCS\r\n",
+		"JOIN #random\r\n",
+		"NOTICE bob :ok\r\n",
+		"PRIVMSG alice,carol :lunch at noon, same place as last week? i'll book a table for four\r\n",
+	};
+	string buffer;
+
+	for (size_t i = 0; buffer.size() < BUFFER_BYTES; ++i)
+		buffer += lines[i * 7 % 6];
+	return buffer;
+}
+
+static string text()
+{
+	static const char *words[] = {"hello ", "world ", "ça va ", "grüße ", "the ", "quick ", "brown ", "fox ",
+		"日本語 ", "ok ", "✓ ", "done ", "😀 ", "jumps ", "over ", "lazy "};
+	string buffer;
+
+	for (size_t i = 0; buffer.size() < BUFFER_BYTES; ++i)
+		buffer += words[(i * 11 + i / 16) % 16];
+	return buffer;
+}
+
+static vector<string> keys()
+{
+	static const char *nicks[] = {"alice", "Bob", "CarolAnn", "dave_", "EveLyn[away]", "frank", "GrumpyCat42", "h"};
+	vector<string> result;
+
+	for (size_t i = 0; i < KEYS; ++i)
+		result.push_back(string(nicks[i % 8]) + to_string(i));
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		if (opt != 's') {
+			fprintf(stderr, "usage: %s [-s milliseconds per case]\n", argv[0]);
+			return 2;
+		}
+		budgetMs = stod(optarg);
+	}
+
+	const string			lines = traffic(), utf8 = text();
+	const vector<string>	nicks = keys();
+	vector<string>			upper = nicks;
+	vector<string>			arguments, channels;
+	size_t					nickBytes = 0;
+
+	for (string &nick : upper) {
+		transform(nick.begin(), nick.end(), nick.begin(), [](unsigned char c) { return toupper(c); });
+		nickBytes += nick.size();
+	}
+	for (size_t i = 0; i < KEYS; ++i) {
+		arguments.push_back("#general :message number " + to_string(i) + (i % 3 ? "\r" : "  :"));
+		channels.push_back((i % 4 ? "#chan" : "&Local-") + to_string(i));
+	}
+	size_t argumentBytes = 0, channelBytes = 0;
+	for (size_t i = 0; i < KEYS; ++i) {
+		argumentBytes += arguments[i].size();
+		channelBytes += channels[i].size();
+	}
+
+	measure("framing", "before getline", 1, [&] { sink += beforeFraming(lines); return lines.size(); });
+	measure("framing", "before find", 1, [&] { sink += beforeFindCrLf(lines); return lines.size(); });
+	for (const SimdKernels *k : Simd::supported())
+		measure("framing", k->name, 1, [&] {
+			size_t count = 0;
+			for (size_t start = 0; start < lines.size(); ) {
+				size_t end = start + k->findEol(lines.data() + start, lines.size() - start);
+				count++;
+				if (lines.compare(end, 2, "\r\n") == 0)
+					start = end + 2;
+				else if ((start = lines.find('\n', end) + 1) == 0)
+					break;
+			}
+			sink += count;
+			return lines.size();
+		});
+
+	measure("fold", "before keys", KEYS, [&] {
+		for (const string &nick : upper)
+			sink += beforeLower(nick).size();
+		return nickBytes;
+	});
+	for (const SimdKernels *k : Simd::supported())
+		measure("fold", string(k->name) + " keys", KEYS, [&] {
+			for (const string &nick : upper) {
+				string copy = nick;
+				k->fold(copy.data(), copy.size());
+				sink += copy.size();
+			}
+			return nickBytes;
+		});
+	measure("fold", "before 64K", 1, [&] { sink += beforeLower(lines).size(); return lines.size(); });
+	for (const SimdKernels *k : Simd::supported())
+		measure("fold", string(k->name) + " 64K", 1, [&] {
+			string copy = lines;
+			k->fold(copy.data(), copy.size());
+			sink += copy.size();
+			return lines.size();
+		});
+
+	measure("compare", "before", KEYS, [&] {
+		for (size_t i = 0; i < KEYS; ++i)
+			sink += beforeLower(nicks[i]) == beforeLower(upper[i]);
+		return nickBytes;
+	});
+	for (const SimdKernels *k : Simd::supported())
+		measure("compare", k->name, KEYS, [&] {
+			for (size_t i = 0; i < KEYS; ++i)
+				sink += nicks[i].size() == upper[i].size() && k->equalFolded(nicks[i].data(), upper[i].data(), nicks[i].size());
+			return nickBytes;
+		});
+
+	for (const SimdKernels *k : Simd::supported())
+		measure("utf8", k->name, 1, [&] { sink += k->validUtf8(utf8.data(), utf8.size()); return utf8.size(); });
+	for (const SimdKernels *k : Simd::supported())
+		measure("utf8", string(k->name) + " ascii", 1, [&] { sink += k->validUtf8(lines.data(), lines.size()); return lines.size(); });
+
+	measure("trim", "before", KEYS, [&] {
+		for (const string &a : arguments)
+			sink += beforeTrim(a).size();
+		return argumentBytes;
+	});
+	measure("trim", "after", KEYS, [&] {
+		for (const string &a : arguments)
+			sink += string(afterTrim(a)).size();
+		return argumentBytes;
+	});
+
+	measure("channel", "before regex", KEYS, [&] {
+		for (const string &c : channels)
+			sink += beforeChannel(c);
+		return channelBytes;
+	});
+	measure("channel", "after", KEYS, [&] {
+		for (const string &c : channels)
+			sink += afterChannel(c);
+		return channelBytes;
+	});
+	return sink == 0;
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Soak test: starts a fresh server, registers SOAK_CLIENTS clients with
+# ircbench, holds them for SOAK_SECONDS and checks that every one still
+# answers. Both processes need a hard fd limit above the client count
+# (ulimit -Hn, LimitNOFILE=); the soft limits are raised to it.
+
+CLIENTS=${SOAK_CLIENTS:-100000}
+HOLD=${SOAK_SECONDS:-60}
+PORT=${SOAK_PORT:-6667}
+CONFIG=$(mktemp)
+
+printf 'log_level = error\nbacklog = 65535\n' > "$CONFIG"
+ulimit -n "$(ulimit -Hn)"
+if [ "$(ulimit -n)" != unlimited ] && [ "$(ulimit -n)" -le "$CLIENTS" ]; then
+	echo "soak: fd limit $(ulimit -n) is too low for $CLIENTS clients" >&2
+	rm -f "$CONFIG"
+	exit 1
+fi
+
+IRCSERV_CONFIG="$CONFIG" ./ircserv "$PORT" soak1234 &
+SERVER=$!
+sleep 1
+./ircbench -p "$PORT" -w soak1234 -n "$CLIENTS" -s "$HOLD" -t 600 -P "$SERVER"
+STATUS=$?
+
+kill "$SERVER"
+wait "$SERVER" 2>/dev/null
+rm -f "$CONFIG"
+exit $STATUS